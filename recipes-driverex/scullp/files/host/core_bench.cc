@@ -0,0 +1,153 @@
+/*
+ * core_bench: microbenchmarks of the scull storage core on the build
+ * host, so changes to the quantum arithmetic or the page ring can be
+ * measured without loading the module. The module's own numbers come
+ * from debugfs scullp/core_bench and the testskull tools.
+ */
+#include <benchmark/benchmark.h>
+#include <vector>
+
+extern "C" {
+#include "scull-core.h"
+}
+
+static void dev_init(struct scull_dev *dev, int quantum, int qset)
+{
+	memset(dev, 0, sizeof(*dev));
+	dev->quantum = quantum;
+	dev->qset = qset;
+	sema_init(&dev->sem, 1);
+}
+
+/*
+ * Sequential writes of one block size into a device trimmed every 64M.
+ * Like write(2) on the device, a call stops at the end of a quantum.
+ */
+static void BM_StoreWrite(benchmark::State &state)
+{
+	size_t block = state.range(0);
+	std::vector<char> buf(block, 0x5a);
+	struct scull_dev dev;
+	int64_t bytes = 0;
+	loff_t pos = 0;
+
+	dev_init(&dev, SCULL_QUANTUM, SCULL_QSET);
+	for (auto _ : state) {
+		if (pos >= (64 << 20)) {
+			state.PauseTiming();
+			scull_trim(&dev);
+			pos = 0;
+			state.ResumeTiming();
+		}
+		bytes += scull_store_write(&dev, buf.data(), block, &pos);
+	}
+	scull_trim(&dev);
+	state.SetBytesProcessed(bytes);
+}
+BENCHMARK(BM_StoreWrite)->RangeMultiplier(4)->Range(64, 256 << 10);
+
+/* sequential reads of a 16M device */
+static void BM_StoreRead(benchmark::State &state)
+{
+	size_t block = state.range(0);
+	const loff_t total = 16 << 20;
+	std::vector<char> buf(block > 64 << 10 ? block : 64 << 10, 0x5a);
+	struct scull_dev dev;
+	int64_t bytes = 0;
+	loff_t pos = 0;
+
+	dev_init(&dev, SCULL_QUANTUM, SCULL_QSET);
+	while (pos < total)
+		scull_store_write(&dev, buf.data(), buf.size(), &pos);
+	pos = 0;
+	for (auto _ : state) {
+		if (pos >= total)
+			pos = 0;
+		bytes += scull_store_read(&dev, buf.data(), block, &pos);
+	}
+	scull_trim(&dev);
+	state.SetBytesProcessed(bytes);
+}
+BENCHMARK(BM_StoreRead)->RangeMultiplier(4)->Range(64, 256 << 10);
+
+/* walking to the last qset: the cost grows with the device size */
+static void BM_Follow(benchmark::State &state)
+{
+	const int quantum = 4096, qset = 16;
+	int nsets = state.range(0);
+	std::vector<char> buf(quantum, 0);
+	struct scull_dev dev;
+	loff_t pos = 0;
+
+	dev_init(&dev, quantum, qset);
+	while (pos < (loff_t)nsets * quantum * qset)
+		scull_store_write(&dev, buf.data(), quantum, &pos);
+	for (auto _ : state)
+		benchmark::DoNotOptimize(scull_follow(&dev, nsets - 1));
+	scull_trim(&dev);
+	state.SetComplexityN(nsets);
+}
+BENCHMARK(BM_Follow)->RangeMultiplier(8)->Range(1, 4096)->Complexity(benchmark::oN);
+
+/* freeing a device of the given size */
+static void BM_Trim(benchmark::State &state)
+{
+	loff_t size = state.range(0);
+	std::vector<char> buf(64 << 10, 0);
+	struct scull_dev dev;
+	loff_t pos;
+
+	dev_init(&dev, SCULL_QUANTUM, SCULL_QSET);
+	for (auto _ : state) {
+		state.PauseTiming();
+		for (pos = 0; pos < size; )
+			scull_store_write(&dev, buf.data(), buf.size(), &pos);
+		state.ResumeTiming();
+		scull_trim(&dev);
+	}
+	state.SetBytesProcessed(state.iterations() * size);
+}
+BENCHMARK(BM_Trim)->Arg(1 << 20)->Arg(16 << 20);
+
+/* a pipe ring in stream mode: put a block, get it back */
+static void BM_RingBytes(benchmark::State &state)
+{
+	size_t block = state.range(0);
+	std::vector<char> in(block, 0x5a), out(block);
+	struct scull_p_ring ring = { };
+
+	if (scull_p_ring_alloc(&ring, scull_p_size_to_pages(1 << 20))) {
+		state.SkipWithError("ring allocation failed");
+		return;
+	}
+	for (auto _ : state) {
+		scull_p_putbytes(&ring, in.data(), block);
+		scull_p_getbytes(&ring, &ring.rp, out.data(), block);
+	}
+	scull_p_ring_release(&ring);
+	state.SetBytesProcessed(state.iterations() * block);
+}
+BENCHMARK(BM_RingBytes)->RangeMultiplier(4)->Range(16, 64 << 10);
+
+/* the same in record mode, headers included */
+static void BM_RingRecords(benchmark::State &state)
+{
+	size_t block = state.range(0);
+	std::vector<char> in(block, 0x5a), out(block);
+	struct scull_p_ring ring = { };
+
+	if (scull_p_ring_alloc(&ring, scull_p_size_to_pages(1 << 20))) {
+		state.SkipWithError("ring allocation failed");
+		return;
+	}
+	for (auto _ : state) {
+		scull_p_putrecord(&ring, in.data(), block);
+		scull_p_getrecord(&ring, &ring.rp, out.data(), block);
+	}
+	scull_p_ring_release(&ring);
+	state.SetItemsProcessed(state.iterations());
+	state.SetBytesProcessed(state.iterations() * block);
+}
+BENCHMARK(BM_RingRecords)->RangeMultiplier(4)->Range(16, 64 << 10);
+
+BENCHMARK_MAIN();
@@ -0,0 +1,146 @@
+#ifndef _SCULL_SHIM_H_
+#define _SCULL_SHIM_H_
+
+/*
+ * Just enough of the kernel for scull-core.c to build as a user-space
+ * library: the allocators are malloc(), a page is a page aligned block,
+ * the semaphore is a mutex and "user" pointers are plain pointers.
+ * Also safe to include from C++.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/types.h>
+
+typedef uint32_t u32;
+typedef uint64_t u64;
+
+#define __user
+#define GFP_KERNEL 0
+#define ERESTARTSYS 512
+
+#define PAGE_SHIFT 12
+#define PAGE_SIZE (1UL << PAGE_SHIFT)
+#define PAGE_MASK (~(PAGE_SIZE - 1))
+
+#define pr_debug(...) do { } while (0)
+
+#define READ_ONCE(x) __atomic_load_n(&(x), __ATOMIC_RELAXED)
+#define smp_load_acquire(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define smp_store_release(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+
+#ifndef __cplusplus
+#define min(a, b) ((a) < (b) ? (a) : (b))
+#define max(a, b) ((a) > (b) ? (a) : (b))
+#define min_t(t, a, b) min((t)(a), (t)(b))
+#endif
+
+struct cdev {
+	int unused;
+};
+
+struct semaphore {
+	pthread_mutex_t lock;
+};
+
+static inline void sema_init(struct semaphore *sem, int val)
+{
+	(void)val; /* scull only uses it as a mutex */
+	pthread_mutex_init(&sem->lock, NULL);
+}
+
+static inline int down_interruptible(struct semaphore *sem)
+{
+	return pthread_mutex_lock(&sem->lock) ? -ERESTARTSYS : 0;
+}
+
+static inline void up(struct semaphore *sem)
+{
+	pthread_mutex_unlock(&sem->lock);
+}
+
+static inline void *kmalloc(size_t size, int flags)
+{
+	(void)flags;
+	return malloc(size);
+}
+
+static inline void kfree(const void *p)
+{
+	free((void *)p);
+}
+
+static inline void *kvcalloc(size_t n, size_t size, int flags)
+{
+	(void)flags;
+	return calloc(n, size);
+}
+
+static inline void kvfree(const void *p)
+{
+	free((void *)p);
+}
+
+/* struct page is never defined; a page pointer is the page itself */
+struct page;
+
+static inline struct page *alloc_page(int flags)
+{
+	void *p;
+
+	(void)flags;
+	if (posix_memalign(&p, PAGE_SIZE, PAGE_SIZE))
+		return NULL;
+	return (struct page *)p;
+}
+
+static inline void __free_page(struct page *page)
+{
+	free(page);
+}
+
+/* pages are never shared in user space, so the last put frees */
+static inline void put_page(struct page *page)
+{
+	free(page);
+}
+
+static inline void *page_address(struct page *page)
+{
+	return page;
+}
+
+static inline unsigned long get_zeroed_page(int flags)
+{
+	struct page *page = alloc_page(flags);
+
+	if (page)
+		memset(page, 0, PAGE_SIZE);
+	return (unsigned long)page;
+}
+
+static inline void free_page(unsigned long addr)
+{
+	free((void *)addr);
+}
+
+static inline unsigned long copy_to_user(void *to, const void *from, unsigned long n)
+{
+	memcpy(to, from, n);
+	return 0;
+}
+
+static inline unsigned long copy_from_user(void *to, const void *from, unsigned long n)
+{
+	memcpy(to, from, n);
+	return 0;
+}
+
+static inline unsigned long roundup_pow_of_two(unsigned long n)
+{
+	return n < 2 ? 1 : 1UL << (8 * sizeof(long) - __builtin_clzl(n - 1));
+}
+
+#endif /* _SCULL_SHIM_H_ */
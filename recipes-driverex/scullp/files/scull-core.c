@@ -0,0 +1,480 @@
+/*
+ * scull-core.c -- the storage of the scull devices: the quantum sets of
+ * scull_char and the page rings of the pipes.
+ *
+ * Nothing here knows about files, wait queues or the rest of the kernel;
+ * it only allocates, locks and copies, so the same source builds into
+ * the module and, through host/scull-shim.h, into a user-space library
+ * for benchmarking on the build host.
+ */
+#include "scull-core.h"
+
+#ifndef __KERNEL__
+/* the module parameters live in scullp-main.c */
+int scull_quantum = SCULL_QUANTUM;
+int scull_qset = SCULL_QSET;
+#endif
+
+/*-----------------------------------------------------------------------------------------*/
+/*
+ * Empty out the scull device; must be called with the device
+ * semaphore held.
+ */
+int scull_trim(struct scull_dev *dev)
+{
+    struct scull_qset *next, *dptr;
+    int qset = dev->qset;   /* "dev" is not-null */
+    int i;
+
+    for (dptr = dev->data; dptr; dptr = next) { /* all the list items */
+        if (dptr->data) {
+            for (i = 0; i < qset; i++)
+                kfree(dptr->data[i]);
+            kfree(dptr->data);
+            dptr->data = NULL;
+        }
+        next = dptr->next;
+        kfree(dptr);
+    }
+    dev->size = 0;
+    dev->quantum = scull_quantum;
+    dev->qset = scull_qset;
+    dev->data = NULL;
+    return 0;
+}
+
+/*
+ * Follow the list
+ */
+struct scull_qset *scull_follow(struct scull_dev *dev, int n)
+{
+    struct scull_qset *qs = dev->data;
+
+        /* Allocate first qset explicitly if need be */
+    if (! qs) {
+        qs = dev->data = kmalloc(sizeof(struct scull_qset), GFP_KERNEL);
+        if (qs == NULL)
+            return NULL;  /* Never mind */
+        memset(qs, 0, sizeof(struct scull_qset));
+    }
+
+    /* Then follow the list */
+    while (n--) {
+        if (!qs->next) {
+            qs->next = kmalloc(sizeof(struct scull_qset), GFP_KERNEL);
+            if (qs->next == NULL)
+                return NULL;  /* Never mind */
+            memset(qs->next, 0, sizeof(struct scull_qset));
+        }
+        qs = qs->next;
+        continue;
+    }
+    return qs;
+}
+
+/*
+ * Where byte pos lives: the list item, the quantum within its set and
+ * the offset within that quantum.
+ */
+void scull_locate(struct scull_dev *dev, loff_t pos, int *item, int *s_pos, int *q_pos)
+{
+    int quantum = dev->quantum, qset = dev->qset;
+    long itemsize = (long)quantum * qset; /* how many bytes in the listitem */
+    long rest;
+
+    *item = (long)pos / itemsize;
+    rest = (long)pos % itemsize;
+    *s_pos = rest / quantum; *q_pos = rest % quantum;
+}
+
+/*
+ * The quantum at s_pos of list item "item", allocated along with the
+ * item and its array of quanta if need be; NULL when out of memory.
+ */
+char *scull_get_quantum(struct scull_dev *dev, int item, int s_pos)
+{
+    struct scull_qset *dptr;
+
+    /* follow the list up to the right position */
+    dptr = scull_follow(dev, item);
+    if (dptr == NULL)
+        return NULL;
+    if (!dptr->data) {
+        dptr->data = kmalloc(dev->qset * sizeof(char *), GFP_KERNEL);
+        if (!dptr->data)
+            return NULL;
+        memset(dptr->data, 0, dev->qset * sizeof(char *));
+    }
+    if (!dptr->data[s_pos])
+        dptr->data[s_pos] = kmalloc(dev->quantum, GFP_KERNEL);
+    return dptr->data[s_pos];
+}
+
+ssize_t scull_store_read(struct scull_dev *dev, char __user * buf, size_t count, loff_t * f_pos)
+{
+    struct scull_qset *dptr;    /* the first listitem */
+    int quantum = dev->quantum;
+    int item, s_pos, q_pos;
+    ssize_t retval = 0;
+
+    if (down_interruptible(&dev->sem))
+        return -ERESTARTSYS;
+
+    if (*f_pos >= dev->size)
+        goto out;
+    if (*f_pos + count > dev->size)
+        count = dev->size - *f_pos;
+
+    scull_locate(dev, *f_pos, &item, &s_pos, &q_pos);
+
+    pr_debug("Read item: %d\t s_pos: %d\tq_pos: %d\tf_pos: %llu",item,s_pos,q_pos,*f_pos);
+
+    /* follow the list up to the right position (defined elsewhere) */
+    dptr = scull_follow(dev, item);
+
+    if (dptr == NULL || !dptr->data || ! dptr->data[s_pos])
+        goto out; /* don't fill holes */
+
+    /* read only up to the end of this quantum */
+    if (count > quantum - q_pos)
+        count = quantum - q_pos;
+
+    if (copy_to_user(buf, dptr->data[s_pos] + q_pos, count)) {
+        retval = -EFAULT;
+        goto out;
+    }
+
+    pr_debug("read %lu chars",count);
+    *f_pos += count;
+    retval = count;
+
+  out:
+    up(&dev->sem);
+    return retval;
+}
+
+ssize_t scull_store_write(struct scull_dev *dev, const char __user * buf, size_t count, loff_t * f_pos)
+{
+    int quantum = dev->quantum;
+    int item, s_pos, q_pos;
+    char *data;
+    ssize_t retval = -ENOMEM; /* value used in "goto out" statements */
+
+    if (down_interruptible(&dev->sem))
+        return -ERESTARTSYS;
+
+    scull_locate(dev, *f_pos, &item, &s_pos, &q_pos);
+
+    pr_debug("Write item: %d\t s_pos: %d\tq_pos: %d\tf_pos: %llu",item,s_pos,q_pos,*f_pos);
+
+    data = scull_get_quantum(dev, item, s_pos);
+    if (data == NULL)
+        goto out;
+    /* write only up to the end of this quantum */
+    if (count > quantum - q_pos)
+        count = quantum - q_pos;
+
+    if (copy_from_user(data + q_pos, buf, count)) {
+        retval = -EFAULT;
+        goto out;
+    }
+
+    pr_debug("wrote %lu characters",count);
+    *f_pos += count;
+    retval = count;
+
+        /* update the size */
+    if (dev->size < *f_pos)
+        dev->size = *f_pos;
+
+  out:
+    up(&dev->sem);
+    return retval;
+}
+
+/*-----------------------------------------------------------------------------------------*/
+
+/*
+The ring is an array of pages whose count is a power of two, so the
+free running rp/wp counters are simply masked into it. The helpers below
+move n bytes starting at counter value pos; callers hold the device
+semaphore and have already checked that the bytes (or the room for
+them) are there.
+*/
+unsigned int scull_p_size_to_pages(unsigned long size)
+{
+	if(size < PAGE_SIZE)
+		size = PAGE_SIZE;
+	return roundup_pow_of_two(size >> PAGE_SHIFT);
+}
+
+void scull_p_ring_release(struct scull_p_ring *ring)
+{
+	unsigned int i;
+
+	if(!ring->pages)
+		return;
+	/*
+	Pages stolen from a pipe by splice may still be referenced
+	elsewhere, so drop our reference instead of freeing outright.
+	*/
+	for(i = 0; i < ring->npages; i++)
+		if(ring->pages[i])
+			put_page(ring->pages[i]);
+	kvfree(ring->pages);
+	ring->pages = NULL;
+	if(ring->ctrl)
+		free_page((unsigned long)ring->ctrl);
+	ring->ctrl = NULL;
+}
+
+int scull_p_ring_alloc(struct scull_p_ring *ring, unsigned int npages)
+{
+	unsigned int i;
+
+	ring->pages = kvcalloc(npages, sizeof(struct page *), GFP_KERNEL);
+	if(!ring->pages)
+		return -ENOMEM;
+	ring->npages = npages;
+	ring->size = (unsigned long)npages << PAGE_SHIFT;
+	for(i = 0; i < npages; i++){
+		ring->pages[i] = alloc_page(GFP_KERNEL);
+		if(!ring->pages[i]){
+			scull_p_ring_release(ring);
+			return -ENOMEM;
+		}
+	}
+	ring->rp = ring->wp = 0; /* rd and wr from the beginning */
+	return 0;
+}
+
+unsigned long scull_p_ring_used(struct scull_p_ring *ring)
+{
+	return ring->wp - ring->rp;
+}
+
+/*
+A pipe ring also has a control page that user space may map (see
+scull_p_mmap) and use to produce or consume without system calls. The
+page mirrors the counters: the semaphore holders pick up what the
+mapping did with scull_p_ring_sync() and hand back their own moves with
+scull_p_publish_wp/rp(), each side storing only the index it owns.
+*/
+void scull_p_ring_sync(struct scull_p_ring *ring)
+{
+	unsigned long wp, rp;
+
+	if(!ring->ctrl)
+		return;
+	wp = ring->wp + (u32)(smp_load_acquire(&ring->ctrl->head) - (u32)ring->wp);
+	rp = ring->rp + (u32)(smp_load_acquire(&ring->ctrl->tail) - (u32)ring->rp);
+	if(wp - rp <= ring->size){ /* ignore nonsense from user space */
+		ring->wp = wp;
+		ring->rp = rp;
+	}
+}
+
+void scull_p_publish_wp(struct scull_p_ring *ring)
+{
+	if(ring->ctrl)
+		smp_store_release(&ring->ctrl->head, (u32)ring->wp);
+}
+
+void scull_p_publish_rp(struct scull_p_ring *ring)
+{
+	if(ring->ctrl)
+		smp_store_release(&ring->ctrl->tail, (u32)ring->rp);
+}
+
+/*
+Bytes queued, for checks made without the semaphore. The counters are
+the ones scull_p_ring_sync() accepted, never the raw control page, and a
+racing update can't make the result exceed the ring.
+*/
+unsigned long scull_p_queued(struct scull_p_ring *ring)
+{
+	return min(READ_ONCE(ring->wp) - READ_ONCE(ring->rp), ring->size);
+}
+
+/* where counter value pos lands, and how much of that page is left */
+char *scull_p_ring_addr(struct scull_p_ring *ring, unsigned long pos, size_t *left)
+{
+	unsigned long idx = pos & (ring->size - 1);
+
+	*left = PAGE_SIZE - (idx & ~PAGE_MASK);
+	return (char *)page_address(ring->pages[idx >> PAGE_SHIFT]) + (idx & ~PAGE_MASK);
+}
+
+void scull_p_peek(struct scull_p_ring *ring, unsigned long pos, void *to, size_t n)
+{
+	size_t chunk;
+	char *from;
+
+	while(n){
+		from = scull_p_ring_addr(ring, pos, &chunk);
+		chunk = min(chunk, n);
+		memcpy(to, from, chunk);
+		to = (char *)to + chunk;
+		pos += chunk;
+		n -= chunk;
+	}
+}
+
+void scull_p_poke(struct scull_p_ring *ring, unsigned long pos, const void *from, size_t n)
+{
+	size_t chunk;
+	char *to;
+
+	while(n){
+		to = scull_p_ring_addr(ring, pos, &chunk);
+		chunk = min(chunk, n);
+		memcpy(to, from, chunk);
+		from = (const char *)from + chunk;
+		pos += chunk;
+		n -= chunk;
+	}
+}
+
+int scull_p_to_user(struct scull_p_ring *ring, unsigned long pos, char __user *buf, size_t n)
+{
+	size_t chunk;
+	char *from;
+
+	while(n){
+		from = scull_p_ring_addr(ring, pos, &chunk);
+		chunk = min(chunk, n);
+		if(copy_to_user(buf, from, chunk))
+			return -EFAULT;
+		buf += chunk;
+		pos += chunk;
+		n -= chunk;
+	}
+	return 0;
+}
+
+int scull_p_from_user(struct scull_p_ring *ring, unsigned long pos, const char __user *buf, size_t n)
+{
+	size_t chunk;
+	char *to;
+
+	while(n){
+		to = scull_p_ring_addr(ring, pos, &chunk);
+		chunk = min(chunk, n);
+		if(copy_from_user(to, buf, chunk))
+			return -EFAULT;
+		buf += chunk;
+		pos += chunk;
+		n -= chunk;
+	}
+	return 0;
+}
+
+/*
+Move the queued data to a ring of npages pages. The counters keep their
+values, so readers and writers don't notice; the caller checked that the
+data fits.
+*/
+int scull_p_ring_resize(struct scull_p_ring *ring, unsigned int npages)
+{
+	struct scull_p_ring new = { };
+	unsigned long pos;
+	size_t chunk;
+	char *from;
+	int result;
+
+	result = scull_p_ring_alloc(&new, npages);
+	if(result)
+		return result;
+	for(pos = ring->rp; pos != ring->wp; pos += chunk){
+		from = scull_p_ring_addr(ring, pos, &chunk);
+		chunk = min(chunk, (size_t)(ring->wp - pos));
+		scull_p_poke(&new, pos, from, chunk);
+	}
+	new.rp = ring->rp;
+	new.wp = ring->wp;
+	new.ctrl = ring->ctrl; /* the counters stay valid */
+	ring->ctrl = NULL;
+	if(new.ctrl)
+		new.ctrl->size = new.size;
+	scull_p_ring_release(ring);
+	*ring = new;
+	return 0;
+}
+
+/* stream mode: return what is there */
+ssize_t scull_p_getbytes(struct scull_p_ring *ring, unsigned long *rp, char __user *buf, size_t count)
+{
+	count = min(count, (size_t)(ring->wp - *rp));
+	if(scull_p_to_user(ring, *rp, buf, count))
+		return -EFAULT;
+	*rp += count;
+	return count;
+}
+
+/*
+Length of the record at rp. A mapped producer writes the headers itself,
+so one that claims more than is queued behind it is corruption: -EIO.
+*/
+int scull_p_reclen(struct scull_p_ring *ring, unsigned long rp, u32 *len)
+{
+	unsigned long avail = ring->wp - rp;
+
+	if(avail < SCULL_P_RECHDR || avail > ring->size)
+		return -EIO;
+	scull_p_peek(ring, rp, len, SCULL_P_RECHDR);
+	if(*len > avail - SCULL_P_RECHDR)
+		return -EIO;
+	return 0;
+}
+
+/*
+record mode: return the next record, dropping what doesn't fit in buf.
+A corrupt record takes everything queued behind it along.
+*/
+ssize_t scull_p_getrecord(struct scull_p_ring *ring, unsigned long *rp, char __user *buf, size_t count)
+{
+	u32 len;
+
+	if(count == 0)
+		return 0; /* don't throw a record away for nothing */
+	if(scull_p_reclen(ring, *rp, &len)){
+		*rp = ring->wp;
+		return -EIO;
+	}
+	count = min(count, (size_t)len);
+	if(scull_p_to_user(ring, *rp + SCULL_P_RECHDR, buf, count))
+		return -EFAULT;
+	*rp += SCULL_P_RECHDR + len;
+	return count;
+}
+
+/* how much space is free? */
+unsigned long scull_p_spacefree(struct scull_p_ring *ring)
+{
+	unsigned long queued = scull_p_queued(ring);
+
+	return queued < ring->size ? ring->size - queued : 0;
+}
+
+/* stream mode: accept what fits */
+ssize_t scull_p_putbytes(struct scull_p_ring *ring, const char __user *buf, size_t count)
+{
+	count = min_t(size_t, count, scull_p_spacefree(ring));
+	pr_debug("going to accept %li bytes at %lu from %p",(long)count, ring->wp, buf);
+	if(scull_p_from_user(ring, ring->wp, buf, count))
+		return -EFAULT;
+	ring->wp += count;
+	return count;
+}
+
+/* record mode: store the whole write as one record; space was checked */
+ssize_t scull_p_putrecord(struct scull_p_ring *ring, const char __user *buf, size_t count)
+{
+	u32 len = count;
+
+	if(scull_p_from_user(ring, ring->wp + SCULL_P_RECHDR, buf, count))
+		return -EFAULT;
+	scull_p_poke(ring, ring->wp, &len, SCULL_P_RECHDR);
+	ring->wp += SCULL_P_RECHDR + count;
+	return count;
+}
@@ -0,0 +1,89 @@
+#ifndef _SCULL_CORE_H_
+#define _SCULL_CORE_H_
+
+/*
+ * The storage shared by the scull devices, see scull-core.c. In the
+ * kernel it sits on the usual headers; in the host build scull-shim.h
+ * stands in for the few kernel services it uses.
+ */
+#ifdef __KERNEL__
+#include <linux/types.h>
+#include <linux/fs.h>
+#include <linux/cdev.h>
+#include <linux/semaphore.h>
+#include <linux/slab.h>
+#include <linux/mm.h>
+#include <linux/log2.h>
+#include <linux/uaccess.h>
+#else
+#include "scull-shim.h"
+#endif
+
+#include "scull_ioctl.h"
+
+#ifndef SCULL_QUANTUM
+#define SCULL_QUANTUM 4000
+#endif
+
+#ifndef SCULL_QSET
+#define SCULL_QSET    1000
+#endif
+
+struct scull_qset {
+	void **data;
+	struct scull_qset *next;
+};
+
+struct scull_dev {
+	struct scull_qset *data;  /* Pointer to first quantum set */
+	int quantum;              /* the current quantum size */
+	int qset;                 /* the current array size */
+	unsigned long size;       /* amount of data stored here */
+	struct semaphore sem;     /* mutual exclusion semaphore     */
+	struct cdev cdev;	  	/* Char device structure		*/
+};
+
+extern int scull_quantum;
+extern int scull_qset;
+
+int scull_trim(struct scull_dev *dev);
+struct scull_qset *scull_follow(struct scull_dev *dev, int n);
+void scull_locate(struct scull_dev *dev, loff_t pos, int *item, int *s_pos, int *q_pos);
+char *scull_get_quantum(struct scull_dev *dev, int item, int s_pos);
+ssize_t scull_store_read(struct scull_dev *dev, char __user *buf, size_t count, loff_t *f_pos);
+ssize_t scull_store_write(struct scull_dev *dev, const char __user *buf, size_t count, loff_t *f_pos);
+
+/*
+ * The ring is a power of two number of pages; rp and wp run freely and are
+ * masked into it, so wp - rp is the amount of data queued.
+ */
+struct scull_p_ring {
+        struct page **pages;                    /* NULL while nobody has it open */
+        unsigned int npages;
+        unsigned long size;                     /* npages * PAGE_SIZE */
+        unsigned long rp, wp;                   /* where to read, where to write */
+        struct scull_p_ring_ctrl *ctrl;         /* mmap control page, mirrors rp/wp */
+};
+
+unsigned int scull_p_size_to_pages(unsigned long size);
+int scull_p_ring_alloc(struct scull_p_ring *ring, unsigned int npages);
+void scull_p_ring_release(struct scull_p_ring *ring);
+int scull_p_ring_resize(struct scull_p_ring *ring, unsigned int npages);
+unsigned long scull_p_ring_used(struct scull_p_ring *ring);
+void scull_p_ring_sync(struct scull_p_ring *ring);
+void scull_p_publish_wp(struct scull_p_ring *ring);
+void scull_p_publish_rp(struct scull_p_ring *ring);
+unsigned long scull_p_queued(struct scull_p_ring *ring);
+unsigned long scull_p_spacefree(struct scull_p_ring *ring);
+char *scull_p_ring_addr(struct scull_p_ring *ring, unsigned long pos, size_t *left);
+void scull_p_peek(struct scull_p_ring *ring, unsigned long pos, void *to, size_t n);
+void scull_p_poke(struct scull_p_ring *ring, unsigned long pos, const void *from, size_t n);
+int scull_p_to_user(struct scull_p_ring *ring, unsigned long pos, char __user *buf, size_t n);
+int scull_p_from_user(struct scull_p_ring *ring, unsigned long pos, const char __user *buf, size_t n);
+ssize_t scull_p_getbytes(struct scull_p_ring *ring, unsigned long *rp, char __user *buf, size_t count);
+int scull_p_reclen(struct scull_p_ring *ring, unsigned long rp, u32 *len);
+ssize_t scull_p_getrecord(struct scull_p_ring *ring, unsigned long *rp, char __user *buf, size_t count);
+ssize_t scull_p_putbytes(struct scull_p_ring *ring, const char __user *buf, size_t count);
+ssize_t scull_p_putrecord(struct scull_p_ring *ring, const char __user *buf, size_t count);
+
+#endif /* _SCULL_CORE_H_ */
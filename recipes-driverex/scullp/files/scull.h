@@ -1,60 +1,140 @@
 #ifndef _SCULL_H_
 #define _SCULL_H_
 
+#include "scull-core.h"
+
 #ifndef SCULL_NR_DEVS
 #define SCULL_NR_DEVS 4    /* scull0 through scull3 */
 #endif
 
-#ifndef SCULL_QUANTUM
-#define SCULL_QUANTUM 4000
-#endif
-
-#ifndef SCULL_QSET
-#define SCULL_QSET    1000
-#endif
-
 /*
- * The pipe device is a simple circular buffer. Here its default size
+ * The pipe device is a simple circular buffer. Here its default size,
+ * rounded up to whole pages, and the largest one a user may ask for
+ * without CAP_SYS_RESOURCE. Nobody gets more than the hard limit.
  */
 #ifndef SCULL_P_BUFFER
 #define SCULL_P_BUFFER 4000
 #endif
 
-struct scull_qset {
-	void **data;
-	struct scull_qset *next;
-};
+#ifndef SCULL_P_MAX_BUFFER
+#define SCULL_P_MAX_BUFFER (1024 * 1024)
+#endif
 
-struct scull_dev {
-	struct scull_qset *data;  /* Pointer to first quantum set */
-	int quantum;              /* the current quantum size */
-	int qset;                 /* the current array size */
-	unsigned long size;       /* amount of data stored here */
-	struct semaphore sem;     /* mutual exclusion semaphore     */
-	struct cdev cdev;	  	/* Char device structure		*/
-};
+#define SCULL_P_HARD_MAX_BUFFER (256 * 1024 * 1024)
+
+/* initial size of each priority lane above lane 0 */
+#ifndef SCULL_P_LANE_BUFFER
+#define SCULL_P_LANE_BUFFER 4096
+#endif
+
+/* longest a reader may busy poll, in microseconds */
+#define SCULL_P_MAX_BUSY_POLL 10000
 
 extern int scull_nr_devs;
-extern int scull_quantum;
-extern int scull_qset;
 
 /*-----------------------------------------------------------------------------------------*/
 
+/*
+ * Pipe instrumentation, kept only while switched on in debugfs. Times are
+ * log2 histograms of nanoseconds; the fill level is sampled at every
+ * write, in tenths of the buffer. With timestamps on, each write leaves
+ * a stamp (where it ended, when) so reads can tell how long bytes waited.
+ */
+#define SCULL_P_HIST_BUCKETS	32
+#define SCULL_P_STAMPS		64
+
+struct scull_p_stats {
+        unsigned long read_sleep[SCULL_P_HIST_BUCKETS];  /* readers waiting for data */
+        unsigned long write_wait[SCULL_P_HIST_BUCKETS];  /* writers waiting for room */
+        unsigned long dwell[SCULL_P_HIST_BUCKETS];       /* bytes, by time from write to read */
+        unsigned long fill[11];
+        unsigned long max_fill;
+        unsigned long reader_wakeups, writer_wakeups;
+        unsigned long read_eagain, write_eagain;
+        struct {
+                unsigned long end;              /* ring position after the write */
+                u64 ns;
+        } stamp[SCULL_P_STAMPS];
+        unsigned int stamp_head, stamp_tail;
+        unsigned long stamp_pos;                /* where the oldest stamped write began */
+        unsigned long stamps_dropped;           /* writes that found the stamps full */
+};
+
 struct scull_pipe {
         wait_queue_head_t inq, outq;            /* read and write queues */
-        char    *buffer, *end;                  /* begin of buf, end of buf */
-        int     buffersize;                     /* used in pointer arithmetic */
-        char    *rp, *wp;                       /* where to read, where to write */
+        struct scull_p_ring ring;               /* the queued data, lane 0 */
+        unsigned long buffersize;               /* ring size, kept while closed */
+        struct scull_p_ring prio[SCULL_P_NR_LANES - 1]; /* lanes 1 and up */
+        unsigned long prio_size[SCULL_P_NR_LANES - 1];
+        unsigned long maxsize;                  /* unprivileged limit for buffersize */
         int     nreaders, nwriters;             /* number of opening for r/w */
+        int     recmode;                        /* SCULL_P_STREAM or SCULL_P_RECORD */
+        int     bcast;                          /* SCULL_P_BCAST_* */
+        struct list_head readers;               /* scull_p_file of each reader */
         struct fasync_struct *async_queue;      /* asynchronous readers */
+        struct eventfd_ctx *evfd;               /* signalled as data and room show up */
+        int     nmaps;                          /* mappings of the ring */
+        struct mutex maplock;                   /* protects nmaps against resizing */
+        unsigned long rcvlowat, sndlowat;       /* wake readers/writers at this many bytes */
+        unsigned int flush_ms;                  /* readers get older data below rcvlowat */
+        unsigned long flushpos;                 /* data before this is due for reading */
+        struct timer_list flush_timer;
+        int     nbusy;                          /* busy polling readers */
+        atomic_long_t spin_hits, spin_misses;
+        struct scull_p_stats stats;             /* protected by sem */
         struct semaphore sem;                   /* mutual exclusion semaphore */
         struct cdev cdev;                       /* char device structure */
 };
 
+/* per open file state of a pipe */
+struct scull_p_file {
+        struct scull_pipe *dev;
+        struct list_head list;                  /* on dev->readers */
+        unsigned long rp;                       /* own read cursor in broadcast mode */
+        unsigned long lost;                     /* bytes skipped by overruns */
+        int     overrun;                        /* next read reports the gap */
+        unsigned int busy_poll;                 /* usecs to spin before sleeping */
+        int     lane;                           /* where this file's writes go */
+};
+
 #ifndef SCULL_P_NR_DEVS
 #define SCULL_P_NR_DEVS	4 	/* scullpipe0 through scullpipe3 */
 #endif
 
+/*
+ * The multi-queue pipe: records are spread over shards that each have their
+ * own ring and lock; only the record count is shared by everybody.
+ */
+struct scull_mq_shard {
+        struct mutex lock;                      /* protects ring */
+        struct scull_p_ring ring;
+        wait_queue_head_t outq;                 /* writers waiting for room here */
+} ____cacheline_aligned_in_smp;
+
+struct scull_mq {
+        struct scull_mq_shard *shards;          /* NULL while nobody has it open */
+        unsigned int nshards;
+        atomic_t nrecs;                         /* records queued in all shards */
+        atomic_t next;                          /* where the next read starts */
+        wait_queue_head_t inq;                  /* readers */
+        int     nopen;
+        struct semaphore sem;                   /* protects shards and nopen */
+        struct cdev cdev;                       /* char device structure */
+};
+
+#ifndef SCULL_MQ_NR_DEVS
+#define SCULL_MQ_NR_DEVS 2	/* scullmq0 and scullmq1 */
+#endif
+
+#ifndef SCULL_MQ_BUFFER
+#define SCULL_MQ_BUFFER (64 * 1024)
+#endif
+
+extern int scull_p_buffer;
+extern int scull_p_max_buffer;
+extern int scull_p_recmode;
+extern int scull_p_busy_poll;
+
 
 
 /*-----------------------------------------------------------------------------------------*/
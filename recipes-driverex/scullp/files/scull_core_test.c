@@ -0,0 +1,204 @@
+/*
+ * scull_core_test.c -- KUnit tests for the quantum sets of the scull_char
+ * devices: where an offset lands, what reads of holes return, growing the
+ * list with scull_follow() and emptying it with scull_trim().
+ *
+ * Not built on its own: scullp-main.c includes it at the end when
+ * CONFIG_SCULL_CORE_KUNIT_TEST is set, so the suite runs inside the
+ * driver module against its own code, static helpers included.
+ */
+#include <kunit/test.h>
+#include <linux/mman.h>
+
+/* small enough to cross every boundary with a few bytes */
+#define TEST_QUANTUM	8
+#define TEST_QSET	4
+#define TEST_ITEM	(TEST_QUANTUM * TEST_QSET)
+
+struct scull_core_test {
+	struct scull_dev dev;
+	struct file filp;	/* only private_data is looked at */
+};
+
+static int scull_core_test_init(struct kunit *test)
+{
+	struct scull_core_test *t;
+
+	t = kunit_kzalloc(test, sizeof(*t), GFP_KERNEL);
+	KUNIT_ASSERT_NOT_NULL(test, t);
+	sema_init(&t->dev.sem, 1);
+	t->dev.quantum = TEST_QUANTUM;
+	t->dev.qset = TEST_QSET;
+	t->filp.private_data = &t->dev;
+	test->priv = t;
+	return 0;
+}
+
+static void scull_core_test_exit(struct kunit *test)
+{
+	struct scull_core_test *t = test->priv;
+
+	scull_trim(&t->dev);
+}
+
+/* a user buffer for the copy_{to,from}_user() of scull_read/scull_write */
+static char __user *scull_test_ubuf(struct kunit *test, size_t len)
+{
+	unsigned long addr;
+
+	addr = kunit_vm_mmap(test, NULL, 0, len, PROT_READ | PROT_WRITE,
+			     MAP_ANONYMOUS | MAP_PRIVATE, 0);
+	KUNIT_ASSERT_FALSE_MSG(test, !addr || IS_ERR_VALUE(addr), "no user memory");
+	return (char __user *)addr;
+}
+
+static ssize_t scull_test_write(struct kunit *test, loff_t pos, const char *data, size_t len)
+{
+	struct scull_core_test *t = test->priv;
+	char __user *ubuf = scull_test_ubuf(test, PAGE_SIZE);
+
+	KUNIT_ASSERT_EQ(test, copy_to_user(ubuf, data, len), 0);
+	return scull_write(&t->filp, ubuf, len, &pos);
+}
+
+#define KUNIT_EXPECT_LOCATION(test, dev, pos, i, s, q) do {		\
+	int item, s_pos, q_pos;						\
+									\
+	scull_locate(dev, pos, &item, &s_pos, &q_pos);			\
+	KUNIT_EXPECT_EQ(test, item, i);					\
+	KUNIT_EXPECT_EQ(test, s_pos, s);				\
+	KUNIT_EXPECT_EQ(test, q_pos, q);				\
+} while(0)
+
+static void scull_locate_boundaries(struct kunit *test)
+{
+	struct scull_core_test *t = test->priv;
+
+	KUNIT_EXPECT_LOCATION(test, &t->dev, 0, 0, 0, 0);
+	KUNIT_EXPECT_LOCATION(test, &t->dev, TEST_QUANTUM - 1, 0, 0, TEST_QUANTUM - 1);
+	KUNIT_EXPECT_LOCATION(test, &t->dev, TEST_QUANTUM, 0, 1, 0);
+	KUNIT_EXPECT_LOCATION(test, &t->dev, TEST_ITEM - 1, 0, TEST_QSET - 1, TEST_QUANTUM - 1);
+	KUNIT_EXPECT_LOCATION(test, &t->dev, TEST_ITEM, 1, 0, 0);
+	KUNIT_EXPECT_LOCATION(test, &t->dev, 3 * TEST_ITEM + TEST_QUANTUM + 4, 3, 1, 4);
+}
+
+static void scull_locate_large_offset(struct kunit *test)
+{
+	struct scull_core_test *t = test->priv;
+
+	/* the default geometry, 1 TiB in: far past what an int offset holds */
+	t->dev.quantum = 4000;
+	t->dev.qset = 1000;
+	KUNIT_EXPECT_LOCATION(test, &t->dev, 1LL << 40, 274877, 906, 3776);
+}
+
+static void scull_follow_past_end(struct kunit *test)
+{
+	struct scull_core_test *t = test->priv;
+	struct scull_dev *dev = &t->dev;
+	struct scull_qset *qs, *dptr;
+	int n = 0;
+
+	/* an empty device grows every item up to the one asked for */
+	qs = scull_follow(dev, 3);
+	KUNIT_ASSERT_NOT_NULL(test, qs);
+	for(dptr = dev->data; dptr; dptr = dptr->next){
+		KUNIT_EXPECT_NULL(test, dptr->data);
+		if(dptr->next == NULL)
+			KUNIT_EXPECT_PTR_EQ(test, dptr, qs);
+		n++;
+	}
+	KUNIT_EXPECT_EQ(test, n, 4);
+
+	/* existing items are walked, not replaced */
+	KUNIT_EXPECT_PTR_EQ(test, scull_follow(dev, 1), dev->data->next);
+	KUNIT_EXPECT_PTR_EQ(test, scull_follow(dev, 3), qs);
+	KUNIT_EXPECT_EQ(test, dev->size, 0UL);
+}
+
+static void scull_write_stops_at_quantum(struct kunit *test)
+{
+	struct scull_core_test *t = test->priv;
+
+	KUNIT_EXPECT_EQ(test, scull_test_write(test, 4, "0123456789", 10), 4);
+	KUNIT_EXPECT_EQ(test, t->dev.size, (unsigned long)TEST_QUANTUM);
+	KUNIT_EXPECT_EQ(test, scull_test_write(test, TEST_QUANTUM, "456789", 6), 6);
+	KUNIT_EXPECT_EQ(test, t->dev.size, (unsigned long)TEST_QUANTUM + 6);
+}
+
+static void scull_read_holes(struct kunit *test)
+{
+	struct scull_core_test *t = test->priv;
+	struct scull_dev *dev = &t->dev;
+	char __user *ubuf = scull_test_ubuf(test, PAGE_SIZE);
+	char buf[TEST_QUANTUM];
+	loff_t pos;
+
+	/* quantum 0 of item 0, then two bytes into item 2 */
+	KUNIT_ASSERT_EQ(test, scull_test_write(test, 0, "abcdefgh", 8), 8);
+	KUNIT_ASSERT_EQ(test, scull_test_write(test, 2 * TEST_ITEM + 6, "xy", 2), 2);
+	KUNIT_ASSERT_EQ(test, dev->size, 2UL * TEST_ITEM + 8);
+
+	/* a read stops at the end of its quantum */
+	pos = 4;
+	KUNIT_EXPECT_EQ(test, scull_read(&t->filp, ubuf, 100, &pos), 4);
+	KUNIT_EXPECT_EQ(test, pos, 8);
+	KUNIT_ASSERT_EQ(test, copy_from_user(buf, ubuf, 4), 0);
+	KUNIT_EXPECT_MEMEQ(test, buf, "efgh", 4);
+
+	/* holes aren't filled: a missing quantum and a missing item read 0 */
+	pos = TEST_QUANTUM;
+	KUNIT_EXPECT_EQ(test, scull_read(&t->filp, ubuf, 4, &pos), 0);
+	KUNIT_EXPECT_EQ(test, pos, TEST_QUANTUM);
+	pos = TEST_ITEM + 1;
+	KUNIT_EXPECT_EQ(test, scull_read(&t->filp, ubuf, 4, &pos), 0);
+	KUNIT_EXPECT_EQ(test, pos, TEST_ITEM + 1);
+
+	/* item 1 was made on the way to item 2, but holds no quanta */
+	KUNIT_EXPECT_NOT_NULL(test, dev->data->next);
+	KUNIT_EXPECT_NULL(test, dev->data->next->data);
+
+	/* data after the holes is still there, and the end is the end */
+	pos = 2 * TEST_ITEM + 6;
+	KUNIT_EXPECT_EQ(test, scull_read(&t->filp, ubuf, 100, &pos), 2);
+	KUNIT_ASSERT_EQ(test, copy_from_user(buf, ubuf, 2), 0);
+	KUNIT_EXPECT_MEMEQ(test, buf, "xy", 2);
+	KUNIT_EXPECT_EQ(test, scull_read(&t->filp, ubuf, 100, &pos), 0);
+}
+
+static void scull_trim_resets(struct kunit *test)
+{
+	struct scull_core_test *t = test->priv;
+	struct scull_dev *dev = &t->dev;
+
+	KUNIT_ASSERT_EQ(test, scull_test_write(test, 3 * TEST_ITEM, "z", 1), 1);
+	KUNIT_ASSERT_NOT_NULL(test, dev->data);
+
+	KUNIT_EXPECT_EQ(test, scull_trim(dev), 0);
+	KUNIT_EXPECT_NULL(test, dev->data);
+	KUNIT_EXPECT_EQ(test, dev->size, 0UL);
+	KUNIT_EXPECT_EQ(test, dev->quantum, scull_quantum);
+	KUNIT_EXPECT_EQ(test, dev->qset, scull_qset);
+
+	/* trimming an empty device is fine too */
+	KUNIT_EXPECT_EQ(test, scull_trim(dev), 0);
+	KUNIT_EXPECT_NULL(test, dev->data);
+}
+
+static struct kunit_case scull_core_test_cases[] = {
+	KUNIT_CASE(scull_locate_boundaries),
+	KUNIT_CASE(scull_locate_large_offset),
+	KUNIT_CASE(scull_follow_past_end),
+	KUNIT_CASE(scull_write_stops_at_quantum),
+	KUNIT_CASE(scull_read_holes),
+	KUNIT_CASE(scull_trim_resets),
+	{}
+};
+
+static struct kunit_suite scull_core_test_suite = {
+	.name = "scull-core",
+	.init = scull_core_test_init,
+	.exit = scull_core_test_exit,
+	.test_cases = scull_core_test_cases,
+};
+kunit_test_suite(scull_core_test_suite);
@@ -0,0 +1,156 @@
+#ifndef _SCULL_IOCTL_H_
+#define _SCULL_IOCTL_H_
+
+/*
+ * ioctl interface of the scull pipe devices. This header is shared with
+ * user space, so it must only use the exported types.
+ */
+#include <linux/ioctl.h>
+#include <linux/types.h>
+
+/*
+ * Record (packet) mode: every write() is stored as one record, a native
+ * endian __u32 length followed by the payload, and read() returns at most
+ * one record. Bytes of a record that don't fit in the read buffer are
+ * discarded, like O_DIRECT pipes do.
+ */
+#define SCULL_P_STREAM	0
+#define SCULL_P_RECORD	1
+
+/*
+ * Broadcast mode: every reader gets every byte written after it opened the
+ * pipe. With BLOCK the writer waits for the slowest reader; with OVERRUN it
+ * never waits and a reader that falls a whole buffer behind skips to the
+ * oldest data kept, its next read failing once with EOVERFLOW.
+ */
+#define SCULL_P_BCAST_OFF	0
+#define SCULL_P_BCAST_BLOCK	1
+#define SCULL_P_BCAST_OVERRUN	2
+
+#define SCULL_P_RECHDR		sizeof(__u32)
+/* space a record takes in a batch buffer: header, payload, pad to 4 bytes */
+#define SCULL_P_REC_SIZE(len)	((SCULL_P_RECHDR + (len) + 3) & ~3UL)
+
+/*
+ * SCULL_P_IOCRDBATCH fills buf with as many whole records as fit, each laid
+ * out as SCULL_P_REC_SIZE(len) bytes. It returns the number of records.
+ */
+struct scull_p_batch {
+	__u64 buf;		/* user buffer */
+	__u32 len;		/* size of buf */
+	__u32 max_recs;		/* stop after this many records, 0 = no limit */
+	__u32 nrecs;		/* out: records copied */
+	__u32 bytes;		/* out: bytes of buf used */
+};
+
+/*
+ * mmap() of a pipe maps this control page at offset 0 and the ring's data
+ * pages right after it, at data_offset. head and tail are the free running
+ * write and read positions of the ring (take them modulo size); the data
+ * is laid out as read() and write() see it, records included, and may wrap
+ * at the end of the data area. The ring has one producer and one consumer:
+ * each side is either the mapping or the read()/write() calls, and only
+ * the producer stores head, only the consumer tail.
+ */
+struct scull_p_ring_ctrl {
+	__u32 size;		/* bytes in the data area, a power of two */
+	__u32 recmode;		/* SCULL_P_STREAM or SCULL_P_RECORD */
+	__u32 data_offset;	/* mmap offset of the data area */
+	__u32 resv[13];
+	__u32 head;		/* producer: where the next byte goes */
+	__u32 resv1[15];
+	__u32 tail;		/* consumer: the next byte to read */
+	__u32 resv2[15];
+};
+
+/*
+ * The usual scull conventions:
+ * T means "Tell" directly with the argument value
+ * Q means "Query": response is on the return value
+ * G means "Get": reply by setting through a pointer
+ */
+#define SCULL_IOC_MAGIC  'k'
+
+#define SCULL_P_IOCTRECMODE	_IO(SCULL_IOC_MAGIC,   1)
+#define SCULL_P_IOCQRECMODE	_IO(SCULL_IOC_MAGIC,   2)
+#define SCULL_P_IOCRDBATCH	_IOWR(SCULL_IOC_MAGIC, 3, struct scull_p_batch)
+/*
+ * Buffer size in bytes, like F_SETPIPE_SZ/F_GETPIPE_SZ: the size is rounded
+ * up to a power of two pages and the new size is returned. Shrinking below
+ * what is queued fails with EBUSY; going above the device limit needs
+ * CAP_SYS_RESOURCE, as does changing the limit.
+ */
+#define SCULL_P_IOCTSIZE	_IO(SCULL_IOC_MAGIC,   4)
+#define SCULL_P_IOCQSIZE	_IO(SCULL_IOC_MAGIC,   5)
+#define SCULL_P_IOCTMAXSIZE	_IO(SCULL_IOC_MAGIC,   6)
+#define SCULL_P_IOCQMAXSIZE	_IO(SCULL_IOC_MAGIC,   7)
+
+/* SCULL_P_IOCQLOST returns the bytes this reader lost and resets the count */
+#define SCULL_P_IOCTBCAST	_IO(SCULL_IOC_MAGIC,   8)
+#define SCULL_P_IOCQBCAST	_IO(SCULL_IOC_MAGIC,   9)
+#define SCULL_P_IOCQLOST	_IO(SCULL_IOC_MAGIC,  10)
+
+/* scullmq devices: number of shards */
+#define SCULL_MQ_IOCQSHARDS	_IO(SCULL_IOC_MAGIC,  11)
+
+/*
+ * SCULL_P_IOCTEVENTFD registers an eventfd (-1 drops it) that is signalled
+ * whenever data or room shows up through the kernel side of the pipe; a
+ * producer or consumer working on the mapping rings SCULL_P_IOCKICK when
+ * it has moved head or tail and the other side may be asleep.
+ */
+#define SCULL_P_IOCTEVENTFD	_IO(SCULL_IOC_MAGIC,  12)
+#define SCULL_P_IOCKICK		_IO(SCULL_IOC_MAGIC,  13)
+
+/*
+ * Watermarks, in bytes, in the manner of SO_RCVLOWAT/SO_SNDLOWAT: blocked
+ * readers (and poll) wait for RCVLOWAT bytes, blocked writers for SNDLOWAT
+ * bytes of room. With a flush timeout (milliseconds, 0 = none) readers
+ * get whatever has waited that long even below the watermark.
+ */
+#define SCULL_P_IOCTRCVLOWAT	_IO(SCULL_IOC_MAGIC,  14)
+#define SCULL_P_IOCQRCVLOWAT	_IO(SCULL_IOC_MAGIC,  15)
+#define SCULL_P_IOCTSNDLOWAT	_IO(SCULL_IOC_MAGIC,  16)
+#define SCULL_P_IOCQSNDLOWAT	_IO(SCULL_IOC_MAGIC,  17)
+#define SCULL_P_IOCTFLUSH	_IO(SCULL_IOC_MAGIC,  18)
+#define SCULL_P_IOCQFLUSH	_IO(SCULL_IOC_MAGIC,  19)
+
+/*
+ * Busy polling, per open file: a reader that finds nothing to read spins
+ * for up to this many microseconds (0 = off) before going to sleep.
+ * SCULL_P_IOCGBUSYSTATS fetches the pipe's counters of spins that found
+ * data (hits) and spins that ended asleep after all (misses).
+ */
+struct scull_p_busy_stats {
+	__u64 hits;
+	__u64 misses;
+};
+
+#define SCULL_P_IOCTBUSYPOLL	_IO(SCULL_IOC_MAGIC,  20)
+#define SCULL_P_IOCQBUSYPOLL	_IO(SCULL_IOC_MAGIC,  21)
+#define SCULL_P_IOCGBUSYSTATS	_IOR(SCULL_IOC_MAGIC, 22, struct scull_p_busy_stats)
+
+/*
+ * Priority lanes: SCULL_P_IOCTLANE picks the lane this file writes to, from
+ * 0 (the default, lowest) to SCULL_P_NR_LANES - 1. Readers always get the
+ * highest lane with data first. Each lane has its own buffer, which the
+ * size ioctls of a file act on. Broadcast mode and mmap use lane 0 only.
+ */
+#define SCULL_P_NR_LANES	4
+
+#define SCULL_P_IOCTLANE	_IO(SCULL_IOC_MAGIC,  23)
+#define SCULL_P_IOCQLANE	_IO(SCULL_IOC_MAGIC,  24)
+
+/*
+ * scull_char devices: quantum size in bytes and quanta per set. Setting
+ * them fails with EBUSY unless the device is empty; open it for writing
+ * with O_TRUNC to empty it, which also restores the module defaults.
+ */
+#define SCULL_IOCTQUANTUM	_IO(SCULL_IOC_MAGIC,  25)
+#define SCULL_IOCQQUANTUM	_IO(SCULL_IOC_MAGIC,  26)
+#define SCULL_IOCTQSET		_IO(SCULL_IOC_MAGIC,  27)
+#define SCULL_IOCQQSET		_IO(SCULL_IOC_MAGIC,  28)
+
+#define SCULL_IOC_MAXNR 28
+
+#endif /*_SCULL_IOCTL_H_*/
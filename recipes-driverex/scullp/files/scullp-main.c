@@ -0,0 +1,2218 @@
+#include <linux/module.h>
+#include <linux/init.h>
+#include <linux/fs.h>
+#include <linux/version.h>
+#include <linux/device.h>
+#include <linux/cdev.h>
+#include <linux/slab.h>     /* kmalloc() */
+#include <linux/uaccess.h>
+#include <linux/fcntl.h>
+#include <linux/poll.h>
+#include <linux/sched/signal.h>
+#include <linux/mm.h>
+#include <linux/eventfd.h>
+#include <linux/timer.h>
+#include <linux/jiffies.h>
+#include <linux/ktime.h>
+#include <linux/log2.h>
+#include <linux/hash.h>
+#include <linux/jump_label.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/pipe_fs_i.h>
+#include <linux/splice.h>
+#include <linux/highmem.h>
+#include "scull.h"
+
+/*
+Interfaces that changed between the kernels this builds on: class_create()
+lost its owner in 6.4, eventfd_signal() its count in 6.8, and the timer
+calls were renamed in 6.2 and 6.16.
+*/
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 4, 0)
+#define scull_class_create(name)	class_create(name)
+#else
+#define scull_class_create(name)	class_create(THIS_MODULE, name)
+#endif
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 8, 0)
+#define scull_eventfd_signal(ctx)	eventfd_signal(ctx)
+#else
+#define scull_eventfd_signal(ctx)	eventfd_signal(ctx, 1)
+#endif
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6, 2, 0)
+#define timer_delete_sync		del_timer_sync
+#endif
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6, 16, 0)
+#define timer_container_of		from_timer
+#endif
+
+static unsigned int major, majorp; /* major number for device */
+static struct class *scull_class;
+static struct class *scullp_class;
+
+struct  scull_dev *scull_devices;
+
+int scull_nr_devs = SCULL_NR_DEVS;  /* number of bare scull devices */
+int scull_quantum = SCULL_QUANTUM;
+int scull_qset =    SCULL_QSET;
+
+module_param(scull_quantum, int, S_IRUGO);
+MODULE_PARM_DESC(scull_quantum, "Bytes per quantum of a scull_char device");
+module_param(scull_qset, int, S_IRUGO);
+MODULE_PARM_DESC(scull_qset, "Quanta per quantum set of a scull_char device");
+
+/*-----------------------------------------------------------------------------------------*/
+static int scull_p_nr_devs = SCULL_P_NR_DEVS; 	/* number of pipe devices */
+int scull_p_buffer = SCULL_P_BUFFER;		/* buffer size */
+int scull_p_max_buffer = SCULL_P_MAX_BUFFER;	/* default per-device size limit */
+int scull_p_recmode = SCULL_P_STREAM;		/* framing of an idle pipe */
+int scull_p_busy_poll = 0;			/* usecs readers spin, by default */
+dev_t scull_p_devno;				/* our first device number */
+
+module_param(scull_p_buffer, int, S_IRUGO);
+MODULE_PARM_DESC(scull_p_buffer, "Initial size of the pipe buffers, in bytes");
+module_param(scull_p_max_buffer, int, S_IRUGO);
+MODULE_PARM_DESC(scull_p_max_buffer, "Largest pipe buffer an unprivileged user may ask for");
+module_param(scull_p_recmode, int, S_IRUGO);
+MODULE_PARM_DESC(scull_p_recmode, "Initial framing of the pipes: 0 stream, 1 record");
+module_param(scull_p_busy_poll, int, S_IRUGO);
+MODULE_PARM_DESC(scull_p_busy_poll, "Microseconds a pipe reader spins before sleeping, 0 to never spin");
+
+static struct scull_pipe *scull_p_devices;
+static int scull_p_fasync(int fd, struct file *filep, int mode);
+
+/*
+Priority lanes: lane 0 is dev->ring, the pipe as it always was, and the
+lanes above it are rings of their own with their own size, so bulk data
+in lane 0 can't keep a control message out. Readers always take the
+highest lane that has data, one lane per read(). The higher lanes are
+plain shared rings: no broadcast, no mapping, no watermarks.
+*/
+static struct scull_p_ring *scull_p_lane(struct scull_pipe *dev, int lane)
+{
+	return lane ? &dev->prio[lane - 1] : &dev->ring;
+}
+
+/* the highest lane above 0 with data, or NULL; safe without the semaphore */
+static struct scull_p_ring *scull_p_top_lane(struct scull_pipe *dev)
+{
+	int i;
+
+	for(i = SCULL_P_NR_LANES - 2; i >= 0; i--)
+		if(scull_p_queued(&dev->prio[i]))
+			return &dev->prio[i];
+	return NULL;
+}
+
+/*
+Broadcast mode: every reader has its own cursor and the ring's rp is the
+oldest byte some reader still needs. In SCULL_P_BCAST_OVERRUN mode the
+writer may push rp past a slow reader, who then finds its cursor behind
+rp and is told about the gap. Callers hold the device semaphore.
+*/
+static unsigned long *scull_p_cursor(struct scull_p_file *pf)
+{
+	struct scull_pipe *dev = pf->dev;
+
+	if(dev->bcast == SCULL_P_BCAST_OFF)
+		return &dev->ring.rp;
+	if((long)(dev->ring.rp - pf->rp) > 0){ /* lapped by the writer */
+		pf->lost += dev->ring.rp - pf->rp;
+		pf->rp = dev->ring.rp;
+		pf->overrun = 1;
+	}
+	return &pf->rp;
+}
+
+/* bytes waiting for this reader; safe to call without the semaphore */
+static unsigned long scull_p_pending(struct scull_p_file *pf)
+{
+	struct scull_pipe *dev = pf->dev;
+
+	if(!READ_ONCE(dev->bcast))
+		return scull_p_queued(&dev->ring);
+	return READ_ONCE(dev->ring.wp) - READ_ONCE(pf->rp);
+}
+
+/*
+Watermarks: readers are woken once rcvlowat bytes are queued and writers
+once sndlowat bytes are free, so small messages don't bounce the two
+between sleeping and running on every call. Data that sits below
+rcvlowat for flush_ms is made readable by the flush timer, which moves
+flushpos up to what was written by then. Both marks are capped at the
+ring size.
+*/
+static unsigned long scull_p_rcvlowat(struct scull_pipe *dev)
+{
+	return min(READ_ONCE(dev->rcvlowat), dev->ring.size);
+}
+
+static unsigned long scull_p_sndlowat(struct scull_pipe *dev, struct scull_p_ring *ring)
+{
+	if(ring != &dev->ring)
+		return 1;
+	return min(READ_ONCE(dev->sndlowat), ring->size);
+}
+
+/* enough for this reader to be woken? safe without the semaphore */
+static int scull_p_readable(struct scull_p_file *pf)
+{
+	struct scull_pipe *dev = pf->dev;
+	unsigned long n = scull_p_pending(pf);
+	unsigned long rp = READ_ONCE(dev->bcast) ? READ_ONCE(pf->rp) : READ_ONCE(dev->ring.rp);
+
+	if(scull_p_top_lane(dev))
+		return 1; /* high lanes don't wait for watermarks */
+	if(!n)
+		return 0;
+	return n >= scull_p_rcvlowat(dev) || (long)(READ_ONCE(dev->flushpos) - rp) > 0;
+}
+
+/*
+Busy polling: rather than paying for a sleep and a wakeup, a reader with
+busy_poll set spins, without the semaphore, for up to that many
+microseconds waiting to become readable. It gives up early when the CPU
+is wanted elsewhere or a signal comes in. Writers on a pipe that has
+busy pollers use sync wakeups, so a reader that did go to sleep is
+pulled onto the writer's CPU instead of a cold one.
+*/
+static int scull_p_busy_wait(struct scull_p_file *pf)
+{
+	struct scull_pipe *dev = pf->dev;
+	u64 end = ktime_get_ns() + (u64)pf->busy_poll * NSEC_PER_USEC;
+
+	while(!scull_p_readable(pf)){
+		if(need_resched() || signal_pending(current) || ktime_get_ns() > end){
+			atomic_long_inc(&dev->spin_misses);
+			return 0;
+		}
+		cpu_relax();
+	}
+	atomic_long_inc(&dev->spin_hits);
+	return 1;
+}
+
+static void scull_p_flush_timeout(struct timer_list *t)
+{
+	struct scull_pipe *dev = timer_container_of(dev, t, flush_timer);
+
+	WRITE_ONCE(dev->flushpos, READ_ONCE(dev->ring.wp));
+	wake_up_interruptible(&dev->inq);
+	if(dev->async_queue)
+		kill_fasync(&dev->async_queue, SIGIO, POLL_IN);
+}
+
+/* move the ring's rp up to the slowest reader; it never goes back */
+static void scull_p_bcast_update(struct scull_pipe *dev)
+{
+	struct scull_p_file *pf;
+	unsigned long rp = dev->ring.wp;
+
+	if(dev->bcast == SCULL_P_BCAST_OFF)
+		return;
+	list_for_each_entry(pf, &dev->readers, list)
+		if((long)(pf->rp - dev->ring.rp) >= 0 && (long)(pf->rp - rp) < 0)
+			rp = pf->rp;
+	/* with nobody reading, the data is simply dropped */
+	dev->ring.rp = list_empty(&dev->readers) ? dev->ring.wp : rp;
+	scull_p_publish_rp(&dev->ring);
+}
+
+/* overrun policy: drop the oldest data until need bytes are free */
+static void scull_p_bcast_makeroom(struct scull_pipe *dev, size_t need)
+{
+	struct scull_p_ring *ring = &dev->ring;
+	u32 len;
+
+	while(scull_p_spacefree(ring) < need && ring->rp != ring->wp){
+		if(dev->recmode == SCULL_P_RECORD){
+			if(scull_p_reclen(ring, ring->rp, &len))
+				ring->rp = ring->wp; /* corrupt, drop the lot */
+			else
+				ring->rp += SCULL_P_RECHDR + len; /* whole records only */
+		} else {
+			ring->rp += need - scull_p_spacefree(ring);
+		}
+		scull_p_publish_rp(ring);
+	}
+}
+
+/* tell the eventfd, if any, that data or room showed up; caller holds sem */
+static void scull_p_notify(struct scull_pipe *dev)
+{
+	if(dev->evfd)
+		scull_eventfd_signal(dev->evfd);
+}
+
+/*
+Instrumentation, switched on through debugfs (scullp/enable and
+scullp/timestamps). While off, each hook below is a patched-out jump.
+Everything is updated with the device semaphore held.
+*/
+static DEFINE_STATIC_KEY_FALSE(scull_p_stats_on);
+static DEFINE_STATIC_KEY_FALSE(scull_p_stamps_on);
+
+#define SCULL_P_COUNT(dev, field) \
+	do { if(static_branch_unlikely(&scull_p_stats_on)) (dev)->stats.field++; } while(0)
+
+/* start of a wait worth timing, 0 when nobody is looking */
+static inline u64 scull_p_clock(void)
+{
+	return static_branch_unlikely(&scull_p_stats_on) ? ktime_get_ns() : 0;
+}
+
+static void scull_p_hist_add(unsigned long *hist, u64 ns, unsigned long n)
+{
+	unsigned int b = ns ? ilog2(ns) : 0;
+
+	hist[min(b, SCULL_P_HIST_BUCKETS - 1U)] += n;
+}
+
+static inline void scull_p_stat_wait(unsigned long *hist, u64 t0)
+{
+	if(t0)
+		scull_p_hist_add(hist, ktime_get_ns() - t0, 1);
+}
+
+/* a write of the bytes from start to wp went in: sample the fill level, stamp them */
+static inline void scull_p_stat_write(struct scull_pipe *dev, unsigned long start)
+{
+	struct scull_p_stats *st = &dev->stats;
+	unsigned long used;
+
+	if(static_branch_unlikely(&scull_p_stats_on)){
+		used = scull_p_ring_used(&dev->ring);
+		st->fill[used * 10 / dev->ring.size]++;
+		st->max_fill = max(st->max_fill, used);
+	}
+	if(!static_branch_unlikely(&scull_p_stamps_on))
+		return;
+	if(st->stamp_head == st->stamp_tail)
+		st->stamp_pos = start;
+	if(st->stamp_head - st->stamp_tail == SCULL_P_STAMPS){
+		/* no room: these bytes count as written with the previous ones */
+		st->stamp[(st->stamp_head - 1) % SCULL_P_STAMPS].end = dev->ring.wp;
+		st->stamps_dropped++;
+		return;
+	}
+	st->stamp[st->stamp_head % SCULL_P_STAMPS].end = dev->ring.wp;
+	st->stamp[st->stamp_head % SCULL_P_STAMPS].ns = ktime_get_ns();
+	st->stamp_head++;
+}
+
+/* a read moved rp: writes now read in full waited this long, byte for byte */
+static inline void scull_p_stat_read(struct scull_pipe *dev)
+{
+	struct scull_p_stats *st = &dev->stats;
+	unsigned int i;
+	u64 now;
+
+	if(!static_branch_unlikely(&scull_p_stamps_on) || st->stamp_head == st->stamp_tail)
+		return;
+	now = ktime_get_ns();
+	while(st->stamp_tail != st->stamp_head){
+		i = st->stamp_tail % SCULL_P_STAMPS;
+		if((long)(st->stamp[i].end - dev->ring.rp) > 0)
+			break;
+		scull_p_hist_add(st->dwell, now - st->stamp[i].ns, st->stamp[i].end - st->stamp_pos);
+		st->stamp_pos = st->stamp[i].end;
+		st->stamp_tail++;
+	}
+}
+
+static void scull_p_lanes_release(struct scull_pipe *dev)
+{
+	int i;
+
+	scull_p_ring_release(&dev->ring);
+	for(i = 0; i < SCULL_P_NR_LANES - 1; i++)
+		scull_p_ring_release(&dev->prio[i]);
+}
+
+static int scull_p_open(struct inode *inode, struct file *filep)
+{
+	struct scull_pipe *dev;
+	struct scull_p_file *pf;
+	int result, i;
+
+	dev = container_of(inode->i_cdev, struct scull_pipe, cdev);
+	pf = kzalloc(sizeof(*pf), GFP_KERNEL);
+	if(!pf)
+		return -ENOMEM;
+	pf->dev = dev;
+	INIT_LIST_HEAD(&pf->list);
+	filep->private_data = pf;
+
+	if(down_interruptible(&dev->sem)){
+		kfree(pf);
+		return -ERESTARTSYS;
+	}
+	if(!dev->ring.pages){
+		/* allocate the buffer */
+		result = scull_p_ring_alloc(&dev->ring, scull_p_size_to_pages(dev->buffersize));
+		if(!result){
+			dev->ring.ctrl = (struct scull_p_ring_ctrl *)get_zeroed_page(GFP_KERNEL);
+			if(!dev->ring.ctrl){
+				scull_p_ring_release(&dev->ring);
+				result = -ENOMEM;
+			}
+		}
+		if(result){
+			up(&dev->sem);
+			kfree(pf);
+			return result;
+		}
+		dev->ring.ctrl->size = dev->ring.size;
+		dev->ring.ctrl->recmode = dev->recmode;
+		dev->ring.ctrl->data_offset = PAGE_SIZE;
+		dev->flushpos = 0;
+		dev->stats.stamp_head = dev->stats.stamp_tail = 0;
+		for(i = 0; !result && i < SCULL_P_NR_LANES - 1; i++)
+			result = scull_p_ring_alloc(&dev->prio[i], scull_p_size_to_pages(dev->prio_size[i]));
+		if(result){
+			scull_p_lanes_release(dev);
+			up(&dev->sem);
+			kfree(pf);
+			return result;
+		}
+	}
+
+	/* use f_mode, not f_flags: it's cleaner (fs/open.c tells why) */
+	if(filep->f_mode & FMODE_READ){
+		dev->nreaders++;
+		pf->rp = dev->ring.wp; /* broadcast readers start from now */
+		list_add_tail(&pf->list, &dev->readers);
+	}
+	if(filep->f_mode & FMODE_WRITE)
+		dev->nwriters++;
+	pf->busy_poll = clamp(scull_p_busy_poll, 0, SCULL_P_MAX_BUSY_POLL);
+	if(pf->busy_poll)
+		dev->nbusy++;
+	up(&dev->sem);
+
+	return nonseekable_open(inode, filep);
+}
+
+static int scull_p_release(struct inode *inode, struct file *filep)
+{
+	struct scull_p_file *pf = filep->private_data;
+	struct scull_pipe *dev = pf->dev;
+	
+	/* remove this filep from the asynchronously notified filp's */
+	scull_p_fasync(-1,filep,0);
+	mutex_lock(&dev->maplock); /* for nmaps; taken before sem as in setsize */
+	down(&dev->sem);
+	if(filep->f_mode & FMODE_READ){
+		dev->nreaders--;
+		list_del(&pf->list);
+		scull_p_bcast_update(dev); /* a slow reader going away frees space */
+	}
+	if(filep->f_mode & FMODE_WRITE)
+		dev->nwriters--;
+	if(pf->busy_poll)
+		dev->nbusy--;
+	if(dev->nreaders + dev->nwriters == 0){
+		timer_delete_sync(&dev->flush_timer);
+		/*
+		A mapping still shows the ring: keep it, and its record mode,
+		so the next open carries on with the same pages. It goes with
+		a later last close or with the module.
+		*/
+		if(!dev->nmaps){
+			scull_p_lanes_release(dev); /* the sizes are kept for the next open */
+			dev->recmode = scull_p_recmode;
+		}
+		dev->bcast = SCULL_P_BCAST_OFF;
+		dev->rcvlowat = dev->sndlowat = 1;
+		dev->flush_ms = 0;
+		if(dev->evfd)
+			eventfd_ctx_put(dev->evfd);
+		dev->evfd = NULL;
+	}
+	up(&dev->sem);
+	mutex_unlock(&dev->maplock);
+	wake_up_interruptible(&dev->outq);
+	kfree(pf);
+	return 0;
+}
+
+/*
+wait for data to read; caller must hold device semaphore.
+on error the semaphore will be release before returning.
+*/
+static int scull_getreaddata(struct scull_pipe *dev, struct file *filep)
+{
+	struct scull_p_file *pf = filep->private_data;
+	u64 t0 = 0;
+
+	scull_p_ring_sync(&dev->ring);
+	while(!scull_p_readable(pf)){ /* nothing (or too little) to read */
+		if(filep->f_flags & O_NONBLOCK){
+			if(scull_p_pending(pf))
+				break; /* below the watermark, but don't fail */
+			SCULL_P_COUNT(dev, read_eagain);
+			up(&dev->sem);
+			return -EAGAIN;
+		}
+		if(!t0)
+			t0 = scull_p_clock();
+		up(&dev->sem);
+		if(!pf->busy_poll || !scull_p_busy_wait(pf)){
+			pr_debug("%s reading going to sleep",current->comm);
+			if(wait_event_interruptible(dev->inq, scull_p_readable(pf)))
+				return -ERESTARTSYS;
+		}
+		/* otherwise loop, but first reacquire the lock */
+		if(down_interruptible(&dev->sem))
+			return -ERESTARTSYS;
+		scull_p_ring_sync(&dev->ring);
+	}
+	scull_p_stat_wait(dev->stats.read_sleep, t0);
+	return 0;
+}
+
+static ssize_t scull_p_read(struct file *filep, char __user *buf, size_t count, loff_t *f_pos)
+{
+	struct scull_p_file *pf = filep->private_data;
+	struct scull_pipe *dev = pf->dev;
+	struct scull_p_ring *ring;
+	unsigned long *rp;
+	ssize_t result;
+	int wake;
+	
+	if(down_interruptible(&dev->sem))
+		return -ERESTARTSYS;
+	
+	result = scull_getreaddata(dev, filep);
+	if(result)
+		return result; /* scull_getreaddata called up(&dev->sem) */
+
+	/* a higher lane goes first */
+	ring = scull_p_top_lane(dev);
+	if(ring){
+		rp = &ring->rp;
+	} else {
+		ring = &dev->ring;
+		rp = scull_p_cursor(pf);
+		if(pf->overrun){
+			/* tell about the gap once, the next read goes on after it */
+			pf->overrun = 0;
+			up(&dev->sem);
+			return -EOVERFLOW;
+		}
+	}
+
+	/* ok, data is there, return something */
+	if(dev->recmode == SCULL_P_RECORD)
+		result = scull_p_getrecord(ring, rp, buf, count);
+	else
+		result = scull_p_getbytes(ring, rp, buf, count);
+	if(ring == &dev->ring){
+		scull_p_bcast_update(dev);
+		scull_p_publish_rp(ring);
+		scull_p_stat_read(dev);
+	}
+	if(result > 0)
+		scull_p_notify(dev);
+	wake = scull_p_spacefree(ring) >= scull_p_sndlowat(dev, ring);
+	if(wake)
+		SCULL_P_COUNT(dev, writer_wakeups);
+	up(&dev->sem);
+	if(result < 0)
+		return result;
+
+	/* finaly, awake any writers (once there is room enough) and return */
+	if(wake)
+		wake_up_interruptible(&dev->outq);
+	pr_debug("%s did read %li bytes",current->comm, (long)result);
+	return result;
+}
+
+/*
+wait for at least "need" bytes of space for writing; caller must hold
+device semaphore. on error the semaphore will be release before returning.
+A writer that has to sleep waits for sndlowat bytes, not just "need".
+*/
+static int scull_getwritespace(struct scull_pipe *dev, struct scull_p_ring *ring,
+			       struct file *filep, size_t need)
+{
+	u64 t0 = 0;
+
+	scull_p_ring_sync(ring);
+	while(scull_p_spacefree(ring) < need) { /* full */
+		size_t want = max(need, (size_t)scull_p_sndlowat(dev, ring));
+		DEFINE_WAIT(wait);
+		
+		if(filep->f_flags & O_NONBLOCK){
+			SCULL_P_COUNT(dev, write_eagain);
+			up(&dev->sem);
+			return -EAGAIN;
+		}
+		if(!t0)
+			t0 = scull_p_clock();
+		up(&dev->sem);
+		pr_debug("%s writing: gpidn to sleep", current->comm);
+		prepare_to_wait(&dev->outq, &wait, TASK_INTERRUPTIBLE);
+		if(scull_p_spacefree(ring) < want)
+			schedule();
+		finish_wait(&dev->outq, &wait);
+		if(signal_pending(current))
+			return -ERESTARTSYS; /*signal: tell the fs layer to handle it*/
+		if(down_interruptible(&dev->sem))
+			return -ERESTARTSYS;
+		scull_p_ring_sync(ring);
+	}
+	scull_p_stat_wait(dev->stats.write_wait, t0);
+	return 0;
+}
+
+static ssize_t scull_p_write(struct file *filep, const char __user *buf, size_t count, loff_t *f_pos)
+{
+	struct scull_p_file *pf = filep->private_data;
+	struct scull_pipe *dev = pf->dev;
+	struct scull_p_ring *ring;
+	size_t need = 1;
+	unsigned long start;
+	ssize_t result;
+	int wake, syncwake;
+	
+	if(down_interruptible(&dev->sem))
+		return -ERESTARTSYS;
+	ring = scull_p_lane(dev, pf->lane);
+	if(ring != &dev->ring && dev->bcast){
+		up(&dev->sem);
+		return -EINVAL; /* broadcast has lane 0 only */
+	}
+
+	if(dev->recmode == SCULL_P_RECORD){
+		/* a record is written whole or not at all */
+		if(count == 0){
+			up(&dev->sem);
+			return 0;
+		}
+		need = SCULL_P_RECHDR + count;
+		if(need > ring->size){
+			up(&dev->sem);
+			return -EMSGSIZE;
+		}
+	}
+
+	/* lagging broadcast readers don't hold the writer back */
+	if(dev->bcast == SCULL_P_BCAST_OVERRUN)
+		scull_p_bcast_makeroom(dev, dev->recmode == SCULL_P_RECORD ?
+				       need : min(count, (size_t)dev->ring.size));
+
+	/* make sure there's space to write */
+	result = scull_getwritespace(dev,ring,filep,need);
+	if(result)
+		return result; /* scull_getwritespace called up(&dev->sem) */
+
+	/* ok, space is there, accept something */
+	start = ring->wp;
+	if(dev->recmode == SCULL_P_RECORD)
+		result = scull_p_putrecord(ring, buf, count);
+	else
+		result = scull_p_putbytes(ring, buf, count);
+	if(ring == &dev->ring){
+		scull_p_bcast_update(dev);
+		scull_p_publish_wp(ring);
+		if(result > 0)
+			scull_p_stat_write(dev, start);
+		wake = scull_p_ring_used(ring) >= scull_p_rcvlowat(dev);
+	} else {
+		wake = 1; /* no watermark holds a higher lane back */
+	}
+	if(result > 0)
+		scull_p_notify(dev);
+	if(wake)
+		SCULL_P_COUNT(dev, reader_wakeups);
+	syncwake = dev->nbusy;
+	if(!wake && dev->flush_ms && !timer_pending(&dev->flush_timer))
+		mod_timer(&dev->flush_timer, jiffies + msecs_to_jiffies(dev->flush_ms));
+	up(&dev->sem);
+	if(result < 0)
+		return result;
+	count = result;
+	if(!wake)
+		goto out; /* the flush timer or a later write will do it */
+
+	/* finally, make any reader */
+	if(syncwake) /* busy pollers want to run here, cache hot */
+		wake_up_interruptible_sync(&dev->inq);
+	else
+		wake_up_interruptible(&dev->inq); /* blocked in read() and select() */
+
+	/* and signal asychronous readers, explained late in chapter 5 */
+	if(dev->async_queue)
+		kill_fasync(&dev->async_queue, SIGIO, POLL_IN);
+  out:
+	pr_debug("%s did write %li bytes",current->comm, (long)count);
+	return count;
+}
+
+static unsigned int scull_p_poll(struct file *filep, poll_table *wait)
+{
+	struct scull_p_file *pf = filep->private_data;
+	struct scull_pipe *dev = pf->dev;
+	struct scull_p_ring *ring;
+	unsigned int mask = 0;
+
+	/*
+	The buffer is circular; it is considered full
+	if wp is a whole ring ahead of rp and empty if the two are equal
+	*/
+	down(&dev->sem);
+	scull_p_ring_sync(&dev->ring);
+	poll_wait(filep, &dev->inq, wait);
+	poll_wait(filep, &dev->outq, wait);
+	if(scull_p_readable(pf))
+		mask |= POLLIN | POLLRDNORM; /* readable */
+	ring = scull_p_lane(dev, pf->lane);
+	if(scull_p_spacefree(ring) >= max_t(unsigned long,
+					    dev->recmode == SCULL_P_RECORD ? SCULL_P_RECHDR + 1 : 1,
+					    scull_p_sndlowat(dev, ring)) ||
+	   dev->bcast == SCULL_P_BCAST_OVERRUN)
+		mask |= POLLOUT | POLLWRNORM; /* writable */
+	up(&dev->sem);
+	return mask;
+}
+
+static int scull_p_fasync(int fd, struct file *filep, int mode)
+{
+	struct scull_p_file *pf = filep->private_data;
+	struct scull_pipe *dev = pf->dev;
+	
+	return fasync_helper(fd,filep, mode, &dev->async_queue);
+}
+
+/*
+Hand back as many whole records as fit in the user buffer, each one
+as header plus payload padded to 4 bytes. Returns the record count.
+*/
+static long scull_p_readbatch(struct scull_pipe *dev, struct file *filep,
+			      struct scull_p_batch __user *ubatch)
+{
+	struct scull_p_ring *ring;
+	struct scull_p_file *pf = filep->private_data;
+	struct scull_p_batch batch;
+	char __user *out;
+	u32 len, used = 0, nrecs = 0;
+	unsigned long *rp, *rp0 = NULL;
+	long result;
+	int wake = 0;
+
+	if(copy_from_user(&batch, ubatch, sizeof(batch)))
+		return -EFAULT;
+	out = u64_to_user_ptr(batch.buf);
+
+	if(down_interruptible(&dev->sem))
+		return -ERESTARTSYS;
+	if(dev->recmode != SCULL_P_RECORD){
+		up(&dev->sem);
+		return -EINVAL;
+	}
+	result = scull_getreaddata(dev, filep);
+	if(result)
+		return result; /* scull_getreaddata called up(&dev->sem) */
+
+	/* records come highest lane first, a gap in lane 0 ends the batch */
+	while(!batch.max_recs || nrecs < batch.max_recs){
+		ring = scull_p_top_lane(dev);
+		if(ring){
+			rp = &ring->rp;
+		} else {
+			ring = &dev->ring;
+			if(!rp0){
+				rp0 = scull_p_cursor(pf);
+				if(pf->overrun && !nrecs){
+					pf->overrun = 0;
+					up(&dev->sem);
+					return -EOVERFLOW;
+				}
+			}
+			if(pf->overrun)
+				break; /* reported by the next call */
+			rp = rp0;
+		}
+		if(*rp == ring->wp)
+			break;
+		if(scull_p_reclen(ring, *rp, &len)){
+			/* deliver what came before, report it on the next call */
+			if(!nrecs){
+				*rp = ring->wp;
+				result = -EIO;
+			}
+			break;
+		}
+		if(SCULL_P_REC_SIZE(len) > batch.len - used)
+			break;
+		if(copy_to_user(out + used, &len, SCULL_P_RECHDR) ||
+		   scull_p_to_user(ring, *rp + SCULL_P_RECHDR, out + used + SCULL_P_RECHDR, len)){
+			result = -EFAULT;
+			break;
+		}
+		*rp += SCULL_P_RECHDR + len;
+		used += SCULL_P_REC_SIZE(len);
+		nrecs++;
+		if(ring != &dev->ring)
+			wake = 1; /* higher lane writers don't wait for watermarks */
+	}
+	scull_p_bcast_update(dev);
+	scull_p_publish_rp(&dev->ring);
+	scull_p_stat_read(dev);
+	if(nrecs)
+		scull_p_notify(dev);
+	wake |= scull_p_spacefree(&dev->ring) >= scull_p_sndlowat(dev, &dev->ring);
+	if(wake)
+		SCULL_P_COUNT(dev, writer_wakeups);
+	up(&dev->sem);
+
+	if(nrecs == 0) /* the first record alone doesn't fit */
+		return result ? result : -EMSGSIZE;
+	if(wake)
+		wake_up_interruptible(&dev->outq);
+
+	batch.nrecs = nrecs;
+	batch.bytes = used;
+	if(copy_to_user(ubatch, &batch, sizeof(batch)))
+		return -EFAULT;
+	return nrecs;
+}
+
+/*
+splice: data moves between the ring and a pipe as whole pages where it
+can, so splicing to a socket or file or from vmsplice() doesn't touch
+the payload. A read of a whole ring page hands that page to the pipe and
+puts a fresh one in the ring; a write of a whole, stealable pipe page at
+a page boundary of the ring swaps it in the same way. Everything else,
+and anything while the ring is mapped or shared by broadcast readers,
+is copied once. Record mode has no byte stream to splice.
+*/
+static const struct pipe_buf_operations scull_p_pipe_buf_ops = {
+	.release = generic_pipe_buf_release,
+	.try_steal = generic_pipe_buf_try_steal,
+	.get = generic_pipe_buf_get,
+};
+
+/* may pages of this ring be swapped? caller holds sem and has tried maplock */
+static int scull_p_can_swap(struct scull_pipe *dev, struct scull_p_ring *ring, int maplocked)
+{
+	if(ring != &dev->ring)
+		return 1;
+	return maplocked && !dev->nmaps && dev->bcast == SCULL_P_BCAST_OFF;
+}
+
+static ssize_t scull_p_splice_read(struct file *filep, loff_t *ppos, struct pipe_inode_info *pipe,
+				   size_t len, unsigned int flags)
+{
+	struct scull_p_file *pf = filep->private_data;
+	struct scull_pipe *dev = pf->dev;
+	struct scull_p_ring *ring;
+	struct pipe_buffer buf;
+	struct page *page, *fresh;
+	unsigned long *rp;
+	size_t chunk, total = 0;
+	ssize_t result = 0;
+	int maplocked, wake;
+	char *from;
+
+	if(down_interruptible(&dev->sem))
+		return -ERESTARTSYS;
+	if(dev->recmode == SCULL_P_RECORD){
+		up(&dev->sem);
+		return -EINVAL;
+	}
+	scull_p_ring_sync(&dev->ring);
+	if((flags & SPLICE_F_NONBLOCK) && !scull_p_readable(pf)){
+		/* below the watermark, take what is there like O_NONBLOCK reads */
+		if(!scull_p_pending(pf)){
+			up(&dev->sem);
+			return -EAGAIN;
+		}
+	} else {
+		result = scull_getreaddata(dev, filep);
+		if(result)
+			return result; /* scull_getreaddata called up(&dev->sem) */
+	}
+
+	ring = scull_p_top_lane(dev);
+	if(ring){
+		rp = &ring->rp;
+	} else {
+		ring = &dev->ring;
+		rp = scull_p_cursor(pf);
+		if(pf->overrun){
+			pf->overrun = 0;
+			up(&dev->sem);
+			return -EOVERFLOW;
+		}
+	}
+
+	/* no waiting for maplock here: mmap takes it before sem */
+	maplocked = mutex_trylock(&dev->maplock);
+	while(len && *rp != ring->wp && pipe->readers &&
+	      !pipe_full(pipe->head, pipe->tail, pipe->max_usage)){
+		from = scull_p_ring_addr(ring, *rp, &chunk);
+		chunk = min3(chunk, len, (size_t)(ring->wp - *rp));
+		page = NULL;
+		if(chunk == PAGE_SIZE && scull_p_can_swap(dev, ring, maplocked)){
+			fresh = alloc_page(GFP_KERNEL);
+			if(fresh){
+				page = virt_to_page(from);
+				ring->pages[(*rp & (ring->size - 1)) >> PAGE_SHIFT] = fresh;
+			}
+		}
+		if(!page){
+			page = alloc_page(GFP_KERNEL);
+			if(!page){
+				result = -ENOMEM;
+				break;
+			}
+			memcpy(page_address(page), from, chunk);
+		}
+		buf = (struct pipe_buffer) {
+			.page = page,
+			.offset = 0, /* only whole ring pages are swapped */
+			.len = chunk,
+			.ops = &scull_p_pipe_buf_ops,
+		};
+		result = add_to_pipe(pipe, &buf); /* drops the page on failure */
+		if(result < 0)
+			break;
+		*rp += chunk;
+		len -= chunk;
+		total += chunk;
+	}
+	if(maplocked)
+		mutex_unlock(&dev->maplock);
+	if(ring == &dev->ring){
+		scull_p_bcast_update(dev);
+		scull_p_publish_rp(ring);
+		scull_p_stat_read(dev);
+	}
+	if(total)
+		scull_p_notify(dev);
+	wake = scull_p_spacefree(ring) >= scull_p_sndlowat(dev, ring);
+	up(&dev->sem);
+
+	if(!total){
+		/* 0 would read as end of file: say why nothing moved */
+		if(result < 0 || !len)
+			return result;
+		return pipe->readers ? -EAGAIN : -EPIPE;
+	}
+	if(wake)
+		wake_up_interruptible(&dev->outq);
+	return total;
+}
+
+/* take one pipe buffer, or as much of it as fits */
+static int scull_p_splice_actor(struct pipe_inode_info *pipe, struct pipe_buffer *buf,
+				struct splice_desc *sd)
+{
+	struct file *filep = sd->u.file;
+	struct scull_p_file *pf = filep->private_data;
+	struct scull_pipe *dev = pf->dev;
+	struct scull_p_ring *ring;
+	unsigned long start;
+	size_t n, idx;
+	int result, maplocked, wake;
+	char *from;
+
+	if(down_interruptible(&dev->sem))
+		return -ERESTARTSYS;
+	ring = scull_p_lane(dev, pf->lane);
+	if(dev->recmode == SCULL_P_RECORD || (ring != &dev->ring && dev->bcast)){
+		up(&dev->sem);
+		return -EINVAL;
+	}
+	if(dev->bcast == SCULL_P_BCAST_OVERRUN)
+		scull_p_bcast_makeroom(dev, min((size_t)sd->len, (size_t)ring->size));
+	result = scull_getwritespace(dev, ring, filep, 1);
+	if(result)
+		return result; /* scull_getwritespace called up(&dev->sem) */
+
+	start = ring->wp;
+	n = min_t(size_t, sd->len, scull_p_spacefree(ring));
+	maplocked = mutex_trylock(&dev->maplock);
+	/*
+	vm_insert_page() refuses anonymous pages, so lane 0, which may be
+	mapped later, only takes page cache pages; the other lanes never are.
+	*/
+	if(n == PAGE_SIZE && buf->offset == 0 && !(ring->wp & ~PAGE_MASK) &&
+	   scull_p_can_swap(dev, ring, maplocked) &&
+	   !PageHighMem(buf->page) && !PageCompound(buf->page) &&
+	   (ring != &dev->ring || !PageAnon(buf->page)) &&
+	   pipe_buf_try_steal(pipe, buf)){
+		/* the page is ours now; the pipe still drops its own reference */
+		unlock_page(buf->page);
+		get_page(buf->page);
+		idx = (ring->wp & (ring->size - 1)) >> PAGE_SHIFT;
+		put_page(ring->pages[idx]);
+		ring->pages[idx] = buf->page;
+	} else {
+		result = pipe_buf_confirm(pipe, buf);
+		if(result){
+			if(maplocked)
+				mutex_unlock(&dev->maplock);
+			up(&dev->sem);
+			return result;
+		}
+		from = kmap(buf->page);
+		scull_p_poke(ring, ring->wp, from + buf->offset, n);
+		kunmap(buf->page);
+	}
+	if(maplocked)
+		mutex_unlock(&dev->maplock);
+	ring->wp += n;
+
+	if(ring == &dev->ring){
+		scull_p_bcast_update(dev);
+		scull_p_publish_wp(ring);
+		scull_p_stat_write(dev, start);
+		wake = scull_p_ring_used(ring) >= scull_p_rcvlowat(dev);
+	} else {
+		wake = 1;
+	}
+	scull_p_notify(dev);
+	if(!wake && dev->flush_ms && !timer_pending(&dev->flush_timer))
+		mod_timer(&dev->flush_timer, jiffies + msecs_to_jiffies(dev->flush_ms));
+	up(&dev->sem);
+
+	if(wake){
+		wake_up_interruptible(&dev->inq);
+		if(dev->async_queue)
+			kill_fasync(&dev->async_queue, SIGIO, POLL_IN);
+	}
+	return n;
+}
+
+static ssize_t scull_p_splice_write(struct pipe_inode_info *pipe, struct file *filep, loff_t *ppos,
+				    size_t len, unsigned int flags)
+{
+	return splice_from_pipe(pipe, filep, ppos, len, flags, scull_p_splice_actor);
+}
+
+/*
+Change the buffer size of a lane, keeping what is queued, in the way
+F_SETPIPE_SZ does for pipes: the size is rounded up to a power of two
+pages and going above the device limit needs CAP_SYS_RESOURCE.
+*/
+static long scull_p_setsize(struct scull_pipe *dev, int lane, unsigned long size)
+{
+	struct scull_p_ring *ring = scull_p_lane(dev, lane);
+	unsigned int npages;
+	long retval;
+
+	if(size == 0 || size > SCULL_P_HARD_MAX_BUFFER)
+		return -EINVAL;
+	npages = scull_p_size_to_pages(size);
+	size = (unsigned long)npages << PAGE_SHIFT;
+
+	/* maplock first: the mmap paths take it under mmap_lock and must not wait on sem */
+	mutex_lock(&dev->maplock);
+	if(down_interruptible(&dev->sem)){
+		mutex_unlock(&dev->maplock);
+		return -ERESTARTSYS;
+	}
+	if(size > dev->maxsize && !capable(CAP_SYS_RESOURCE)){
+		retval = -EPERM;
+		goto out;
+	}
+	if(dev->nmaps && ring == &dev->ring && size != ring->size){
+		retval = -EBUSY; /* the pages are mapped */
+		goto out;
+	}
+	scull_p_ring_sync(ring);
+	if(scull_p_ring_used(ring) > size){
+		retval = -EBUSY; /* the queued data wouldn't fit */
+		goto out;
+	}
+	if(ring->pages && npages != ring->npages){
+		retval = scull_p_ring_resize(ring, npages);
+		if(retval)
+			goto out;
+	}
+	if(lane)
+		dev->prio_size[lane - 1] = size;
+	else
+		dev->buffersize = size;
+	retval = size;
+
+  out:
+	up(&dev->sem);
+	mutex_unlock(&dev->maplock);
+	if(retval > 0) /* a bigger ring may let writers in */
+		wake_up_interruptible(&dev->outq);
+	return retval;
+}
+
+/* switching to or from broadcast needs an empty ring */
+static long scull_p_setbcast(struct scull_pipe *dev, unsigned long mode)
+{
+	struct scull_p_file *pf;
+	long retval = 0;
+
+	if(mode != SCULL_P_BCAST_OFF && mode != SCULL_P_BCAST_BLOCK &&
+	   mode != SCULL_P_BCAST_OVERRUN)
+		return -EINVAL;
+	mutex_lock(&dev->maplock);
+	if(down_interruptible(&dev->sem)){
+		mutex_unlock(&dev->maplock);
+		return -ERESTARTSYS;
+	}
+	scull_p_ring_sync(&dev->ring);
+	if((dev->ring.rp != dev->ring.wp || dev->nmaps || scull_p_top_lane(dev)) &&
+	   !dev->bcast != !mode){
+		retval = -EBUSY; /* mapped rings and higher lanes have a single consumer */
+		goto out;
+	}
+	if(!dev->bcast)
+		list_for_each_entry(pf, &dev->readers, list)
+			pf->rp = dev->ring.wp;
+	dev->bcast = mode;
+
+  out:
+	up(&dev->sem);
+	mutex_unlock(&dev->maplock);
+	return retval;
+}
+
+static long scull_p_seteventfd(struct scull_pipe *dev, unsigned long arg)
+{
+	struct eventfd_ctx *ctx = NULL, *old;
+
+	if((int)arg >= 0){
+		ctx = eventfd_ctx_fdget((int)arg);
+		if(IS_ERR(ctx))
+			return PTR_ERR(ctx);
+	}
+	if(down_interruptible(&dev->sem)){
+		if(ctx)
+			eventfd_ctx_put(ctx);
+		return -ERESTARTSYS;
+	}
+	old = dev->evfd;
+	dev->evfd = ctx;
+	up(&dev->sem);
+	if(old)
+		eventfd_ctx_put(old);
+	return 0;
+}
+
+static long scull_p_ioctl(struct file *filep, unsigned int cmd, unsigned long arg)
+{
+	struct scull_p_file *pf = filep->private_data;
+	struct scull_pipe *dev = pf->dev;
+	long retval = 0;
+
+	/* don't even decode wrong cmds: better returning ENOTTY than EFAULT */
+	if(_IOC_TYPE(cmd) != SCULL_IOC_MAGIC)
+		return -ENOTTY;
+	if(_IOC_NR(cmd) > SCULL_IOC_MAXNR)
+		return -ENOTTY;
+
+	switch(cmd) {
+	case SCULL_P_IOCTRECMODE:
+		if(arg != SCULL_P_STREAM && arg != SCULL_P_RECORD)
+			return -EINVAL;
+		if(down_interruptible(&dev->sem))
+			return -ERESTARTSYS;
+		/* the framing of queued data can't change under a reader */
+		scull_p_ring_sync(&dev->ring);
+		if((dev->ring.rp != dev->ring.wp || scull_p_top_lane(dev)) && dev->recmode != arg)
+			retval = -EBUSY;
+		else
+			dev->recmode = dev->ring.ctrl->recmode = arg;
+		up(&dev->sem);
+		break;
+
+	case SCULL_P_IOCQRECMODE:
+		retval = dev->recmode;
+		break;
+
+	case SCULL_P_IOCRDBATCH:
+		retval = scull_p_readbatch(dev, filep, (struct scull_p_batch __user *)arg);
+		break;
+
+	case SCULL_P_IOCTSIZE:
+		retval = scull_p_setsize(dev, pf->lane, arg);
+		break;
+
+	case SCULL_P_IOCQSIZE:
+		retval = pf->lane ? dev->prio_size[pf->lane - 1] : dev->buffersize;
+		break;
+
+	case SCULL_P_IOCTMAXSIZE:
+		if(!capable(CAP_SYS_RESOURCE))
+			return -EPERM;
+		if(arg < PAGE_SIZE || arg > SCULL_P_HARD_MAX_BUFFER)
+			return -EINVAL;
+		dev->maxsize = arg;
+		break;
+
+	case SCULL_P_IOCQMAXSIZE:
+		retval = dev->maxsize;
+		break;
+
+	case SCULL_P_IOCTBCAST:
+		retval = scull_p_setbcast(dev, arg);
+		break;
+
+	case SCULL_P_IOCQBCAST:
+		retval = dev->bcast;
+		break;
+
+	case SCULL_P_IOCQLOST:
+		if(down_interruptible(&dev->sem))
+			return -ERESTARTSYS;
+		scull_p_cursor(pf); /* account for a gap not read into yet */
+		retval = pf->lost;
+		pf->lost = 0;
+		up(&dev->sem);
+		break;
+
+	case SCULL_P_IOCTRCVLOWAT:
+		/* like SO_RCVLOWAT, 0 means 1 */
+		WRITE_ONCE(dev->rcvlowat, arg ? arg : 1);
+		wake_up_interruptible(&dev->inq); /* readers may be content now */
+		break;
+
+	case SCULL_P_IOCQRCVLOWAT:
+		retval = dev->rcvlowat;
+		break;
+
+	case SCULL_P_IOCTSNDLOWAT:
+		WRITE_ONCE(dev->sndlowat, arg ? arg : 1);
+		wake_up_interruptible(&dev->outq);
+		break;
+
+	case SCULL_P_IOCQSNDLOWAT:
+		retval = dev->sndlowat;
+		break;
+
+	case SCULL_P_IOCTFLUSH:
+		if(arg > 60 * MSEC_PER_SEC)
+			return -EINVAL;
+		WRITE_ONCE(dev->flush_ms, arg);
+		break;
+
+	case SCULL_P_IOCQFLUSH:
+		retval = dev->flush_ms;
+		break;
+
+	case SCULL_P_IOCTBUSYPOLL:
+		if(arg > SCULL_P_MAX_BUSY_POLL)
+			return -EINVAL;
+		if(down_interruptible(&dev->sem))
+			return -ERESTARTSYS;
+		dev->nbusy += !!arg - !!pf->busy_poll;
+		pf->busy_poll = arg;
+		up(&dev->sem);
+		break;
+
+	case SCULL_P_IOCQBUSYPOLL:
+		retval = pf->busy_poll;
+		break;
+
+	case SCULL_P_IOCGBUSYSTATS: {
+		struct scull_p_busy_stats st = {
+			.hits = atomic_long_read(&dev->spin_hits),
+			.misses = atomic_long_read(&dev->spin_misses),
+		};
+
+		if(copy_to_user((void __user *)arg, &st, sizeof(st)))
+			return -EFAULT;
+		break;
+	}
+
+	case SCULL_P_IOCTLANE:
+		if(arg >= SCULL_P_NR_LANES)
+			return -EINVAL;
+		pf->lane = arg;
+		break;
+
+	case SCULL_P_IOCQLANE:
+		retval = pf->lane;
+		break;
+
+	case SCULL_P_IOCTEVENTFD:
+		retval = scull_p_seteventfd(dev, arg);
+		break;
+
+	case SCULL_P_IOCKICK:
+		/* the mapping moved head or tail: wake whoever waits on the other side */
+		if(down_interruptible(&dev->sem))
+			return -ERESTARTSYS;
+		scull_p_ring_sync(&dev->ring);
+		scull_p_notify(dev);
+		up(&dev->sem);
+		wake_up_interruptible(&dev->inq);
+		wake_up_interruptible(&dev->outq);
+		if(dev->async_queue && scull_p_pending(pf))
+			kill_fasync(&dev->async_queue, SIGIO, POLL_IN);
+		break;
+
+	default:  /* redundant, as cmd was checked against MAXNR */
+		return -ENOTTY;
+	}
+	return retval;
+}
+
+/*
+debugfs: scullp/enable and scullp/timestamps switch the instrumentation
+on and off, scullp/scullpipeN shows a pipe's numbers and clears them
+when written to. Histograms are printed as "lowest-ns:count" pairs for
+the buckets that are not empty.
+*/
+static struct dentry *scull_p_debugfs;
+
+static int scull_p_key_get(void *data, u64 *val)
+{
+	*val = static_key_enabled((struct static_key_false *)data);
+	return 0;
+}
+
+static int scull_p_key_set(void *data, u64 val)
+{
+	struct scull_pipe *dev;
+	int i;
+
+	if(!val){
+		static_branch_disable((struct static_key_false *)data);
+		return 0;
+	}
+	if(data == &scull_p_stamps_on){
+		/* stamps left over from last time would make for huge dwell times */
+		for(i = 0; i < scull_p_nr_devs; i++){
+			dev = &scull_p_devices[i];
+			down(&dev->sem);
+			dev->stats.stamp_head = dev->stats.stamp_tail = 0;
+			up(&dev->sem);
+		}
+	}
+	static_branch_enable((struct static_key_false *)data);
+	return 0;
+}
+DEFINE_DEBUGFS_ATTRIBUTE(scull_p_key_fops, scull_p_key_get, scull_p_key_set, "%llu\n");
+
+static void scull_p_show_hist(struct seq_file *m, const char *name, unsigned long *hist)
+{
+	int i;
+
+	seq_printf(m, "%s", name);
+	for(i = 0; i < SCULL_P_HIST_BUCKETS; i++)
+		if(hist[i])
+			seq_printf(m, " %llu:%lu", i ? 1ULL << i : 0ULL, hist[i]);
+	seq_putc(m, '\n');
+}
+
+static int scull_p_stats_show(struct seq_file *m, void *v)
+{
+	struct scull_pipe *dev = m->private;
+	struct scull_p_stats *st = &dev->stats;
+	int i;
+
+	if(down_interruptible(&dev->sem))
+		return -ERESTARTSYS;
+	seq_printf(m, "size %lu\nqueued %lu\n", dev->buffersize,
+		   dev->ring.pages ? scull_p_ring_used(&dev->ring) : 0);
+	seq_printf(m, "readers %d\nwriters %d\n", dev->nreaders, dev->nwriters);
+	seq_printf(m, "reader_wakeups %lu\nwriter_wakeups %lu\n", st->reader_wakeups, st->writer_wakeups);
+	seq_printf(m, "read_eagain %lu\nwrite_eagain %lu\n", st->read_eagain, st->write_eagain);
+	seq_printf(m, "spin_hits %ld\nspin_misses %ld\n", atomic_long_read(&dev->spin_hits),
+		   atomic_long_read(&dev->spin_misses));
+	seq_printf(m, "max_fill %lu\nfill_tenths", st->max_fill);
+	for(i = 0; i < ARRAY_SIZE(st->fill); i++)
+		seq_printf(m, " %lu", st->fill[i]);
+	seq_putc(m, '\n');
+	scull_p_show_hist(m, "read_sleep_ns", st->read_sleep);
+	scull_p_show_hist(m, "write_wait_ns", st->write_wait);
+	scull_p_show_hist(m, "dwell_ns_bytes", st->dwell);
+	seq_printf(m, "stamps_dropped %lu\n", st->stamps_dropped);
+	up(&dev->sem);
+	return 0;
+}
+
+static int scull_p_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, scull_p_stats_show, inode->i_private);
+}
+
+static ssize_t scull_p_stats_write(struct file *file, const char __user *buf, size_t count, loff_t *ppos)
+{
+	struct scull_pipe *dev = ((struct seq_file *)file->private_data)->private;
+
+	if(down_interruptible(&dev->sem))
+		return -ERESTARTSYS;
+	memset(&dev->stats, 0, sizeof(dev->stats));
+	atomic_long_set(&dev->spin_hits, 0);
+	atomic_long_set(&dev->spin_misses, 0);
+	up(&dev->sem);
+	return count;
+}
+
+static const struct file_operations scull_p_stats_fops = {
+	.owner = THIS_MODULE,
+	.open = scull_p_stats_open,
+	.read = seq_read,
+	.write = scull_p_stats_write,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+static void scull_p_debugfs_init(void)
+{
+	char name[16];
+	int i;
+
+	scull_p_debugfs = debugfs_create_dir("scullp", NULL);
+	debugfs_create_file_unsafe("enable", 0600, scull_p_debugfs, &scull_p_stats_on, &scull_p_key_fops);
+	debugfs_create_file_unsafe("timestamps", 0600, scull_p_debugfs, &scull_p_stamps_on, &scull_p_key_fops);
+	for(i = 0; i < scull_p_nr_devs; i++){
+		snprintf(name, sizeof(name), "scullpipe%d", i);
+		debugfs_create_file(name, 0600, scull_p_debugfs, &scull_p_devices[i], &scull_p_stats_fops);
+	}
+}
+
+/*
+mmap: the control page at offset 0, then the data pages in ring order.
+The pages are inserted up front, so there is nothing to fault in; the
+ring can't be resized or switched to broadcast while it is mapped.
+This runs under mmap_lock, and read() and write() take the semaphore
+and then fault on user buffers, so only maplock is taken here: the
+pages of an open pipe only change in scull_p_setsize, which holds it.
+*/
+static void scull_p_vma_open(struct vm_area_struct *vma)
+{
+	struct scull_pipe *dev = vma->vm_private_data;
+
+	mutex_lock(&dev->maplock);
+	dev->nmaps++;
+	mutex_unlock(&dev->maplock);
+}
+
+static void scull_p_vma_close(struct vm_area_struct *vma)
+{
+	struct scull_pipe *dev = vma->vm_private_data;
+
+	mutex_lock(&dev->maplock);
+	dev->nmaps--;
+	mutex_unlock(&dev->maplock);
+}
+
+static const struct vm_operations_struct scull_p_vm_ops = {
+	.open = scull_p_vma_open,
+	.close = scull_p_vma_close,
+};
+
+static int scull_p_mmap(struct file *filep, struct vm_area_struct *vma)
+{
+	struct scull_p_file *pf = filep->private_data;
+	struct scull_pipe *dev = pf->dev;
+	struct scull_p_ring *ring = &dev->ring;
+	unsigned long npages = (vma->vm_end - vma->vm_start) >> PAGE_SHIFT;
+	unsigned long i;
+	int result;
+
+	if(!(vma->vm_flags & VM_SHARED))
+		return -EINVAL; /* a private copy of the ring is no use */
+	if(vma->vm_pgoff != 0)
+		return -EINVAL;
+
+	mutex_lock(&dev->maplock);
+	if(READ_ONCE(dev->bcast) != SCULL_P_BCAST_OFF){
+		result = -EBUSY;
+		goto out;
+	}
+	if(npages > ring->npages + 1){
+		result = -EINVAL;
+		goto out;
+	}
+	result = vm_insert_page(vma, vma->vm_start, virt_to_page(ring->ctrl));
+	for(i = 1; !result && i < npages; i++)
+		result = vm_insert_page(vma, vma->vm_start + (i << PAGE_SHIFT), ring->pages[i - 1]);
+	if(result)
+		goto out;
+	vma->vm_ops = &scull_p_vm_ops;
+	vma->vm_private_data = dev;
+	dev->nmaps++;
+
+  out:
+	mutex_unlock(&dev->maplock);
+	return result;
+}
+
+/*
+The file operations for the pipe device
+(soem are overlayed with bare scull)
+*/
+
+struct file_operations scull_pipe_fops = {
+	.owner = THIS_MODULE,
+	.read = scull_p_read,
+	.write = scull_p_write,
+	.poll = scull_p_poll,
+	.unlocked_ioctl = scull_p_ioctl,
+	.mmap = scull_p_mmap,
+	.splice_read = scull_p_splice_read,
+	.splice_write = scull_p_splice_write,
+	.open = scull_p_open,
+	.release = scull_p_release,
+	.fasync = scull_p_fasync,
+};
+
+/*-----------------------------------------------------------------------------------------*/
+/*
+The multi-queue pipe: scullmqN spreads records over shards, each a ring
+of its own with its own lock, so writers on different CPUs don't meet.
+Every write() is one record and read() returns one record; readers take
+records from the shards in round-robin order.
+
+Ordering: records of one shard come out in the order they went in, and
+nothing is promised across shards. With scull_mq_by_thread=0 a writer
+uses the shard of the CPU it runs on, so two writes from one thread keep
+their order unless the thread migrated in between; with 1 each thread
+is hashed to a fixed shard and its records always stay in order.
+*/
+static int scull_mq_nr_devs = SCULL_MQ_NR_DEVS;	/* number of multi-queue devices */
+int scull_mq_shards = 0;			/* shards per device, 0: one per CPU */
+int scull_mq_buffer = SCULL_MQ_BUFFER;		/* ring size of each shard */
+int scull_mq_by_thread = 0;			/* pick shards by thread, not CPU */
+static unsigned int majormq;
+
+module_param(scull_mq_shards, int, S_IRUGO);
+MODULE_PARM_DESC(scull_mq_shards, "Shards per scullmq device, 0 for one per possible CPU");
+module_param(scull_mq_buffer, int, S_IRUGO);
+MODULE_PARM_DESC(scull_mq_buffer, "Ring size of each scullmq shard, in bytes");
+module_param(scull_mq_by_thread, int, S_IRUGO);
+MODULE_PARM_DESC(scull_mq_by_thread, "Pick the shard by writing thread instead of by CPU");
+
+static struct scull_mq *scull_mq_devices;
+
+static int scull_mq_open(struct inode *inode, struct file *filep)
+{
+	struct scull_mq *mq = container_of(inode->i_cdev, struct scull_mq, cdev);
+	unsigned int i;
+	int result = 0;
+
+	filep->private_data = mq;
+	if(down_interruptible(&mq->sem))
+		return -ERESTARTSYS;
+	if(!mq->shards){
+		mq->nshards = scull_mq_shards > 0 ? scull_mq_shards : nr_cpu_ids;
+		mq->shards = kcalloc(mq->nshards, sizeof(*mq->shards), GFP_KERNEL);
+		if(!mq->shards){
+			result = -ENOMEM;
+			goto out;
+		}
+		for(i = 0; i < mq->nshards; i++){
+			mutex_init(&mq->shards[i].lock);
+			init_waitqueue_head(&mq->shards[i].outq);
+			result = scull_p_ring_alloc(&mq->shards[i].ring,
+						    scull_p_size_to_pages(scull_mq_buffer));
+			if(result)
+				break;
+		}
+		if(result){
+			while(i--)
+				scull_p_ring_release(&mq->shards[i].ring);
+			kfree(mq->shards);
+			mq->shards = NULL;
+			goto out;
+		}
+		atomic_set(&mq->nrecs, 0);
+	}
+	mq->nopen++;
+
+  out:
+	up(&mq->sem);
+	return result ? result : nonseekable_open(inode, filep);
+}
+
+static int scull_mq_release(struct inode *inode, struct file *filep)
+{
+	struct scull_mq *mq = filep->private_data;
+	unsigned int i;
+
+	down(&mq->sem);
+	if(--mq->nopen == 0){
+		for(i = 0; i < mq->nshards; i++)
+			scull_p_ring_release(&mq->shards[i].ring);
+		kfree(mq->shards);
+		mq->shards = NULL;
+	}
+	up(&mq->sem);
+	return 0;
+}
+
+static struct scull_mq_shard *scull_mq_myshard(struct scull_mq *mq)
+{
+	unsigned int n;
+
+	if(scull_mq_by_thread)
+		n = hash_32(current->pid, 32) % mq->nshards;
+	else
+		n = raw_smp_processor_id() % mq->nshards;
+	return &mq->shards[n];
+}
+
+/* take the oldest record of a shard; returns 0 if it was empty */
+static ssize_t scull_mq_getrecord(struct scull_mq_shard *shard, char __user *buf, size_t count)
+{
+	struct scull_p_ring *ring = &shard->ring;
+	u32 len;
+
+	if(ring->rp == ring->wp)
+		return 0;
+	scull_p_peek(ring, ring->rp, &len, SCULL_P_RECHDR);
+	count = min(count, (size_t)len);
+	if(scull_p_to_user(ring, ring->rp + SCULL_P_RECHDR, buf, count))
+		return -EFAULT;
+	ring->rp += SCULL_P_RECHDR + len;
+	return count; /* never 0: empty records aren't written */
+}
+
+static ssize_t scull_mq_read(struct file *filep, char __user *buf, size_t count, loff_t *f_pos)
+{
+	struct scull_mq *mq = filep->private_data;
+	struct scull_mq_shard *shard;
+	unsigned int i, start;
+	ssize_t result = 0;
+
+	if(count == 0)
+		return 0; /* don't throw a record away for nothing */
+
+	while(!result){
+		if(atomic_read(&mq->nrecs) == 0){
+			if(filep->f_flags & O_NONBLOCK)
+				return -EAGAIN;
+			if(wait_event_interruptible(mq->inq, atomic_read(&mq->nrecs) > 0))
+				return -ERESTARTSYS;
+		}
+		/* each read starts one shard further, so no shard starves */
+		start = atomic_inc_return(&mq->next);
+		for(i = 0; i < mq->nshards && !result; i++){
+			shard = &mq->shards[(start + i) % mq->nshards];
+			if(READ_ONCE(shard->ring.wp) == READ_ONCE(shard->ring.rp))
+				continue;
+			if(mutex_lock_interruptible(&shard->lock))
+				return -ERESTARTSYS;
+			result = scull_mq_getrecord(shard, buf, count);
+			mutex_unlock(&shard->lock);
+		}
+		if(!result) /* another reader beat us to it */
+			cond_resched();
+	}
+	if(result < 0)
+		return result;
+
+	atomic_dec(&mq->nrecs);
+	if(wq_has_sleeper(&shard->outq))
+		wake_up_interruptible(&shard->outq);
+	return result;
+}
+
+static ssize_t scull_mq_write(struct file *filep, const char __user *buf, size_t count, loff_t *f_pos)
+{
+	struct scull_mq *mq = filep->private_data;
+	struct scull_mq_shard *shard = scull_mq_myshard(mq);
+	struct scull_p_ring *ring = &shard->ring;
+	size_t need = SCULL_P_RECHDR + count;
+	u32 len = count;
+
+	if(count == 0)
+		return 0;
+	if(need > ring->size)
+		return -EMSGSIZE;
+
+	if(mutex_lock_interruptible(&shard->lock))
+		return -ERESTARTSYS;
+	while(ring->size - scull_p_ring_used(ring) < need){ /* full */
+		mutex_unlock(&shard->lock);
+		if(filep->f_flags & O_NONBLOCK)
+			return -EAGAIN;
+		if(wait_event_interruptible(shard->outq,
+				READ_ONCE(ring->size) - (READ_ONCE(ring->wp) - READ_ONCE(ring->rp)) >= need))
+			return -ERESTARTSYS;
+		if(mutex_lock_interruptible(&shard->lock))
+			return -ERESTARTSYS;
+	}
+	if(scull_p_from_user(ring, ring->wp + SCULL_P_RECHDR, buf, count)){
+		mutex_unlock(&shard->lock);
+		return -EFAULT;
+	}
+	scull_p_poke(ring, ring->wp, &len, SCULL_P_RECHDR);
+	ring->wp += need;
+	mutex_unlock(&shard->lock);
+
+	atomic_inc(&mq->nrecs);
+	if(wq_has_sleeper(&mq->inq))
+		wake_up_interruptible(&mq->inq);
+	return count;
+}
+
+static unsigned int scull_mq_poll(struct file *filep, poll_table *wait)
+{
+	struct scull_mq *mq = filep->private_data;
+	struct scull_mq_shard *shard = scull_mq_myshard(mq);
+	struct scull_p_ring *ring = &shard->ring;
+	unsigned int mask = 0;
+
+	poll_wait(filep, &mq->inq, wait);
+	poll_wait(filep, &shard->outq, wait);
+	if(atomic_read(&mq->nrecs) > 0)
+		mask |= POLLIN | POLLRDNORM; /* readable */
+	if(ring->size - scull_p_ring_used(ring) > SCULL_P_RECHDR)
+		mask |= POLLOUT | POLLWRNORM; /* writable, from this CPU */
+	return mask;
+}
+
+/*
+Batched read: one record from each shard in turn, round after round,
+until the buffer is full or everything queued has been taken.
+*/
+static long scull_mq_readbatch(struct scull_mq *mq, struct file *filep,
+			       struct scull_p_batch __user *ubatch)
+{
+	struct scull_p_batch batch;
+	struct scull_mq_shard *shard;
+	struct scull_p_ring *ring;
+	char __user *out;
+	u32 len, used = 0, nrecs = 0;
+	unsigned int i, start, idle;
+	int full = 0;
+	long result = 0;
+
+	if(copy_from_user(&batch, ubatch, sizeof(batch)))
+		return -EFAULT;
+	out = u64_to_user_ptr(batch.buf);
+
+  retry:
+	if(atomic_read(&mq->nrecs) == 0){
+		if(filep->f_flags & O_NONBLOCK)
+			return -EAGAIN;
+		if(wait_event_interruptible(mq->inq, atomic_read(&mq->nrecs) > 0))
+			return -ERESTARTSYS;
+	}
+
+	start = atomic_inc_return(&mq->next);
+	for(i = 0, idle = 0; idle < mq->nshards && !result; i++){
+		if(batch.max_recs && nrecs == batch.max_recs)
+			break;
+		shard = &mq->shards[(start + i) % mq->nshards];
+		ring = &shard->ring;
+		if(mutex_lock_interruptible(&shard->lock)){
+			result = -ERESTARTSYS;
+			break;
+		}
+		if(ring->rp == ring->wp){
+			mutex_unlock(&shard->lock);
+			idle++;
+			continue;
+		}
+		scull_p_peek(ring, ring->rp, &len, SCULL_P_RECHDR);
+		if(SCULL_P_REC_SIZE(len) > batch.len - used){
+			mutex_unlock(&shard->lock);
+			/* full: the next batch starts with this shard */
+			atomic_set(&mq->next, start + i - 1);
+			full = 1;
+			break;
+		}
+		if(copy_to_user(out + used, &len, SCULL_P_RECHDR) ||
+		   scull_p_to_user(ring, ring->rp + SCULL_P_RECHDR, out + used + SCULL_P_RECHDR, len)){
+			mutex_unlock(&shard->lock);
+			result = -EFAULT;
+			break;
+		}
+		ring->rp += SCULL_P_RECHDR + len;
+		mutex_unlock(&shard->lock);
+		atomic_dec(&mq->nrecs);
+		if(wq_has_sleeper(&shard->outq))
+			wake_up_interruptible(&shard->outq);
+		used += SCULL_P_REC_SIZE(len);
+		nrecs++;
+		idle = 0;
+	}
+
+	if(nrecs == 0){
+		if(result || full)
+			return result ? result : -EMSGSIZE;
+		/* another reader took them first */
+		if(filep->f_flags & O_NONBLOCK)
+			return -EAGAIN;
+		cond_resched();
+		goto retry;
+	}
+	batch.nrecs = nrecs;
+	batch.bytes = used;
+	if(copy_to_user(ubatch, &batch, sizeof(batch)))
+		return -EFAULT;
+	return nrecs;
+}
+
+static long scull_mq_ioctl(struct file *filep, unsigned int cmd, unsigned long arg)
+{
+	struct scull_mq *mq = filep->private_data;
+
+	if(_IOC_TYPE(cmd) != SCULL_IOC_MAGIC)
+		return -ENOTTY;
+
+	switch(cmd) {
+	case SCULL_P_IOCQRECMODE:
+		return SCULL_P_RECORD; /* always */
+
+	case SCULL_P_IOCRDBATCH:
+		return scull_mq_readbatch(mq, filep, (struct scull_p_batch __user *)arg);
+
+	case SCULL_P_IOCQSIZE:
+		return mq->shards[0].ring.size;
+
+	case SCULL_MQ_IOCQSHARDS:
+		return mq->nshards;
+
+	default:
+		return -ENOTTY;
+	}
+}
+
+struct file_operations scull_mq_fops = {
+	.owner = THIS_MODULE,
+	.read = scull_mq_read,
+	.write = scull_mq_write,
+	.poll = scull_mq_poll,
+	.unlocked_ioctl = scull_mq_ioctl,
+	.open = scull_mq_open,
+	.release = scull_mq_release,
+};
+
+static void scull_mq_cleanup(void)
+{
+	int i;
+
+	if(scull_mq_devices){
+		for(i = 0; i < scull_mq_nr_devs; i++){
+			device_destroy(scullp_class, MKDEV(majormq, i));
+			cdev_del(&scull_mq_devices[i].cdev);
+		}
+		kfree(scull_mq_devices);
+		scull_mq_devices = NULL;
+	}
+	if(majormq)
+		unregister_chrdev_region(MKDEV(majormq, 0), scull_mq_nr_devs);
+	majormq = 0; /* module init may come back here after a failed scull_mq_init */
+}
+
+static int scull_mq_init(void)
+{
+	dev_t devmq;
+	int error, i;
+
+	error = alloc_chrdev_region(&devmq, 0, scull_mq_nr_devs, "scullmq");
+	if(error < 0){
+		pr_err("can't get major number\n");
+		return error;
+	}
+	majormq = MAJOR(devmq);
+
+	scull_mq_devices = kcalloc(scull_mq_nr_devs, sizeof(struct scull_mq), GFP_KERNEL);
+	if(!scull_mq_devices){
+		scull_mq_cleanup();
+		return -ENOMEM;
+	}
+	for(i = 0; i < scull_mq_nr_devs; i++){
+		struct scull_mq *mq = &scull_mq_devices[i];
+
+		init_waitqueue_head(&mq->inq);
+		sema_init(&mq->sem, 1);
+		cdev_init(&mq->cdev, &scull_mq_fops);
+		mq->cdev.owner = THIS_MODULE;
+		error = cdev_add(&mq->cdev, MKDEV(majormq, i), 1);
+		if(error){
+			pr_err("Error %d adding scullmq%d\n", error, i);
+			goto fail;
+		}
+		if(IS_ERR(device_create(scullp_class, NULL, MKDEV(majormq, i), NULL, "scullmq%d", i))){
+			pr_err("Error creating scull mq device.\n");
+			cdev_del(&mq->cdev);
+			error = -ENODEV;
+			goto fail;
+		}
+	}
+	pr_info("scullmq major number = %d\n", majormq);
+	return 0;
+
+fail:
+	/* only devices before i are fully set up */
+	while(i--){
+		device_destroy(scullp_class, MKDEV(majormq, i));
+		cdev_del(&scull_mq_devices[i].cdev);
+	}
+	kfree(scull_mq_devices);
+	scull_mq_devices = NULL;
+	scull_mq_cleanup();
+	return error;
+}
+
+int scull_open(struct inode * inode, struct file * filp)
+{
+    struct scull_dev *dev; /* device information */
+
+    dev = container_of(inode->i_cdev, struct scull_dev, cdev);
+    filp->private_data = dev; /* for other methods */
+    pr_debug("Someone tried to open me\n");
+
+    /* opening for writing with O_TRUNC empties the device */
+    if ((filp->f_mode & FMODE_WRITE) && (filp->f_flags & O_TRUNC)) {
+        if (down_interruptible(&dev->sem))
+            return -ERESTARTSYS;
+        scull_trim(dev);
+        up(&dev->sem);
+    }
+    return 0;
+}
+
+int scull_release(struct inode * inode, struct file * filp)
+{
+    pr_debug("Someone closed me\n");
+    return 0;
+}
+
+/* the quantum arithmetic lives in scull-core.c */
+ssize_t scull_read (struct file *filp, char __user * buf, size_t count, loff_t * f_pos)
+{
+    return scull_store_read(filp->private_data, buf, count, f_pos);
+}
+
+ssize_t scull_write(struct file * filp, const char __user * buf, size_t count, loff_t * f_pos)
+{
+    return scull_store_write(filp->private_data, buf, count, f_pos);
+}
+
+/*
+ * The "extended" operations -- only seek
+ */
+
+loff_t scull_llseek(struct file *filp, loff_t off, int whence)
+{
+    struct scull_dev *dev = filp->private_data;
+    loff_t newpos;
+
+    switch(whence) {
+      case 0: /* SEEK_SET */
+        newpos = off;
+        break;
+
+      case 1: /* SEEK_CUR */
+        newpos = filp->f_pos + off;
+        break;
+
+      case 2: /* SEEK_END */
+        newpos = dev->size + off;
+        break;
+
+      default: /* can't happen */
+        return -EINVAL;
+    }
+    if (newpos < 0) return -EINVAL;
+    filp->f_pos = newpos;
+    return newpos;
+}
+
+/*
+ * The geometry can only change while the device is empty, otherwise
+ * the data already stored would be laid out wrong.
+ */
+long scull_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
+{
+    struct scull_dev *dev = filp->private_data;
+    long retval = 0;
+
+    if (_IOC_TYPE(cmd) != SCULL_IOC_MAGIC) return -ENOTTY;
+    if (_IOC_NR(cmd) > SCULL_IOC_MAXNR) return -ENOTTY;
+
+    switch(cmd) {
+      case SCULL_IOCTQUANTUM:
+      case SCULL_IOCTQSET:
+        /* a quantum is one kmalloc(), a qset one array of pointers */
+        if (arg < 1 || arg > INT_MAX ||
+            arg > (cmd == SCULL_IOCTQUANTUM ? KMALLOC_MAX_SIZE : KMALLOC_MAX_SIZE / sizeof(char *)))
+            return -EINVAL;
+        if (down_interruptible(&dev->sem))
+            return -ERESTARTSYS;
+        if (dev->data)
+            retval = -EBUSY;
+        else if (arg > (unsigned long)LONG_MAX / (cmd == SCULL_IOCTQUANTUM ? dev->qset : dev->quantum))
+            retval = -EINVAL; /* quantum * qset, scull_locate's item size, must fit a long */
+        else if (cmd == SCULL_IOCTQUANTUM)
+            dev->quantum = arg;
+        else
+            dev->qset = arg;
+        up(&dev->sem);
+        break;
+
+      case SCULL_IOCQQUANTUM:
+        return dev->quantum;
+
+      case SCULL_IOCQQSET:
+        return dev->qset;
+
+      default:  /* redundant, as cmd was checked against MAXNR */
+        return -ENOTTY;
+    }
+    return retval;
+}
+
+struct file_operations scull_fops = {
+    owner:      THIS_MODULE,
+    open:       scull_open,
+    release:    scull_release,
+    read:       scull_read,
+    write:      scull_write,
+    llseek:     scull_llseek,
+    unlocked_ioctl: scull_ioctl,
+};
+
+/*
+ * Microbenchmark of the storage core, in debugfs as scullp/core_bench:
+ * reading it fills a private device of growing size quantum by quantum,
+ * looks up random positions in it and trims it, all with the module's
+ * geometry, and prints the average cost of each step. scull_follow()
+ * walks a list, so lookups are expected to grow with the size; anything
+ * that grows faster is a regression. scullp/core_bench_max is the
+ * largest size tried, in bytes.
+ */
+#define SCULL_BENCH_LOOKUPS 4096
+
+static unsigned long scull_bench_max = 16 * 1024 * 1024;
+
+static int scull_bench_show(struct seq_file *m, void *v)
+{
+    struct scull_dev *dev;
+    unsigned long size, nquanta, i;
+    int item, s_pos, q_pos, retval = 0;
+    u64 t0, alloc_ns, follow_ns, trim_ns;
+    loff_t pos;
+
+    dev = kzalloc(sizeof(*dev), GFP_KERNEL);
+    if (!dev)
+        return -ENOMEM;
+    dev->quantum = scull_quantum;
+    dev->qset = scull_qset;
+
+    seq_printf(m, "quantum %d qset %d\n", dev->quantum, dev->qset);
+    seq_puts(m, "size quanta items alloc_ns/quantum follow_ns/lookup trim_ns/quantum\n");
+    for (size = 64 * 1024; size <= min(scull_bench_max, 1UL << 30); size *= 4) {
+        nquanta = DIV_ROUND_UP(size, dev->quantum);
+
+        t0 = ktime_get_ns();
+        for (i = 0; i < nquanta; i++) {
+            scull_locate(dev, (loff_t)i * dev->quantum, &item, &s_pos, &q_pos);
+            if (!scull_get_quantum(dev, item, s_pos)) {
+                retval = -ENOMEM;
+                goto out;
+            }
+            if (!(i & 255))
+                cond_resched();
+        }
+        alloc_ns = ktime_get_ns() - t0;
+
+        /* a multiplicative hash spreads the lookups over the device */
+        t0 = ktime_get_ns();
+        for (i = 0; i < SCULL_BENCH_LOOKUPS; i++) {
+            pos = (i * 2654435761UL) % size;
+            scull_locate(dev, pos, &item, &s_pos, &q_pos);
+            if (!scull_follow(dev, item)) {
+                retval = -ENOMEM;
+                goto out;
+            }
+        }
+        follow_ns = ktime_get_ns() - t0;
+
+        t0 = ktime_get_ns();
+        scull_trim(dev);
+        trim_ns = ktime_get_ns() - t0;
+
+        seq_printf(m, "%lu %lu %lu %llu %llu %llu\n", size, nquanta,
+                   DIV_ROUND_UP(nquanta, dev->qset), div_u64(alloc_ns, nquanta),
+                   div_u64(follow_ns, SCULL_BENCH_LOOKUPS), div_u64(trim_ns, nquanta));
+        cond_resched();
+    }
+  out:
+    scull_trim(dev);
+    kfree(dev);
+    return retval;
+}
+DEFINE_SHOW_ATTRIBUTE(scull_bench);
+
+static void __exit scull_char_cleanup_module(void)
+{
+    int i;
+    debugfs_remove_recursive(scull_p_debugfs);
+    unregister_chrdev_region(MKDEV(major, 0), 1);
+    unregister_chrdev_region(MKDEV(majorp,0), 1);
+
+        /* Get rid of our char dev entries */
+    if (scull_devices) {
+        for (i = 0; i < scull_nr_devs; i++) {
+            scull_trim(scull_devices + i);
+            device_destroy(scull_class, MKDEV(major, i));
+            cdev_del(&scull_devices[i].cdev);
+        }
+        kfree(scull_devices);
+    }
+    class_destroy(scull_class);
+
+   if(scull_p_devices) {
+	for(i=0;i < scull_p_nr_devs; i++)
+	{
+		device_destroy(scullp_class, MKDEV(majorp,i));
+		cdev_del(&scull_p_devices[i].cdev);
+		scull_p_lanes_release(&scull_p_devices[i]);
+	}
+	kfree(scull_p_devices);
+   }
+   scull_mq_cleanup();
+   class_destroy(scullp_class);
+    pr_info("scull char and pipe module Unloaded\n");
+}
+
+static int __init scull_char_init_module(void)
+{
+    int error,i,j;
+    dev_t devt = 0;
+    dev_t devp = 0;
+
+    /* Get a range of minor numbers (starting with 0) to work with */
+    error = alloc_chrdev_region(&devt, 0, 1, "scull_char");
+    if (error < 0) {
+        pr_err("Can't get major number\n");
+        return error;
+    }
+    major = MAJOR(devt);
+    pr_info("scull_char major number = %d\n",major);
+
+    error = alloc_chrdev_region(&devp, 0, 1, "scullp");
+    if(error < 0){
+	pr_err("can't get major number\n");
+	return error;
+    }
+    majorp = MAJOR(devp);
+    pr_info("scullp major number = %d\n",MAJOR(devp));
+
+    /* Create device class, visible in /sys/class */
+    scull_class = scull_class_create("scull_char_class");
+    if (IS_ERR(scull_class)) {
+        pr_err("Error creating scull char class.\n");
+        unregister_chrdev_region(MKDEV(major, 0), 1);
+        return PTR_ERR(scull_class);
+    }
+	
+    scullp_class = scull_class_create("scullp_class");
+    if(IS_ERR(scull_class)){
+	pr_err("Error creating scullp class.\n");
+	unregister_chrdev_region(MKDEV(MAJOR(devp),0),1);
+	return PTR_ERR(scullp_class);
+    }
+
+    scull_devices =  kmalloc(scull_nr_devs * sizeof(struct scull_dev), GFP_KERNEL);
+    if (!scull_devices) {
+        error = -ENOMEM;
+        goto fail;  /* Make this more graceful */
+    }
+
+    scull_p_devices = kmalloc(scull_p_nr_devs * sizeof(struct scull_pipe), GFP_KERNEL);
+    if(!scull_devices) {
+	error = -ENOMEM;
+	goto fail; /*make this more graceful */
+    }
+
+    memset(scull_devices, 0, scull_nr_devs * sizeof(struct scull_dev));
+    memset(scull_p_devices, 0, scull_p_nr_devs * sizeof(struct scull_pipe));
+
+    for(i=0; i<scull_nr_devs; i++){
+        /* Initialize the char device and tie a file_operations to it */
+        scull_devices[i].quantum = scull_quantum;
+        scull_devices[i].qset = scull_qset;
+        sema_init(&scull_devices[i].sem, 1);
+
+        cdev_init(&scull_devices[i].cdev, &scull_fops);
+        scull_devices[i].cdev.owner = THIS_MODULE;
+        scull_devices[i].cdev.ops = &scull_fops;
+        /* Now make the device live for the users to access */
+        cdev_add(&scull_devices[i].cdev, MKDEV(MAJOR(devt),MINOR(devt)+i), 1);
+
+        if (IS_ERR(device_create(scull_class,NULL,MKDEV(MAJOR(devt),MINOR(devt)+i),NULL,"scull_char%d",i))) {
+            pr_err("Error creating scull char device.\n");
+            for(j=0;j<i;j++)
+            {
+                scull_trim(scull_devices + j);
+                device_destroy(scull_class,MKDEV(MAJOR(devt),MINOR(devt)+j));
+                cdev_del(&scull_devices[j].cdev);
+            }
+            class_destroy(scull_class);
+            unregister_chrdev_region(devt, 1);
+            return -1;
+        }    
+    }
+
+    for(i=0; i<scull_p_nr_devs; i++){
+        /* Initialize the char device and tie a file_operations to it */
+        init_waitqueue_head(&(scull_p_devices[i].inq));
+	init_waitqueue_head(&(scull_p_devices[i].outq));
+        sema_init(&scull_p_devices[i].sem, 1);
+        INIT_LIST_HEAD(&scull_p_devices[i].readers);
+        mutex_init(&scull_p_devices[i].maplock);
+        timer_setup(&scull_p_devices[i].flush_timer, scull_p_flush_timeout, 0);
+        scull_p_devices[i].rcvlowat = scull_p_devices[i].sndlowat = 1;
+        scull_p_devices[i].recmode = scull_p_recmode;
+        scull_p_devices[i].buffersize = scull_p_buffer;
+        for(j = 0; j < SCULL_P_NR_LANES - 1; j++)
+            scull_p_devices[i].prio_size[j] = SCULL_P_LANE_BUFFER;
+        scull_p_devices[i].maxsize = max(scull_p_max_buffer, scull_p_buffer);
+
+        cdev_init(&scull_p_devices[i].cdev, &scull_pipe_fops);
+        scull_p_devices[i].cdev.owner = THIS_MODULE;
+        scull_p_devices[i].cdev.ops = &scull_pipe_fops;
+        /* Now make the device live for the users to access */
+        cdev_add(&scull_p_devices[i].cdev, MKDEV(MAJOR(devp),MINOR(devp)+i), 1);
+
+        if (IS_ERR(device_create(scullp_class,NULL,MKDEV(MAJOR(devp),MINOR(devp)+i),NULL,"scullpipe%d",i))) {
+            pr_err("Error creating scull pipe device.\n");
+            for(j=0;j<i;j++)
+            {
+                device_destroy(scull_class,MKDEV(MAJOR(devp),MINOR(devp)+j));
+                cdev_del(&scull_p_devices[j].cdev);
+            }
+            class_destroy(scullp_class);
+            unregister_chrdev_region(devp, 1);
+            return -1;
+        }
+    }
+
+    scull_p_debugfs_init();
+    debugfs_create_file("core_bench", 0400, scull_p_debugfs, NULL, &scull_bench_fops);
+    debugfs_create_ulong("core_bench_max", 0600, scull_p_debugfs, &scull_bench_max);
+
+    error = scull_mq_init();
+    if(error)
+        goto fail;
+
+    pr_info("scull char and pipe module loaded\n");
+    return 0;
+
+fail:
+    scull_char_cleanup_module();
+    return error;
+}
+
+module_init(scull_char_init_module);
+module_exit(scull_char_cleanup_module);
+
+MODULE_AUTHOR("Kiran Kumar Uggina <suryakiran104@gmail.com>");
+MODULE_DESCRIPTION("scull device driver");
+MODULE_LICENSE("GPL");
+
+#ifdef CONFIG_SCULL_CORE_KUNIT_TEST
+#include "scull_core_test.c"
+#endif
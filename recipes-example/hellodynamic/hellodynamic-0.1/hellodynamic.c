@@ -1,7 +1,81 @@
+/*
+ * hellodynamic: a tour of libscull. Writes a greeting to a scull_char
+ * device through a buffered stream and reads it back, then sends a few
+ * messages through a scull pipe and picks them up with the epoll
+ * consumer, from the mapped ring when the pipe allows it.
+ */
 #include<stdio.h>
-#include"hwdynamic.h"
-int main()
+#include<string.h>
+#include<fcntl.h>
+#include<unistd.h>
+#include<sys/epoll.h>
+#include<libscull.h>
+
+#define NMSG 8
+
+static int got;
+
+static void on_data(void *arg, const void *data, size_t len)
 {
-	printf("%s %s",hwdynamic1(), hwdynamic2());
-	return 0;
+	(void)arg;
+	printf("pipe: %.*s", (int)len, (const char *)data);
+	got += len;
+}
+
+int main(int argc, char **argv)
+{
+	const char *chardev = argc > 1 ? argv[1] : "/dev/scull_char0";
+	const char *pipedev = argc > 2 ? argv[2] : "/dev/scullpipe0";
+	struct scull_stream *s;
+	struct scull_consumer *c;
+	struct epoll_event ev;
+	char msg[64], back[64];
+	int i, len, want = 0, epfd, rfd;
+	ssize_t n;
+
+	/* the memory device: buffered write, read back in one go */
+	len = snprintf(msg, sizeof(msg), "hello from libscull %s\n", LIBSCULL_VERSION);
+	s = scull_stream_open(chardev, O_WRONLY | O_TRUNC, 4096);
+	if(!s || scull_stream_write(s, msg, len) != len || scull_stream_close(s)){
+		perror(chardev);
+		return 1;
+	}
+	s = scull_stream_open(chardev, O_RDONLY, 4096);
+	if(!s || (n = scull_stream_read_full(s, back, sizeof(back) - 1)) < 0){
+		perror(chardev);
+		return 1;
+	}
+	scull_stream_close(s);
+	printf("%s: %.*s", chardev, (int)n, back);
+
+	/* the pipe: a consumer in an epoll loop, a writer on the same thread */
+	epfd = epoll_create1(0);
+	rfd = open(pipedev, O_RDONLY);
+	s = scull_stream_open(pipedev, O_WRONLY, 4096);
+	if(epfd < 0 || rfd < 0 || !s){
+		perror(pipedev);
+		return 1;
+	}
+	c = scull_consumer_new(epfd, rfd, SCULL_CONSUMER_MMAP, 4096, on_data, NULL);
+	if(!c){
+		perror("scull_consumer_new");
+		return 1;
+	}
+	printf("consumer reads %s\n", scull_consumer_mapped(c) ? "the mapped ring" : "with read()");
+	for(i = 0; i < NMSG; i++){
+		len = snprintf(msg, sizeof(msg), "message %d\n", i);
+		scull_stream_write(s, msg, len);
+		want += len;
+	}
+	scull_stream_flush(s);
+
+	while(got < want && epoll_wait(epfd, &ev, 1, 1000) == 1)
+		if(ev.data.ptr == c && scull_consumer_ready(c) < 0)
+			break;
+
+	scull_consumer_free(c);
+	scull_stream_close(s);
+	close(rfd);
+	close(epfd);
+	return got == want ? 0 : 1;
 }
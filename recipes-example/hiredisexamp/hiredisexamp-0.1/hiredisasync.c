@@ -0,0 +1,324 @@
+/*
+ * hiredisasync: the asynchronous hiredis API on many connections at
+ * once. Each worker thread runs its own epoll loop over its own set of
+ * redisAsyncContexts and keeps a fixed number of commands in flight on
+ * each, reissuing one as every reply comes back. At the end it prints
+ * the replies per second of every thread and of all of them together.
+ *
+ * hiredis ships adapters for libevent, libev and others; the few lines
+ * of glue below make it drive epoll directly instead.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+
+#include "hiredis/hiredis.h"
+#include "hiredis/async.h"
+
+struct worker;
+
+struct conn {
+    struct worker *w;
+    redisAsyncContext *ac;      /* NULL once hiredis has let go of it */
+    int fd;
+    unsigned int events;        /* what epoll watches for now */
+    unsigned int inflight;
+    unsigned long seq;
+};
+
+struct worker {
+    pthread_t thread;
+    int id;
+    int epfd;
+    struct conn *conns;
+    unsigned int nconns;
+    unsigned int live;          /* connections not yet disconnected */
+    unsigned long ops;          /* replies received */
+    unsigned long errors;
+    unsigned long ops_at_end;   /* ops when the clock ran out */
+    int stopping;
+};
+
+static const char *host = "127.0.0.1";
+static const char *unix_path;
+static int port = 6379;
+static unsigned int nthreads = 4, conns_per_thread = 32, depth = 16;
+static double duration = 10, t_start, t_end;
+static pthread_barrier_t start_line;
+
+static double now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* the epoll adapter */
+
+static void ev_set(struct conn *cn, unsigned int events) {
+    struct epoll_event ev;
+    int op;
+
+    if (events == cn->events)
+        return;
+    op = !cn->events ? EPOLL_CTL_ADD : events ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = events;
+    ev.data.ptr = cn;
+    if (epoll_ctl(cn->w->epfd, op, cn->fd, &ev) == 0)
+        cn->events = events;
+}
+
+static void ev_add_read(void *privdata) {
+    struct conn *cn = privdata;
+    ev_set(cn, cn->events | EPOLLIN);
+}
+
+static void ev_del_read(void *privdata) {
+    struct conn *cn = privdata;
+    ev_set(cn, cn->events & ~EPOLLIN);
+}
+
+static void ev_add_write(void *privdata) {
+    struct conn *cn = privdata;
+    ev_set(cn, cn->events | EPOLLOUT);
+}
+
+static void ev_del_write(void *privdata) {
+    struct conn *cn = privdata;
+    ev_set(cn, cn->events & ~EPOLLOUT);
+}
+
+static void ev_cleanup(void *privdata) {
+    struct conn *cn = privdata;
+    ev_set(cn, 0);
+}
+
+static void ev_attach(struct conn *cn) {
+    redisAsyncContext *ac = cn->ac;
+
+    cn->fd = ac->c.fd;
+    ac->ev.data = cn;
+    ac->ev.addRead = ev_add_read;
+    ac->ev.delRead = ev_del_read;
+    ac->ev.addWrite = ev_add_write;
+    ac->ev.delWrite = ev_del_write;
+    ac->ev.cleanup = ev_cleanup;
+}
+
+/* the workload */
+
+static void issue(struct conn *cn);
+
+static void on_reply(redisAsyncContext *ac, void *r, void *privdata) {
+    struct conn *cn = privdata;
+    redisReply *reply = r;
+
+    (void)ac;
+    cn->inflight--;
+    if (!reply)
+        return; /* disconnecting */
+    cn->w->ops++;
+    if (reply->type == REDIS_REPLY_ERROR) {
+        if (!cn->w->errors++)
+            fprintf(stderr, "thread %d: %s\n", cn->w->id, reply->str);
+    }
+    if (!cn->w->stopping)
+        issue(cn);
+}
+
+/* one command of the SET/GET/INCR mix */
+static void issue(struct conn *cn) {
+    char key[48];
+    int ret;
+
+    snprintf(key, sizeof(key), "async:%d:%lu", cn->w->id, cn->seq % 1000);
+    switch (cn->seq++ % 3) {
+    case 0: ret = redisAsyncCommand(cn->ac, on_reply, cn, "SET %s %s", key, "hello world"); break;
+    case 1: ret = redisAsyncCommand(cn->ac, on_reply, cn, "GET %s", key); break;
+    default: ret = redisAsyncCommand(cn->ac, on_reply, cn, "INCR async:counter"); break;
+    }
+    if (ret == REDIS_OK)
+        cn->inflight++;
+}
+
+/* hiredis is done with the context; depending on its version it may say so twice */
+static void gone(struct conn *cn) {
+    if (cn->ac) {
+        cn->ac = NULL;
+        cn->w->live--;
+    }
+}
+
+static void on_connect(const redisAsyncContext *ac, int status) {
+    struct conn *cn = ac->data;
+
+    if (status != REDIS_OK) {
+        fprintf(stderr, "thread %d: connect: %s\n", cn->w->id, ac->errstr);
+        gone(cn);
+    }
+}
+
+static void on_disconnect(const redisAsyncContext *ac, int status) {
+    struct conn *cn = ac->data;
+
+    if (status != REDIS_OK && !cn->w->stopping)
+        fprintf(stderr, "thread %d: disconnected: %s\n", cn->w->id, ac->errstr);
+    gone(cn);
+}
+
+static int connect_all(struct worker *w) {
+    unsigned int i, k;
+
+    for (i = 0; i < w->nconns; i++) {
+        struct conn *cn = &w->conns[i];
+
+        cn->w = w;
+        cn->ac = unix_path ? redisAsyncConnectUnix(unix_path) : redisAsyncConnect(host, port);
+        if (!cn->ac || cn->ac->err) {
+            fprintf(stderr, "thread %d: %s\n", w->id, cn->ac ? cn->ac->errstr : "out of memory");
+            if (cn->ac)
+                redisAsyncFree(cn->ac);
+            cn->ac = NULL;
+            return -1;
+        }
+        cn->ac->data = cn;
+        ev_attach(cn);
+        redisAsyncSetConnectCallback(cn->ac, on_connect);
+        redisAsyncSetDisconnectCallback(cn->ac, on_disconnect);
+        w->live++;
+        /* queued until the connection is up */
+        for (k = 0; k < depth; k++)
+            issue(cn);
+    }
+    return 0;
+}
+
+static void *run(void *arg) {
+    struct worker *w = arg;
+    struct epoll_event evs[256];
+    unsigned int i;
+    int n, ok;
+    double t;
+
+    w->epfd = epoll_create1(EPOLL_CLOEXEC);
+    w->conns = calloc(w->nconns, sizeof(*w->conns));
+    ok = w->epfd >= 0 && w->conns && connect_all(w) == 0;
+    pthread_barrier_wait(&start_line);
+    if (!ok) {
+        w->stopping = 1;
+        for (i = 0; i < w->nconns; i++)
+            if (w->conns && w->conns[i].ac)
+                redisAsyncDisconnect(w->conns[i].ac);
+    }
+
+    while (w->live) {
+        n = epoll_wait(w->epfd, evs, 256, 100);
+        for (i = 0; i < (unsigned int)(n > 0 ? n : 0); i++) {
+            struct conn *cn = evs[i].data.ptr;
+
+            if (cn->ac && (evs[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP)))
+                redisAsyncHandleRead(cn->ac);
+            if (cn->ac && (evs[i].events & EPOLLOUT))
+                redisAsyncHandleWrite(cn->ac);
+        }
+        t = now();
+        if (!w->stopping && t >= t_end) {
+            /* stop reissuing; disconnect lets what is in flight finish */
+            w->stopping = 1;
+            w->ops_at_end = w->ops;
+            for (i = 0; i < w->nconns; i++)
+                if (w->conns[i].ac)
+                    redisAsyncDisconnect(w->conns[i].ac);
+        } else if (w->stopping && t >= t_end + 5) {
+            /* a server that stopped answering doesn't get to hold us up */
+            for (i = 0; i < w->nconns; i++) {
+                struct conn *cn = &w->conns[i];
+
+                if (cn->ac) {
+                    redisAsyncFree(cn->ac);
+                    gone(cn);
+                }
+            }
+        }
+    }
+    if (!w->stopping)
+        w->ops_at_end = w->ops; /* every connection died early */
+    if (w->epfd >= 0)
+        close(w->epfd);
+    free(w->conns);
+    return NULL;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "usage: %s [-t threads] [-c conns] [-d depth] [-T secs] [-s socket] [host [port]]\n"
+            "  -t  worker threads, each with its own epoll loop (4)\n"
+            "  -c  connections per thread (32)\n"
+            "  -d  commands in flight per connection (16)\n"
+            "  -T  seconds to run (10)\n"
+            "  -s  connect to this unix socket instead of host:port\n", prog);
+}
+
+int main(int argc, char **argv) {
+    struct worker *workers;
+    unsigned long total = 0, errors = 0;
+    unsigned int i;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "t:c:d:T:s:h")) != -1) {
+        switch (opt) {
+        case 't': nthreads = strtoul(optarg, NULL, 0); break;
+        case 'c': conns_per_thread = strtoul(optarg, NULL, 0); break;
+        case 'd': depth = strtoul(optarg, NULL, 0); break;
+        case 'T': duration = atof(optarg); break;
+        case 's': unix_path = optarg; break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (argc > optind)
+        host = argv[optind];
+    if (argc > optind + 1)
+        port = atoi(argv[optind + 1]);
+    if (!nthreads || !conns_per_thread || !depth || duration <= 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    workers = calloc(nthreads, sizeof(*workers));
+    if (!workers)
+        return 1;
+    pthread_barrier_init(&start_line, NULL, nthreads + 1);
+    for (i = 0; i < nthreads; i++) {
+        workers[i].id = i;
+        workers[i].epfd = -1;
+        workers[i].nconns = conns_per_thread;
+        if (pthread_create(&workers[i].thread, NULL, run, &workers[i])) {
+            perror("pthread_create");
+            return 1;
+        }
+    }
+    /* every thread has its connections; the clock starts now */
+    t_start = now();
+    t_end = t_start + duration;
+    pthread_barrier_wait(&start_line);
+
+    printf("thread,conns,depth,ops,errors,seconds,ops/s\n");
+    for (i = 0; i < nthreads; i++) {
+        pthread_join(workers[i].thread, NULL);
+        printf("%u,%u,%u,%lu,%lu,%.3f,%.0f\n", i, conns_per_thread, depth,
+               workers[i].ops_at_end, workers[i].errors, duration, workers[i].ops_at_end / duration);
+        total += workers[i].ops_at_end;
+        errors += workers[i].errors;
+    }
+    printf("all,%u,%u,%lu,%lu,%.3f,%.0f\n", nthreads * conns_per_thread, depth,
+           total, errors, duration, total / duration);
+    free(workers);
+    return errors ? 2 : 0;
+}
@@ -1,78 +1,909 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <time.h>
+#include <poll.h>
 
 #include "hiredis/hiredis.h"
 
-int main(int argc, char **argv) {
-    unsigned int j;
+/*
+ * Pipelining: commands are appended to the context's output buffer and
+ * only sent, with their replies read back in bulk, once `depth` of them
+ * are waiting. A depth of 1 is the plain redisCommand() round trip.
+ * Every command keeps its number, name and reply callback, so errors are
+ * still reported one by one.
+ */
+typedef void reply_fn(redisReply *reply, void *arg);
+
+struct pending {
+    unsigned long seq;
+    char name[16];
+    reply_fn *fn;
+    void *arg;
+};
+
+struct pipeline {
     redisContext *c;
+    unsigned int depth;
+    unsigned int count;         /* appended, reply not read yet */
+    unsigned long seq;
+    unsigned long errors;
+    struct pending *slot;
+    struct arena *arena;        /* replies live here, not in malloc()ed trees */
+};
+
+/*
+ * Allocation-free replies: the reader builds redisReply objects in an
+ * arena instead of one malloc() per object (one per element of an
+ * LRANGE, say). The arena is emptied after every batch of replies and
+ * keeps its memory, so once it has grown to the largest batch nothing
+ * is allocated any more.
+ */
+struct chunk {
+    struct chunk *next;
+    size_t size, used;
+    char data[];
+};
+
+struct arena {
+    struct chunk *head, *cur;
+};
+
+static void *arena_alloc(struct arena *a, size_t n) {
+    struct chunk *ch = a->cur;
+    void *p;
+
+    n = (n + 15) & ~(size_t)15;
+    while (ch && ch->size - ch->used < n) {
+        if (!ch->next) {
+            size_t size = ch->size * 2 > n ? ch->size * 2 : n;
+            struct chunk *more = malloc(sizeof(*more) + size);
+
+            if (!more)
+                return NULL;
+            more->next = NULL;
+            more->size = size;
+            more->used = 0;
+            ch->next = more;
+        }
+        ch = ch->next;
+    }
+    if (!ch)
+        return NULL;
+    a->cur = ch;
+    p = ch->data + ch->used;
+    ch->used += n;
+    return p;
+}
+
+static struct arena *arena_new(size_t size) {
+    struct arena *a = malloc(sizeof(*a));
+
+    if (!a)
+        return NULL;
+    a->head = malloc(sizeof(*a->head) + size);
+    if (!a->head) {
+        free(a);
+        return NULL;
+    }
+    a->head->next = NULL;
+    a->head->size = size;
+    a->head->used = 0;
+    a->cur = a->head;
+    return a;
+}
+
+static void arena_reset(struct arena *a) {
+    struct chunk *ch;
+
+    for (ch = a->head; ch; ch = ch->next)
+        ch->used = 0;
+    a->cur = a->head;
+}
+
+static void arena_free(struct arena *a) {
+    struct chunk *ch, *next;
+
+    for (ch = a->head; ch; ch = next) {
+        next = ch->next;
+        free(ch);
+    }
+    free(a);
+}
+
+/* the same objects hiredis's own createXxx functions build */
+static redisReply *arena_reply(const redisReadTask *task, int type) {
+    redisReply *r = arena_alloc(task->privdata, sizeof(*r));
+
+    if (!r)
+        return NULL;
+    memset(r, 0, sizeof(*r));
+    r->type = type;
+    if (task->parent) {
+        redisReply *parent = task->parent->obj;
+
+        parent->element[task->idx] = r;
+    }
+    return r;
+}
+
+static char *arena_strdup(const redisReadTask *task, const char *str, size_t len) {
+    char *buf = arena_alloc(task->privdata, len + 1);
+
+    if (buf) {
+        memcpy(buf, str, len);
+        buf[len] = '\0';
+    }
+    return buf;
+}
+
+static void *arena_string(const redisReadTask *task, char *str, size_t len) {
+    redisReply *r = arena_reply(task, task->type);
+
+    if (!r)
+        return NULL;
+    if (task->type == REDIS_REPLY_VERB && len >= 4) {
+        memcpy(r->vtype, str, 3); /* "txt:..." */
+        str += 4;
+        len -= 4;
+    }
+    r->str = arena_strdup(task, str, len);
+    r->len = len;
+    return r->str ? r : NULL;
+}
+
+static void *arena_array(const redisReadTask *task, size_t elements) {
+    redisReply *r = arena_reply(task, task->type);
+
+    if (!r)
+        return NULL;
+    if (elements) {
+        r->element = arena_alloc(task->privdata, elements * sizeof(*r->element));
+        if (!r->element)
+            return NULL;
+    }
+    r->elements = elements;
+    return r;
+}
+
+static void *arena_integer(const redisReadTask *task, long long value) {
+    redisReply *r = arena_reply(task, REDIS_REPLY_INTEGER);
+
+    if (r)
+        r->integer = value;
+    return r;
+}
+
+static void *arena_double(const redisReadTask *task, double value, char *str, size_t len) {
+    redisReply *r = arena_reply(task, REDIS_REPLY_DOUBLE);
+
+    if (!r)
+        return NULL;
+    r->dval = value;
+    r->str = arena_strdup(task, str, len);
+    r->len = len;
+    return r->str ? r : NULL;
+}
+
+static void *arena_nil(const redisReadTask *task) {
+    return arena_reply(task, REDIS_REPLY_NIL);
+}
+
+static void *arena_bool(const redisReadTask *task, int bval) {
+    redisReply *r = arena_reply(task, REDIS_REPLY_BOOL);
+
+    if (r)
+        r->integer = bval != 0;
+    return r;
+}
+
+static void arena_object_free(void *obj) {
+    (void)obj; /* goes with the arena */
+}
+
+static redisReplyObjectFunctions arena_functions = {
+    arena_string,
+    arena_array,
+    arena_integer,
+    arena_double,
+    arena_nil,
+    arena_bool,
+    arena_object_free,
+};
+
+/* give c a reader that builds its replies in a */
+static int use_arena(redisContext *c, struct arena *a) {
+    redisReader *r = redisReaderCreateWithFunctions(&arena_functions);
+
+    if (!r)
+        return -1;
+    r->privdata = a;
+    r->maxbuf = 0; /* keep the input buffer, however large it got */
+    redisReaderFree(c->reader);
+    c->reader = r;
+    return 0;
+}
+
+static int pipeline_init(struct pipeline *p, redisContext *c, unsigned int depth) {
+    memset(p, 0, sizeof(*p));
+    p->c = c;
+    p->depth = depth ? depth : 1;
+    p->slot = calloc(p->depth, sizeof(*p->slot));
+    return p->slot ? 0 : -1;
+}
+
+static void pipeline_free(struct pipeline *p) {
+    free(p->slot);
+    p->slot = NULL;
+}
+
+/* send what is buffered and read every outstanding reply */
+static int pipeline_drain(struct pipeline *p) {
     redisReply *reply;
-    const char *hostname = (argc > 1) ? argv[1] : "127.0.0.1";
-    int port = (argc > 2) ? atoi(argv[2]) : 6379;
+    unsigned int i;
 
-    struct timeval timeout = { 1, 500000 }; // 1.5 seconds
-    c = redisConnectWithTimeout(hostname, port, timeout);
-    if (c == NULL || c->err) {
-        if (c) {
-            printf("Connection error: %s\n", c->errstr);
-            redisFree(c);
-        } else {
-            printf("Connection error: can't allocate redis context\n");
+    for (i = 0; i < p->count; i++) {
+        struct pending *q = &p->slot[i];
+
+        if (redisGetReply(p->c, (void **)&reply) != REDIS_OK) {
+            fprintf(stderr, "command %lu (%s): %s\n", q->seq, q->name, p->c->errstr);
+            p->count = 0; /* the connection is gone, and the replies with it */
+            return -1;
         }
-        exit(1);
+        if (reply->type == REDIS_REPLY_ERROR) {
+            fprintf(stderr, "command %lu (%s): %s\n", q->seq, q->name, reply->str);
+            p->errors++;
+        } else if (q->fn) {
+            q->fn(reply, q->arg);
+        }
+        if (!p->arena)
+            freeReplyObject(reply);
+    }
+    p->count = 0;
+    if (p->arena)
+        arena_reset(p->arena);
+    return 0;
+}
+
+/* note a command appended to the context, and send the batch when full */
+static int pipeline_queued(struct pipeline *p, reply_fn *fn, void *arg, const char *name) {
+    struct pending *q = &p->slot[p->count];
+    size_t n = strcspn(name, " ");
+
+    q->seq = p->seq++;
+    if (n >= sizeof(q->name))
+        n = sizeof(q->name) - 1;
+    memcpy(q->name, name, n);
+    q->name[n] = '\0';
+    q->fn = fn;
+    q->arg = arg;
+    if (++p->count == p->depth)
+        return pipeline_drain(p);
+    return 0;
+}
+
+static int pipeline_append(struct pipeline *p, reply_fn *fn, void *arg, const char *fmt, ...) {
+    va_list ap;
+    int ret;
+
+    va_start(ap, fmt);
+    ret = redisvAppendCommand(p->c, fmt, ap);
+    va_end(ap);
+    if (ret != REDIS_OK) {
+        fprintf(stderr, "command %lu: %s\n", p->seq, p->c->errstr);
+        return -1;
+    }
+    return pipeline_queued(p, fn, arg, fmt);
+}
+
+/* a command formatted beforehand, e.g. with redisFormatCommand() */
+static int pipeline_append_formatted(struct pipeline *p, reply_fn *fn, void *arg,
+                                     const char *name, const char *cmd, size_t len) {
+    if (redisAppendFormattedCommand(p->c, cmd, len) != REDIS_OK) {
+        fprintf(stderr, "command %lu: %s\n", p->seq, p->c->errstr);
+        return -1;
     }
+    return pipeline_queued(p, fn, arg, name);
+}
+
+static void print_str(redisReply *reply, void *arg) {
+    printf("%s: %s\n", (const char *)arg, reply->str);
+}
+
+static void print_int(redisReply *reply, void *arg) {
+    printf("%s: %lld\n", (const char *)arg, reply->integer);
+}
+
+static void print_list(redisReply *reply, void *arg) {
+    unsigned int j;
+
+    (void)arg;
+    if (reply->type == REDIS_REPLY_ARRAY) {
+        for (j = 0; j < reply->elements; j++) {
+            printf("%u) %s\n", j, reply->element[j]->str);
+        }
+    }
+}
+
+/* the original walk through the API, now through the pipeline */
+static int demo(struct pipeline *p) {
+    unsigned int j;
 
     /* PING server */
-    reply = redisCommand(c,"PING");
-    printf("PING: %s\n", reply->str);
-    freeReplyObject(reply);
+    pipeline_append(p, print_str, "PING", "PING");
 
     /* Set a key */
-    reply = redisCommand(c,"SET %s %s", "foo", "hello world");
-    printf("SET: %s\n", reply->str);
-    freeReplyObject(reply);
+    pipeline_append(p, print_str, "SET", "SET %s %s", "foo", "hello world");
 
     /* Set a key using binary safe API */
-    reply = redisCommand(c,"SET %b %b", "bar", (size_t) 3, "hello", (size_t) 5);
-    printf("SET (binary API): %s\n", reply->str);
-    freeReplyObject(reply);
+    pipeline_append(p, print_str, "SET (binary API)", "SET %b %b", "bar", (size_t) 3, "hello", (size_t) 5);
 
     /* Try a GET and two INCR */
-    reply = redisCommand(c,"GET foo");
-    printf("GET foo: %s\n", reply->str);
-    freeReplyObject(reply);
-
-    reply = redisCommand(c,"INCR counter");
-    printf("INCR counter: %lld\n", reply->integer);
-    freeReplyObject(reply);
+    pipeline_append(p, print_str, "GET foo", "GET foo");
+    pipeline_append(p, print_int, "INCR counter", "INCR counter");
     /* again ... */
-    reply = redisCommand(c,"INCR counter");
-    printf("INCR counter: %lld\n", reply->integer);
-    freeReplyObject(reply);
+    pipeline_append(p, print_int, "INCR counter", "INCR counter");
 
     /* Create a list of numbers, from 0 to 9 */
-    reply = redisCommand(c,"DEL mylist");
-    freeReplyObject(reply);
+    pipeline_append(p, NULL, NULL, "DEL mylist");
     for (j = 0; j < 10; j++) {
         char buf[64];
 
         snprintf(buf,64,"%u",j);
-        reply = redisCommand(c,"LPUSH mylist element-%s", buf);
-        freeReplyObject(reply);
+        pipeline_append(p, NULL, NULL, "LPUSH mylist element-%s", buf);
     }
 
     /* Let's check what we have inside the list */
-    reply = redisCommand(c,"LRANGE mylist 0 -1");
-    if (reply->type == REDIS_REPLY_ARRAY) {
-        for (j = 0; j < reply->elements; j++) {
-            printf("%u) %s\n", j, reply->element[j]->str);
+    pipeline_append(p, print_list, NULL, "LRANGE mylist 0 -1");
+    return pipeline_drain(p);
+}
+
+static double now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double cpu_now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* hiredis's allocations, counted through hiredisSetAllocators() */
+static unsigned long n_allocs;
+
+static void *count_malloc(size_t size) {
+    n_allocs++;
+    return malloc(size);
+}
+
+static void *count_calloc(size_t n, size_t size) {
+    n_allocs++;
+    return calloc(n, size);
+}
+
+static void *count_realloc(void *ptr, size_t size) {
+    n_allocs++;
+    return realloc(ptr, size);
+}
+
+static char *count_strdup(const char *str) {
+    n_allocs++;
+    return strdup(str);
+}
+
+/*
+ * The bench mix: SET, GET, INCR, LPUSH and a 10 element LRANGE over
+ * NKEYS keys. For the arena mode every command is formatted once, here.
+ */
+#define NKEYS 1000
+
+struct formatted {
+    char *cmd;
+    int len;
+};
+
+static struct formatted set_cmd[NKEYS], get_cmd[NKEYS], lpush_cmd[NKEYS], incr_cmd, lrange_cmd;
+
+static int format_mix(void) {
+    char key[32];
+    int k;
+
+    for (k = 0; k < NKEYS; k++) {
+        snprintf(key, sizeof(key), "bench:%d", k);
+        set_cmd[k].len = redisFormatCommand(&set_cmd[k].cmd, "SET %s %s", key, "hello world");
+        get_cmd[k].len = redisFormatCommand(&get_cmd[k].cmd, "GET %s", key);
+        lpush_cmd[k].len = redisFormatCommand(&lpush_cmd[k].cmd, "LPUSH bench:list %s", key);
+        if (set_cmd[k].len < 0 || get_cmd[k].len < 0 || lpush_cmd[k].len < 0)
+            return -1;
+    }
+    incr_cmd.len = redisFormatCommand(&incr_cmd.cmd, "INCR bench:counter");
+    lrange_cmd.len = redisFormatCommand(&lrange_cmd.cmd, "LRANGE bench:list 0 9");
+    return incr_cmd.len < 0 || lrange_cmd.len < 0 ? -1 : 0;
+}
+
+static void free_mix(void) {
+    int k;
+
+    for (k = 0; k < NKEYS; k++) {
+        redisFreeCommand(set_cmd[k].cmd);
+        redisFreeCommand(get_cmd[k].cmd);
+        redisFreeCommand(lpush_cmd[k].cmd);
+    }
+    redisFreeCommand(incr_cmd.cmd);
+    redisFreeCommand(lrange_cmd.cmd);
+}
+
+static void append_plain(struct pipeline *p, unsigned long i) {
+    char key[32];
+
+    snprintf(key, sizeof(key), "bench:%lu", i % NKEYS);
+    switch (i % 5) {
+    case 0: pipeline_append(p, NULL, NULL, "SET %s %s", key, "hello world"); break;
+    case 1: pipeline_append(p, NULL, NULL, "GET %s", key); break;
+    case 2: pipeline_append(p, NULL, NULL, "INCR bench:counter"); break;
+    case 3: pipeline_append(p, NULL, NULL, "LPUSH bench:list %s", key); break;
+    case 4: pipeline_append(p, NULL, NULL, "LRANGE bench:list 0 9"); break;
+    }
+}
+
+static void append_formatted(struct pipeline *p, unsigned long i) {
+    unsigned long k = i % NKEYS;
+    struct formatted *f;
+    const char *name;
+
+    switch (i % 5) {
+    case 0: f = &set_cmd[k]; name = "SET"; break;
+    case 1: f = &get_cmd[k]; name = "GET"; break;
+    case 2: f = &incr_cmd; name = "INCR"; break;
+    case 3: f = &lpush_cmd[k]; name = "LPUSH"; break;
+    default: f = &lrange_cmd; name = "LRANGE"; break;
+    }
+    pipeline_append_formatted(p, NULL, NULL, name, f->cmd, f->len);
+}
+
+/*
+ * ops commands of the mix, `depth` to a round trip. With an arena the
+ * commands come preformatted and the replies are built in the arena.
+ */
+static int bench(redisContext *c, unsigned int depth, unsigned long ops, struct arena *a) {
+    struct pipeline p;
+    unsigned long i, allocs;
+    double t0, t, cpu;
+
+    if (pipeline_init(&p, c, depth))
+        return -1;
+    p.arena = a;
+    allocs = n_allocs;
+    cpu = cpu_now();
+    t0 = now();
+    for (i = 0; i < ops && !c->err; i++) {
+        if (a)
+            append_formatted(&p, i);
+        else
+            append_plain(&p, i);
+    }
+    if (pipeline_drain(&p) || c->err) {
+        pipeline_free(&p);
+        return -1;
+    }
+    t = now() - t0;
+    cpu = cpu_now() - cpu;
+    allocs = n_allocs - allocs;
+    printf("%u,%s,%lu,%lu,%.3f,%.0f,%.3f,%.3f\n", p.depth, a ? "arena" : "plain", ops, p.errors,
+           t, ops / t, (double)allocs / ops, cpu * 1e6 / ops);
+    pipeline_append(&p, NULL, NULL, "DEL bench:list");
+    pipeline_drain(&p);
+    pipeline_free(&p);
+    return 0;
+}
+
+/*
+ * Client side caching. The connection is switched to RESP3 with CLIENT
+ * TRACKING on, so the server remembers the keys it has handed us and
+ * pushes an "invalidate" message when one of them changes. GETs are
+ * answered from a bounded LRU of key -> value until such a message
+ * says otherwise. Pushes are only seen when something reads the
+ * socket, so before a hit is served the socket is polled, without
+ * waiting, and whatever invalidations are pending are applied first.
+ * Replies and pushes come down the same connection in order, so a
+ * value is never cached after the invalidation that would drop it.
+ */
+struct centry {
+    struct centry *hnext;           /* hash chain */
+    struct centry *prev, *next;     /* LRU, most recent first */
+    char *key, *val;                /* val NULL: the key doesn't exist */
+    size_t klen, vlen;
+};
+
+struct cache {
+    redisContext *c;
+    struct centry **table;
+    unsigned int nbuckets;
+    unsigned int count, capacity;
+    struct centry lru;              /* list head */
+    unsigned long hits, misses, invalidations, evictions;
+};
+
+static unsigned int cache_hash(const char *key, size_t len) {
+    unsigned int h = 2166136261u;   /* FNV-1a */
+
+    while (len--)
+        h = (h ^ (unsigned char)*key++) * 16777619u;
+    return h;
+}
+
+static struct centry **cache_slot(struct cache *k, const char *key, size_t len) {
+    struct centry **pe = &k->table[cache_hash(key, len) & (k->nbuckets - 1)];
+
+    while (*pe && ((*pe)->klen != len || memcmp((*pe)->key, key, len)))
+        pe = &(*pe)->hnext;
+    return pe;
+}
+
+static void lru_unlink(struct centry *e) {
+    e->prev->next = e->next;
+    e->next->prev = e->prev;
+}
+
+static void lru_push(struct cache *k, struct centry *e) {
+    e->next = k->lru.next;
+    e->prev = &k->lru;
+    k->lru.next->prev = e;
+    k->lru.next = e;
+}
+
+static void cache_drop(struct cache *k, const char *key, size_t len) {
+    struct centry **pe = cache_slot(k, key, len), *e = *pe;
+
+    if (!e)
+        return;
+    *pe = e->hnext;
+    lru_unlink(e);
+    free(e);
+    k->count--;
+}
+
+static void cache_clear(struct cache *k) {
+    while (k->lru.next != &k->lru)
+        cache_drop(k, k->lru.next->key, k->lru.next->klen);
+}
+
+/* val NULL caches a missing key; the entry is one allocation */
+static struct centry *cache_put(struct cache *k, const char *key, size_t klen,
+                                const char *val, size_t vlen) {
+    struct centry *e, **slot;
+
+    cache_drop(k, key, klen);
+    if (k->count == k->capacity) {
+        cache_drop(k, k->lru.prev->key, k->lru.prev->klen);
+        k->evictions++;
+    }
+    e = malloc(sizeof(*e) + klen + vlen + 2);
+    if (!e)
+        return NULL;
+    e->key = (char *)(e + 1);
+    memcpy(e->key, key, klen);
+    e->key[klen] = '\0';
+    e->klen = klen;
+    e->val = NULL;
+    e->vlen = 0;
+    if (val) {
+        e->val = e->key + klen + 1;
+        memcpy(e->val, val, vlen);
+        e->val[vlen] = '\0';
+        e->vlen = vlen;
+    }
+    slot = &k->table[cache_hash(key, klen) & (k->nbuckets - 1)];
+    e->hnext = *slot;
+    *slot = e;
+    lru_push(k, e);
+    k->count++;
+    return e;
+}
+
+/* ["invalidate", [key, ...]], or ["invalidate", nil] when everything goes */
+static void on_push(void *privdata, void *r) {
+    struct cache *k = privdata;
+    redisReply *reply = r, *keys;
+    size_t i;
+
+    if (reply->type == REDIS_REPLY_PUSH && reply->elements == 2 &&
+        reply->element[0]->type == REDIS_REPLY_STRING && !strcmp(reply->element[0]->str, "invalidate")) {
+        keys = reply->element[1];
+        if (keys->type == REDIS_REPLY_ARRAY) {
+            for (i = 0; i < keys->elements; i++)
+                cache_drop(k, keys->element[i]->str, keys->element[i]->len);
+        } else {
+            cache_clear(k);
         }
+        k->invalidations++;
     }
     freeReplyObject(reply);
+}
+
+static struct cache *cache_new(redisContext *c, unsigned int capacity) {
+    struct cache *k;
+    redisReply *reply;
+
+    k = calloc(1, sizeof(*k));
+    if (!k)
+        return NULL;
+    for (k->nbuckets = 16; k->nbuckets < capacity; k->nbuckets *= 2)
+        ;
+    k->table = calloc(k->nbuckets, sizeof(*k->table));
+    if (!k->table) {
+        free(k);
+        return NULL;
+    }
+    k->c = c;
+    k->capacity = capacity;
+    k->lru.next = k->lru.prev = &k->lru;
+    c->privdata = k;
+    redisSetPushCallback(c, on_push);
+
+    reply = redisCommand(c, "HELLO 3");
+    if (reply && reply->type != REDIS_REPLY_ERROR) {
+        freeReplyObject(reply);
+        reply = redisCommand(c, "CLIENT TRACKING on");
+    }
+    if (!reply || reply->type == REDIS_REPLY_ERROR) {
+        printf("Client side caching: %s\n", reply ? reply->str : c->errstr);
+        if (reply)
+            freeReplyObject(reply);
+        redisSetPushCallback(c, NULL);
+        c->privdata = NULL;
+        free(k->table);
+        free(k);
+        return NULL;
+    }
+    freeReplyObject(reply);
+    return k;
+}
+
+static void cache_free(struct cache *k) {
+    cache_clear(k);
+    redisSetPushCallback(k->c, NULL);
+    k->c->privdata = NULL;
+    free(k->table);
+    free(k);
+}
+
+/* applies the invalidations that have arrived; between commands nothing else can */
+static int cache_sync(struct cache *k) {
+    struct pollfd pfd = { k->c->fd, POLLIN, 0 };
+    void *reply;
+
+    while (poll(&pfd, 1, 0) == 1) {
+        if (redisBufferRead(k->c) != REDIS_OK)
+            return -1;
+        for (;;) {
+            if (redisGetReplyFromReader(k->c, &reply) != REDIS_OK)
+                return -1;
+            if (!reply)
+                break;
+            on_push(k, reply);
+        }
+    }
+    return 0;
+}
+
+/*
+ * GET through the cache: 1 with *val pointing at the value (valid until
+ * the next cache call), 0 when the key doesn't exist, -1 on error.
+ */
+static int cache_get(struct cache *k, const char *key, const char **val, size_t *vlen) {
+    size_t klen = strlen(key);
+    struct centry *e;
+    redisReply *reply;
+
+    if (cache_sync(k)) {
+        cache_clear(k); /* can't know what we missed */
+        return -1;
+    }
+    e = *cache_slot(k, key, klen);
+    if (e) {
+        k->hits++;
+        lru_unlink(e);
+        lru_push(k, e);
+    } else {
+        k->misses++;
+        reply = redisCommand(k->c, "GET %b", key, klen);
+        if (!reply) {
+            cache_clear(k);
+            return -1;
+        }
+        if (reply->type == REDIS_REPLY_STRING || reply->type == REDIS_REPLY_NIL)
+            e = cache_put(k, key, klen, reply->type == REDIS_REPLY_STRING ? reply->str : NULL, reply->len);
+        freeReplyObject(reply);
+        if (!e)
+            return -1;
+    }
+    *val = e->val;
+    *vlen = e->vlen;
+    return e->val != NULL;
+}
+
+/*
+ * The cache bench: GETs where nine in ten go to CACHE_HOT keys and the
+ * rest are spread over CACHE_KEYS, while a second connection rewrites
+ * a hot key every CACHE_WRITE_EVERY reads. The same sequence is run
+ * with every GET going to the server and then through the cache.
+ */
+#define CACHE_KEYS 10000
+#define CACHE_HOT 16
+#define CACHE_WRITE_EVERY 100
+
+static int cmp_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+static int cache_run(redisContext *c, redisContext *writer, struct cache *k,
+                     unsigned long ops, double *lat) {
+    unsigned int seed = 1;
+    unsigned long i, errors = 0;
+    const char *val;
+    size_t vlen;
+    redisReply *reply;
+    char key[32];
+    double t, sum = 0;
+
+    for (i = 0; i < ops; i++) {
+        int r = rand_r(&seed);
+
+        if (i % CACHE_WRITE_EVERY == CACHE_WRITE_EVERY - 1) {
+            reply = redisCommand(writer, "SET cache:%d v%lu", r % CACHE_HOT, i);
+            if (!reply)
+                return -1;
+            freeReplyObject(reply);
+            r = rand_r(&seed);
+        }
+        snprintf(key, sizeof(key), "cache:%d",
+                 r % 10 ? r / 10 % CACHE_HOT : CACHE_HOT + r / 10 % (CACHE_KEYS - CACHE_HOT));
+        t = now();
+        if (k) {
+            if (cache_get(k, key, &val, &vlen) < 0)
+                errors++;
+        } else {
+            reply = redisCommand(c, "GET %s", key);
+            if (!reply)
+                return -1;
+            freeReplyObject(reply);
+        }
+        lat[i] = now() - t;
+        sum += lat[i];
+    }
+    qsort(lat, ops, sizeof(*lat), cmp_double);
+    printf("%s,%lu,%lu,%.1f,%lu,%lu,%.1f,%.1f,%.1f\n", k ? "cached" : "uncached", ops, errors,
+           k ? 100.0 * k->hits / ops : 0.0, k ? k->invalidations : 0, k ? k->evictions : 0,
+           lat[ops / 2] * 1e6, lat[ops - ops / 100 - 1] * 1e6, sum / ops * 1e6);
+    return errors ? -1 : 0;
+}
+
+static int cache_bench(redisContext *c, const char *hostname, int port, unsigned long ops,
+                       unsigned int capacity) {
+    struct timeval timeout = { 1, 500000 };
+    redisContext *writer;
+    struct cache *k;
+    double *lat;
+    int i, ret = -1;
+
+    writer = redisConnectWithTimeout(hostname, port, timeout);
+    lat = malloc(ops * sizeof(*lat));
+    if (!writer || writer->err || !lat) {
+        printf("Connection error: %s\n", writer ? writer->errstr : "out of memory");
+        goto out;
+    }
+    for (i = 0; i < CACHE_KEYS; i++)
+        redisAppendCommand(writer, "SET cache:%d %s", i, "hello world");
+    for (i = 0; i < CACHE_KEYS; i++) {
+        void *reply;
+
+        if (redisGetReply(writer, &reply) != REDIS_OK)
+            goto out;
+        freeReplyObject(reply);
+    }
+
+    printf("mode,ops,errors,hit%%,invalidations,evictions,p50_us,p99_us,mean_us\n");
+    if (cache_run(c, writer, NULL, ops, lat))
+        goto out;
+    k = cache_new(c, capacity);
+    if (!k)
+        goto out;
+    ret = cache_run(c, writer, k, ops, lat);
+    cache_free(k);
+out:
+    free(lat);
+    if (writer)
+        redisFree(writer);
+    return ret;
+}
+
+int main(int argc, char **argv) {
+    hiredisAllocFuncs counting = {
+        count_malloc, count_calloc, count_realloc, count_strdup, free
+    };
+    redisContext *c;
+    struct pipeline p;
+    struct arena *arena = NULL;
+    unsigned int depth = 1;
+    unsigned long ops = 0;
+    unsigned int cache_entries = 0;
+    int opt, ret = 0, zero_alloc = 0;
+
+    while ((opt = getopt(argc, argv, "d:b:zC:h")) != -1) {
+        switch (opt) {
+        case 'd': depth = strtoul(optarg, NULL, 0); break;
+        case 'b': ops = strtoul(optarg, NULL, 0); break;
+        case 'z': zero_alloc = 1; break;
+        case 'C': cache_entries = strtoul(optarg, NULL, 0); break;
+        default:
+            fprintf(stderr, "usage: %s [-d depth] [-b ops] [-z] [-C entries] [host [port]]\n"
+                    "  -d  commands per round trip (1: one at a time)\n"
+                    "  -b  benchmark ops commands at depth 1 and at -d, instead of the demo\n"
+                    "  -z  replies in a reusable arena, bench commands formatted once\n"
+                    "  -C  bench ops GETs (100000 by default) uncached, then through a client\n"
+                    "      side cache of this many entries kept current by RESP3 tracking\n", argv[0]);
+            return 1;
+        }
+    }
+    const char *hostname = (argc > optind) ? argv[optind] : "127.0.0.1";
+    int port = (argc > optind + 1) ? atoi(argv[optind + 1]) : 6379;
+
+    hiredisSetAllocators(&counting);
+    if (zero_alloc && !(arena = arena_new(64 * 1024))) {
+        printf("Out of memory\n");
+        exit(1);
+    }
+
+    struct timeval timeout = { 1, 500000 }; // 1.5 seconds
+    c = redisConnectWithTimeout(hostname, port, timeout);
+    if (c == NULL || c->err) {
+        if (c) {
+            printf("Connection error: %s\n", c->errstr);
+            redisFree(c);
+        } else {
+            printf("Connection error: can't allocate redis context\n");
+        }
+        exit(1);
+    }
+
+    if (cache_entries) {
+        ret = cache_bench(c, hostname, port, ops ? ops : 100000, cache_entries);
+    } else if (ops) {
+        printf("depth,mode,ops,errors,seconds,ops/s,allocs/op,cpu_us/op\n");
+        ret = bench(c, 1, ops, NULL);
+        if (!ret && depth > 1)
+            ret = bench(c, depth, ops, NULL);
+        if (!ret && arena) {
+            /* the same again, without allocating */
+            ret = format_mix() || use_arena(c, arena);
+            if (!ret)
+                ret = bench(c, 1, ops, arena);
+            if (!ret && depth > 1)
+                ret = bench(c, depth, ops, arena);
+            free_mix();
+        }
+    } else if (pipeline_init(&p, c, depth) == 0) {
+        if (arena && use_arena(c, arena) == 0)
+            p.arena = arena;
+        ret = demo(&p);
+        pipeline_free(&p);
+    } else {
+        ret = -1;
+    }
 
     /* Disconnects and frees the context */
     redisFree(c);
+    if (arena)
+        arena_free(arena);
 
-    return 0;
+    return ret ? 1 : 0;
 }
@@ -0,0 +1,607 @@
+/*
+ * redisbench: replays a mix of GET/SET/INCR/LPUSH/LRANGE (and, on
+ * request, GETRANGE/SETRANGE/APPEND/STRLEN) at a fixed arrival rate and reports per-command latency percentiles as JSON.
+ *
+ * The load is open loop. Every command has an intended send time on a
+ * schedule fixed before the run starts, and its latency is measured
+ * from that time, not from when it was actually written. A server (or
+ * client) that stalls therefore shows up as the whole queue of
+ * commands it held back, instead of as one slow reply followed by
+ * a conveniently paused load generator ("coordinated omission").
+ *
+ * One nonblocking hiredis context is driven by hand: commands are
+ * appended as they come due, flushed with redisBufferWrite(), and
+ * replies pulled with redisBufferRead()/redisGetReplyFromReader() from
+ * a ppoll() loop. Replies come back in order, so a ring of intended
+ * send times is all the bookkeeping needed.
+ *
+ * -s talks to a unix socket, e.g. a local
+ *   redis-server --port 0 --unixsocket /tmp/redis.sock
+ * so no network is involved.
+ */
+#define _GNU_SOURCE                     /* ppoll() */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdint.h>
+#include <errno.h>
+#include <math.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "hiredis/hiredis.h"
+
+/*
+ * Log-linear latency histogram in the manner of HdrHistogram: values
+ * below SUB_COUNT are counted exactly, above that every power of two
+ * is split into SUB_COUNT linear buckets, so any recorded value is
+ * within 1/SUB_COUNT (< 0.8%) of the bucket it is reported as.
+ */
+#define SUB_BITS 7
+#define SUB_COUNT (1 << SUB_BITS)
+#define MAX_BITS 40                     /* ns: ~18 minutes */
+#define BUCKETS ((MAX_BITS - SUB_BITS + 1) * SUB_COUNT)
+
+struct hist {
+    uint64_t counts[BUCKETS];
+    uint64_t total;
+    uint64_t min, max;
+    double sum;
+};
+
+static unsigned int hist_index(uint64_t v) {
+    unsigned int shift;
+
+    if (v >= (1ULL << MAX_BITS))
+        v = (1ULL << MAX_BITS) - 1;
+    if (v < SUB_COUNT)
+        return v;
+    shift = 63 - __builtin_clzll(v) - SUB_BITS;
+    return (shift + 1) * SUB_COUNT + (unsigned int)((v >> shift) - SUB_COUNT);
+}
+
+/* the largest value that lands in bucket i */
+static uint64_t hist_value(unsigned int i) {
+    unsigned int b = i / SUB_COUNT, s = i % SUB_COUNT;
+
+    if (!b)
+        return s;
+    return ((uint64_t)(SUB_COUNT + s) << (b - 1)) + (1ULL << (b - 1)) - 1;
+}
+
+static void hist_record(struct hist *h, uint64_t v) {
+    h->counts[hist_index(v)]++;
+    if (!h->total || v < h->min)
+        h->min = v;
+    if (v > h->max)
+        h->max = v;
+    h->total++;
+    h->sum += v;
+}
+
+static uint64_t hist_percentile(const struct hist *h, double pct) {
+    uint64_t want, seen = 0;
+    unsigned int i;
+
+    if (!h->total)
+        return 0;
+    want = (uint64_t)ceil(pct / 100 * h->total);
+    if (!want)
+        want = 1;
+    for (i = 0; i < BUCKETS; i++) {
+        seen += h->counts[i];
+        if (seen >= want)
+            return hist_value(i) < h->max ? hist_value(i) : h->max;
+    }
+    return h->max;
+}
+
+/* size and key distributions */
+
+static uint64_t rng_state = 0x9e3779b97f4a7c15ULL;
+
+static uint64_t rng(void) {        /* xorshift64* */
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * 0x2545f4914f6cdd1dULL;
+}
+
+static double rng_unit(void) {      /* [0, 1) */
+    return (rng() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+enum { D_FIXED, D_UNIFORM, D_EXP };
+
+struct dist {
+    int type;
+    unsigned long a, b;             /* fixed: a; uniform: a..b; exp: mean a, cap b */
+};
+
+/* "N", "MIN-MAX" or "exp:MEAN" */
+static int parse_dist(const char *s, struct dist *d, unsigned long cap) {
+    char *end;
+
+    if (!strncmp(s, "exp:", 4)) {
+        d->type = D_EXP;
+        d->a = strtoul(s + 4, &end, 0);
+        d->b = cap;
+    } else {
+        d->a = strtoul(s, &end, 0);
+        if (*end == '-') {
+            d->type = D_UNIFORM;
+            d->b = strtoul(end + 1, &end, 0);
+        } else {
+            d->type = D_FIXED;
+            d->b = d->a;
+        }
+    }
+    if (*end || !d->a || d->b < d->a || d->b > cap)
+        return -1;
+    return 0;
+}
+
+static unsigned long dist_sample(const struct dist *d) {
+    unsigned long v;
+
+    switch (d->type) {
+    case D_UNIFORM:
+        return d->a + rng() % (d->b - d->a + 1);
+    case D_EXP:
+        v = 1 + (unsigned long)(-log(1 - rng_unit()) * d->a);
+        return v < d->b ? v : d->b;
+    default:
+        return d->a;
+    }
+}
+
+/* key popularity: uniform, or zipfian with exponent zipf_s over a precomputed CDF */
+static unsigned long nkeys = 10000;
+static double zipf_s;
+static double *zipf_cdf;
+
+static int zipf_init(void) {
+    double sum = 0;
+    unsigned long k;
+
+    zipf_cdf = malloc(nkeys * sizeof(*zipf_cdf));
+    if (!zipf_cdf)
+        return -1;
+    for (k = 0; k < nkeys; k++) {
+        sum += 1 / pow(k + 1, zipf_s);
+        zipf_cdf[k] = sum;
+    }
+    for (k = 0; k < nkeys; k++)
+        zipf_cdf[k] /= sum;
+    return 0;
+}
+
+static unsigned long pick_key(void) {
+    unsigned long lo = 0, hi = nkeys - 1, mid;
+    double u;
+
+    if (!zipf_cdf)
+        return rng() % nkeys;
+    u = rng_unit();
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if (zipf_cdf[mid] < u)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+/* the command mix */
+
+enum { C_GET, C_SET, C_INCR, C_LPUSH, C_LRANGE, C_GETRANGE, C_SETRANGE, C_APPEND, C_STRLEN, NCMDS };
+
+static const char *cmd_names[NCMDS] = {
+    "GET", "SET", "INCR", "LPUSH", "LRANGE", "GETRANGE", "SETRANGE", "APPEND", "STRLEN"
+};
+static unsigned int weights[NCMDS] = { 60, 20, 5, 10, 5 };
+static unsigned int weight_total;
+
+static struct dist key_len = { D_FIXED, 16, 16 };
+static struct dist val_len = { D_FIXED, 64, 64 };
+static unsigned int lrange_len = 10;
+static const char *prefix = "rb:";
+static char **fixed_keys;           /* -x: these names instead of generated ones */
+static unsigned long nfixed;
+static char *value_buf;
+
+#define MAX_KEY 512
+#define MAX_VALUE (1024 * 1024)
+
+/* "get=60,set=20,..." */
+static int parse_mix(char *s) {
+    char *tok, *eq;
+    unsigned int i;
+
+    memset(weights, 0, sizeof(weights));
+    for (tok = strtok(s, ","); tok; tok = strtok(NULL, ",")) {
+        eq = strchr(tok, '=');
+        if (!eq)
+            return -1;
+        *eq = '\0';
+        for (i = 0; i < NCMDS; i++)
+            if (!strcasecmp(tok, cmd_names[i]))
+                break;
+        if (i == NCMDS)
+            return -1;
+        weights[i] = strtoul(eq + 1, NULL, 0);
+    }
+    return 0;
+}
+
+/* "k1,k2,..." */
+static int parse_keys(char *s) {
+    char *tok;
+
+    for (tok = strtok(s, ","); tok; tok = strtok(NULL, ",")) {
+        char **keys = realloc(fixed_keys, (nfixed + 1) * sizeof(*keys));
+
+        if (!keys)
+            return -1;
+        fixed_keys = keys;
+        fixed_keys[nfixed++] = tok;
+    }
+    return nfixed ? 0 : -1;
+}
+
+static unsigned int pick_cmd(void) {
+    unsigned int r = rng() % weight_total, i;
+
+    for (i = 0; i < NCMDS - 1; i++) {
+        if (r < weights[i])
+            return i;
+        r -= weights[i];
+    }
+    return NCMDS - 1;
+}
+
+/*
+ * Key names are the prefix, a namespace per value type (so INCR never
+ * meets a SET's string, nor LPUSH either) and the key number, padded
+ * out to a length drawn from key_len; the draw is seeded by the key
+ * number so that a key is always spelled the same way.
+ */
+static size_t make_key(char *buf, unsigned long k, unsigned int ns) {
+    static const char *spaces[] = { "s:", "c:", "l:" };
+    uint64_t saved = rng_state;
+    size_t len, want;
+
+    if (fixed_keys) {
+        len = snprintf(buf, MAX_KEY, "%s", fixed_keys[k]);
+        return len < MAX_KEY ? len : MAX_KEY - 1;
+    }
+    len = snprintf(buf, MAX_KEY, "%s%s%lu:", prefix, spaces[ns], k);
+    if (len >= MAX_KEY)
+        len = MAX_KEY - 1;
+    rng_state = (0x9e3779b97f4a7c15ULL ^ (k * 0xbf58476d1ce4e5b9ULL) ^ ns) | 1;
+    want = dist_sample(&key_len);
+    rng_state = saved;
+    if (want >= MAX_KEY)
+        want = MAX_KEY - 1;
+    while (len < want)
+        buf[len++] = 'k';
+    buf[len] = '\0';
+    return len;
+}
+
+static int append_cmd(redisContext *c, unsigned int cmd) {
+    char key[MAX_KEY];
+    size_t klen, vlen;
+    unsigned long off;
+
+    klen = make_key(key, pick_key(), cmd == C_INCR ? 1 : cmd == C_LPUSH || cmd == C_LRANGE ? 2 : 0);
+    switch (cmd) {
+    case C_GET:
+        return redisAppendCommand(c, "GET %b", key, klen);
+    case C_SET:
+        return redisAppendCommand(c, "SET %b %b", key, klen, value_buf, (size_t)dist_sample(&val_len));
+    case C_INCR:
+        return redisAppendCommand(c, "INCR %b", key, klen);
+    case C_LPUSH:
+        return redisAppendCommand(c, "LPUSH %b %b", key, klen, value_buf, (size_t)dist_sample(&val_len));
+    case C_LRANGE:
+        return redisAppendCommand(c, "LRANGE %b 0 %u", key, klen, lrange_len - 1);
+    case C_GETRANGE:
+    case C_SETRANGE:
+        /* somewhere within the largest value a SET could have left */
+        vlen = dist_sample(&val_len);
+        off = rng() % val_len.b;
+        if (cmd == C_GETRANGE)
+            return redisAppendCommand(c, "GETRANGE %b %lu %lu", key, klen, off, off + vlen - 1);
+        return redisAppendCommand(c, "SETRANGE %b %lu %b", key, klen, off, value_buf, vlen);
+    case C_APPEND:
+        return redisAppendCommand(c, "APPEND %b %b", key, klen, value_buf, (size_t)dist_sample(&val_len));
+    default:
+        return redisAppendCommand(c, "STRLEN %b", key, klen);
+    }
+}
+
+/* the run */
+
+struct sent {
+    uint64_t intended;              /* ns */
+    unsigned int cmd;
+    int record;                     /* 0 during warmup */
+};
+
+static volatile sig_atomic_t interrupted;
+
+static void on_signal(int sig) {
+    (void)sig;
+    interrupted = 1;
+}
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* nonblocking connect, finished by hand */
+static redisContext *connect_to(const char *host, int port, const char *path) {
+    struct pollfd pfd;
+    redisContext *c;
+    socklen_t len;
+    int err = 0;
+
+    c = path ? redisConnectUnixNonBlock(path) : redisConnectNonBlock(host, port);
+    if (!c || c->err) {
+        fprintf(stderr, "connect: %s\n", c ? c->errstr : "can't allocate redis context");
+        goto fail;
+    }
+    pfd.fd = c->fd;
+    pfd.events = POLLOUT;
+    if (poll(&pfd, 1, 2000) != 1) {
+        fprintf(stderr, "connect: timed out\n");
+        goto fail;
+    }
+    len = sizeof(err);
+    if (getsockopt(c->fd, SOL_SOCKET, SO_ERROR, &err, &len) || err) {
+        fprintf(stderr, "connect: %s\n", strerror(err ? err : errno));
+        goto fail;
+    }
+    return c;
+fail:
+    if (c)
+        redisFree(c);
+    return NULL;
+}
+
+static void print_hist(const char *name, const struct hist *h, int last) {
+    static const double pcts[] = { 50, 90, 99, 99.9, 99.99, 99.999 };
+    static const char *labels[] = { "p50", "p90", "p99", "p99.9", "p99.99", "p99.999" };
+    unsigned int i;
+
+    printf("    \"%s\": {\"count\": %llu", name, (unsigned long long)h->total);
+    if (h->total) {
+        printf(", \"min\": %.1f, \"mean\": %.1f", h->min / 1e3, h->sum / h->total / 1e3);
+        for (i = 0; i < sizeof(pcts) / sizeof(pcts[0]); i++)
+            printf(", \"%s\": %.1f", labels[i], hist_percentile(h, pcts[i]) / 1e3);
+        printf(", \"max\": %.1f", h->max / 1e3);
+    }
+    printf("}%s\n", last ? "" : ",");
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "usage: %s [options] [host [port]]\n"
+            "  -s path   connect to this unix socket instead of host:port\n"
+            "  -r rate   commands per second (10000)\n"
+            "  -T secs   seconds to measure (10)\n"
+            "  -W secs   warmup before measuring, not recorded (1)\n"
+            "  -P        poisson arrivals instead of evenly spaced\n"
+            "  -m mix    command weights (get=60,set=20,incr=5,lpush=10,lrange=5);\n"
+            "            getrange, setrange, append and strlen may be added\n"
+            "  -k keys   keys per command type (10000)\n"
+            "  -z s      zipfian key popularity with exponent s (uniform)\n"
+            "  -K len    key length: N, MIN-MAX or exp:MEAN (16)\n"
+            "  -V len    SET/LPUSH value length, same forms (64)\n"
+            "  -L n      elements an LRANGE asks for (10)\n"
+            "  -p str    key prefix (rb:)\n"
+            "  -x k,k..  use exactly these keys, e.g. the devices behind scullresp\n"
+            "  -o n      most commands outstanding before sending stalls (65536)\n"
+            "  -S seed   random seed\n", prog);
+}
+
+int main(int argc, char **argv) {
+    const char *host = "127.0.0.1", *path = NULL;
+    int port = 6379, poisson = 0, opt, done, ret = 0;
+    double rate = 10000, duration = 10, warmup = 1;
+    unsigned long max_out = 65536, head = 0, tail = 0;
+    unsigned long sent = 0, received = 0, errors = 0;
+    uint64_t t0, t_measure, t_end, next, t, lag, max_lag = 0;
+    struct hist *hists;
+    struct sent *ring;
+    struct pollfd pfd;
+    redisContext *c;
+    unsigned int i;
+    void *reply;
+
+    while ((opt = getopt(argc, argv, "s:r:T:W:Pm:k:z:K:V:L:p:x:o:S:h")) != -1) {
+        switch (opt) {
+        case 's': path = optarg; break;
+        case 'r': rate = atof(optarg); break;
+        case 'T': duration = atof(optarg); break;
+        case 'W': warmup = atof(optarg); break;
+        case 'P': poisson = 1; break;
+        case 'm':
+            if (parse_mix(optarg)) {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'k': nkeys = strtoul(optarg, NULL, 0); break;
+        case 'z': zipf_s = atof(optarg); break;
+        case 'K':
+            if (parse_dist(optarg, &key_len, MAX_KEY - 1)) {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'V':
+            if (parse_dist(optarg, &val_len, MAX_VALUE)) {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'L': lrange_len = strtoul(optarg, NULL, 0); break;
+        case 'p': prefix = optarg; break;
+        case 'x':
+            if (parse_keys(optarg)) {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'o': max_out = strtoul(optarg, NULL, 0); break;
+        case 'S': rng_state = strtoull(optarg, NULL, 0) | 1; break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (argc > optind)
+        host = argv[optind];
+    if (argc > optind + 1)
+        port = atoi(argv[optind + 1]);
+    if (fixed_keys)
+        nkeys = nfixed;
+    for (weight_total = 0, i = 0; i < NCMDS; i++)
+        weight_total += weights[i];
+    if (rate <= 0 || duration <= 0 || warmup < 0 || !nkeys || !lrange_len || !max_out || !weight_total) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    hists = calloc(NCMDS + 1, sizeof(*hists));
+    ring = calloc(max_out, sizeof(*ring));
+    value_buf = malloc(MAX_VALUE);
+    if (!hists || !ring || !value_buf || (zipf_s > 0 && zipf_init())) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+    memset(value_buf, 'v', MAX_VALUE);
+
+    c = connect_to(host, port, path);
+    if (!c)
+        return 1;
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+
+    t0 = now_ns();
+    t_measure = t0 + (uint64_t)(warmup * 1e9);
+    t_end = t_measure + (uint64_t)(duration * 1e9);
+    next = t0;
+    done = 1;
+    while (!interrupted) {
+        t = now_ns();
+
+        /* everything that has come due goes out, however late */
+        while (next <= t && next < t_end && tail - head < max_out) {
+            struct sent *s = &ring[tail % max_out];
+
+            s->intended = next;
+            s->cmd = pick_cmd();
+            s->record = next >= t_measure;
+            if (append_cmd(c, s->cmd) != REDIS_OK)
+                break;
+            tail++;
+            sent++;
+            lag = t - next;
+            if (s->record && lag > max_lag)
+                max_lag = lag;
+            next += (uint64_t)((poisson ? -log(1 - rng_unit()) : 1.0) * 1e9 / rate);
+        }
+        if (redisBufferWrite(c, &done) != REDIS_OK)
+            break;
+        if (next >= t_end && head == tail)
+            break;
+
+        /* sleep until the next command is due or something can be read */
+        pfd.fd = c->fd;
+        pfd.events = POLLIN | (done ? 0 : POLLOUT);
+        pfd.revents = 0;
+        if (next < t_end && tail - head < max_out) {
+            struct timespec ts;
+
+            t = now_ns();
+            ts.tv_sec = next > t ? (next - t) / 1000000000ULL : 0;
+            ts.tv_nsec = next > t ? (next - t) % 1000000000ULL : 0;
+            if (ppoll(&pfd, 1, &ts, NULL) < 0 && errno != EINTR)
+                break;
+        } else if (poll(&pfd, 1, 1000) < 0 && errno != EINTR) {
+            break;
+        } else if (!pfd.revents && now_ns() > t_end + 10000000000ULL) {
+            fprintf(stderr, "gave up on %lu outstanding replies\n", tail - head);
+            break;
+        }
+        if (!(pfd.revents & (POLLIN | POLLERR | POLLHUP)))
+            continue;
+
+        if (redisBufferRead(c) != REDIS_OK)
+            break;
+        t = now_ns();
+        while (head != tail) {
+            struct sent *s = &ring[head % max_out];
+
+            if (redisGetReplyFromReader(c, &reply) != REDIS_OK)
+                break;
+            if (!reply)
+                break;
+            if (((redisReply *)reply)->type == REDIS_REPLY_ERROR) {
+                if (!errors++)
+                    fprintf(stderr, "%s: %s\n", cmd_names[s->cmd], ((redisReply *)reply)->str);
+            }
+            freeReplyObject(reply);
+            if (s->record) {
+                hist_record(&hists[s->cmd], t - s->intended);
+                hist_record(&hists[NCMDS], t - s->intended);
+            }
+            received++;
+            head++;
+        }
+        if (c->err)
+            break;
+    }
+    if (c->err) {
+        fprintf(stderr, "connection error: %s\n", c->errstr);
+        ret = 2;
+    }
+    if (interrupted) {
+        t = now_ns();
+        duration = t > t_measure ? (t - t_measure) / 1e9 : 0;
+    }
+
+    printf("{\n");
+    printf("  \"target_rate\": %.0f,\n", rate);
+    printf("  \"arrivals\": \"%s\",\n", poisson ? "poisson" : "fixed");
+    printf("  \"duration_s\": %.3f,\n", duration);
+    printf("  \"sent\": %lu,\n", sent);
+    printf("  \"completed\": %lu,\n", received);
+    printf("  \"errors\": %lu,\n", errors);
+    printf("  \"achieved_rate\": %.0f,\n", duration > 0 ? hists[NCMDS].total / duration : 0);
+    printf("  \"max_send_lag_us\": %.1f,\n", max_lag / 1e3);
+    printf("  \"latency_us\": {\n");
+    for (i = 0; i < NCMDS; i++)
+        if (weights[i])
+            print_hist(cmd_names[i], &hists[i], 0);
+    print_hist("all", &hists[NCMDS], 1);
+    printf("  }\n}\n");
+
+    redisFree(c);
+    free(zipf_cdf);
+    free(fixed_keys);
+    free(value_buf);
+    free(ring);
+    free(hists);
+    return ret ? ret : errors ? 3 : 0;
+}
@@ -1,5 +0,0 @@
-#ifndef HWDYNAMIC_H
-#define HWDYNAMIC_H
-char *hwdynamic1(void);
-char *hwdynamic2(void);
-#endif
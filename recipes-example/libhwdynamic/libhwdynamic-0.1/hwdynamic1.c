@@ -1,4 +0,0 @@
-char *hwdynamic1(void)
-{
-	return "hwdynamic1() of dynamic shared library libhwdynamic is called\n";
-}
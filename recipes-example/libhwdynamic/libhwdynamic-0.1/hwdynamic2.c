@@ -1,4 +0,0 @@
-char *hwdynamic2(void)
-{
-	return "hwdynamic2() of libhwdynamic is called\n";
-}
@@ -0,0 +1,108 @@
+#ifndef LIBSCULL_H
+#define LIBSCULL_H
+
+/*
+ * libscull: user space access to the scull devices, so applications
+ * don't each hand roll their own read and write loops.
+ *
+ * Nothing allocates after setup: every object gets its buffer when it
+ * is created and reuses it. Functions return -1 (or NULL) with errno
+ * set on failure, like the system calls under them.
+ */
+#include<stddef.h>
+#include<sys/types.h>
+#include<sys/uio.h>
+#include<scull/scull_ioctl.h>
+
+#define LIBSCULL_VERSION "1.0.0"
+
+/*
+ * Buffered streams, in the manner of stdio. Reads and writes at least
+ * as large as the buffer go straight to the device, and a write that
+ * overflows the buffer goes out in a single writev() together with what
+ * was buffered. A scull_char read or write stops at the end of a
+ * quantum; scull_stream_read_full() and the vectored calls below go on
+ * until everything has moved.
+ */
+struct scull_stream;
+
+struct scull_stream *scull_stream_open(const char *path, int flags, size_t bufsize);
+struct scull_stream *scull_stream_fdopen(int fd, size_t bufsize);
+ssize_t scull_stream_read(struct scull_stream *s, void *buf, size_t len);
+ssize_t scull_stream_read_full(struct scull_stream *s, void *buf, size_t len);
+ssize_t scull_stream_write(struct scull_stream *s, const void *buf, size_t len);
+int scull_stream_flush(struct scull_stream *s);
+int scull_stream_fd(const struct scull_stream *s);
+/* flushes, and closes the fd if scull_stream_open() opened it */
+int scull_stream_close(struct scull_stream *s);
+
+/*
+ * Whole vectored transfers: retry on EINTR and short counts until all
+ * of iov has moved, or read() reports end of file. iov is updated in
+ * place as it is consumed. They return the bytes moved, or -1 if
+ * nothing could be.
+ */
+ssize_t scull_readv_full(int fd, struct iovec *iov, int iovcnt);
+ssize_t scull_writev_full(int fd, struct iovec *iov, int iovcnt);
+
+/*
+ * Records from a pipe in record mode, fetched many at a time with
+ * SCULL_P_IOCRDBATCH. scull_batch_next() points data into the batch
+ * buffer, valid until the next call. On a non-blocking fd it fails
+ * with EAGAIN once the pipe is empty.
+ */
+struct scull_batch;
+
+struct scull_batch *scull_batch_new(int fd, size_t bufsize);
+int scull_batch_next(struct scull_batch *b, const void **data, size_t *len);
+void scull_batch_free(struct scull_batch *b);
+
+/*
+ * The shared ring of a pipe (see "Shared ring" in the scullp README),
+ * for one producer or one consumer that moves data without system
+ * calls. peek/consume and reserve/commit work in place on the mapping
+ * and may hand out less than is queued or free when the data wraps; the
+ * record calls copy one whole record and fail with EAGAIN when there is
+ * none, or no room for it. Call scull_ring_kick() after moving data if
+ * the other side may be asleep in read() or write().
+ */
+struct scull_ring;
+
+struct scull_ring *scull_ring_map(int fd);
+void scull_ring_unmap(struct scull_ring *r);
+int scull_ring_recmode(const struct scull_ring *r);
+size_t scull_ring_peek(struct scull_ring *r, const void **data);
+void scull_ring_consume(struct scull_ring *r, size_t n);
+size_t scull_ring_reserve(struct scull_ring *r, void **data);
+void scull_ring_commit(struct scull_ring *r, size_t n);
+ssize_t scull_ring_get_record(struct scull_ring *r, void *buf, size_t len);
+ssize_t scull_ring_put_record(struct scull_ring *r, const void *buf, size_t len);
+int scull_ring_kick(struct scull_ring *r);
+
+/*
+ * An asynchronous pipe consumer for an application's own epoll loop.
+ * scull_consumer_new() makes fd non-blocking and adds it to epfd with
+ * the consumer as data.ptr. When epoll_wait() returns that pointer,
+ * call scull_consumer_ready(). It hands everything queued to cb, one
+ * call per record in record mode and one per chunk in stream mode, and
+ * returns the bytes delivered.
+ *
+ * With SCULL_CONSUMER_MMAP the consumer maps the ring, when the pipe
+ * allows it, and waits on an eventfd instead of the fd. cb then gets
+ * pointers straight into the mapping, and only records that wrap are
+ * copied. The framing is the pipe's at creation time.
+ */
+#define SCULL_CONSUMER_MMAP	1
+
+typedef void (*scull_consumer_cb)(void *arg, const void *data, size_t len);
+
+struct scull_consumer;
+
+struct scull_consumer *scull_consumer_new(int epfd, int fd, unsigned int flags, size_t bufsize,
+					  scull_consumer_cb cb, void *arg);
+ssize_t scull_consumer_ready(struct scull_consumer *c);
+int scull_consumer_mapped(const struct scull_consumer *c);
+/* takes the consumer out of epfd; the fd stays open */
+void scull_consumer_free(struct scull_consumer *c);
+
+#endif
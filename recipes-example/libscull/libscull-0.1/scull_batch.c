@@ -0,0 +1,69 @@
+/*
+ * Record batches: one SCULL_P_IOCRDBATCH fills the buffer with as many
+ * records as fit, which are then handed out one at a time.
+ */
+#include<stdlib.h>
+#include<string.h>
+#include<errno.h>
+#include<sys/ioctl.h>
+#include "scull_internal.h"
+
+struct scull_batch {
+	int fd;
+	char *buf;
+	size_t size;
+	size_t off, used;
+};
+
+struct scull_batch *scull_batch_new(int fd, size_t bufsize)
+{
+	struct scull_batch *b;
+
+	if(bufsize < SCULL_P_REC_SIZE(0) || bufsize > 0xffffffffUL){
+		errno = EINVAL;
+		return NULL;
+	}
+	b = calloc(1, sizeof(*b));
+	if(!b)
+		return NULL;
+	b->buf = malloc(bufsize);
+	if(!b->buf){
+		free(b);
+		return NULL;
+	}
+	b->fd = fd;
+	b->size = bufsize;
+	return b;
+}
+
+int scull_batch_next(struct scull_batch *b, const void **data, size_t *len)
+{
+	struct scull_p_batch req;
+	__u32 rlen;
+
+	if(b->off >= b->used){
+		memset(&req, 0, sizeof(req));
+		req.buf = (__u64)(unsigned long)b->buf;
+		req.len = b->size;
+		while(ioctl(b->fd, SCULL_P_IOCRDBATCH, &req) < 0)
+			if(errno != EINTR)
+				return -1;
+		b->off = 0;
+		b->used = req.bytes;
+		if(!req.nrecs){
+			errno = EAGAIN;
+			return -1;
+		}
+	}
+	memcpy(&rlen, b->buf + b->off, sizeof(rlen));
+	*data = b->buf + b->off + SCULL_P_RECHDR;
+	*len = rlen;
+	b->off += SCULL_P_REC_SIZE(rlen);
+	return 0;
+}
+
+void scull_batch_free(struct scull_batch *b)
+{
+	free(b->buf);
+	free(b);
+}
@@ -0,0 +1,189 @@
+/*
+ * Asynchronous pipe consumer for an epoll loop: from the mapping, woken
+ * by an eventfd, when allowed and possible; otherwise non-blocking
+ * read() or SCULL_P_IOCRDBATCH into a buffer kept for the purpose.
+ */
+#include<stdlib.h>
+#include<string.h>
+#include<errno.h>
+#include<fcntl.h>
+#include<unistd.h>
+#include<sys/ioctl.h>
+#include<sys/epoll.h>
+#include<sys/eventfd.h>
+#include "scull_internal.h"
+
+struct scull_consumer {
+	int epfd;
+	int fd;
+	int evfd;		/* -1 unless mapped */
+	int recmode;
+	struct scull_ring *ring;
+	struct scull_batch *batch;
+	char *buf;		/* read() buffer, or room for a wrapped record */
+	size_t size;
+	scull_consumer_cb cb;
+	void *arg;
+};
+
+static int consumer_map(struct scull_consumer *c)
+{
+	c->ring = scull_ring_map(c->fd);
+	if(!c->ring)
+		return -1;
+	c->evfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if(c->evfd < 0 || ioctl(c->fd, SCULL_P_IOCTEVENTFD, c->evfd) < 0){
+		if(c->evfd >= 0)
+			close(c->evfd);
+		c->evfd = -1;
+		scull_ring_unmap(c->ring);
+		c->ring = NULL;
+		return -1;
+	}
+	return 0;
+}
+
+struct scull_consumer *scull_consumer_new(int epfd, int fd, unsigned int flags, size_t bufsize,
+					  scull_consumer_cb cb, void *arg)
+{
+	struct scull_consumer *c;
+	struct epoll_event ev;
+	int fl, err;
+	__u32 tail;
+
+	if(bufsize == 0 || !cb){
+		errno = EINVAL;
+		return NULL;
+	}
+	c = calloc(1, sizeof(*c));
+	if(!c)
+		return NULL;
+	c->epfd = epfd;
+	c->fd = fd;
+	c->evfd = -1;
+	c->size = bufsize;
+	c->cb = cb;
+	c->arg = arg;
+	c->recmode = ioctl(fd, SCULL_P_IOCQRECMODE);
+	fl = fcntl(fd, F_GETFL);
+	if(c->recmode < 0 || fl < 0 || fcntl(fd, F_SETFL, fl | O_NONBLOCK) < 0)
+		goto fail;
+
+	/* a pipe that can't be mapped (broadcast, say) is read instead */
+	if(flags & SCULL_CONSUMER_MMAP)
+		consumer_map(c);
+	if(!c->ring && c->recmode == SCULL_P_RECORD){
+		c->batch = scull_batch_new(fd, bufsize);
+		if(!c->batch)
+			goto fail;
+	} else {
+		c->buf = malloc(bufsize);
+		if(!c->buf)
+			goto fail;
+	}
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.ptr = c;
+	if(epoll_ctl(epfd, EPOLL_CTL_ADD, c->ring ? c->evfd : fd, &ev) < 0)
+		goto fail;
+	/* the eventfd only hears of data written from now on */
+	if(c->ring && scull_ring_avail(c->ring, &tail))
+		eventfd_write(c->evfd, 1);
+	return c;
+
+  fail:
+	err = errno;
+	scull_consumer_free(c);
+	errno = err;
+	return NULL;
+}
+
+int scull_consumer_mapped(const struct scull_consumer *c)
+{
+	return c->ring != NULL;
+}
+
+static size_t drain_ring(struct scull_consumer *c)
+{
+	struct scull_ring *r = c->ring;
+	const void *data;
+	size_t total = 0, n;
+	__u32 tail, avail, rlen;
+
+	if(c->recmode != SCULL_P_RECORD){
+		while((n = scull_ring_peek(r, &data))){
+			c->cb(c->arg, data, n);
+			scull_ring_consume(r, n);
+			total += n;
+		}
+		return total;
+	}
+	while((avail = scull_ring_avail(r, &tail)) >= SCULL_P_RECHDR){
+		__u32 off;
+
+		scull_ring_copy_out(r, tail, &rlen, SCULL_P_RECHDR);
+		if(avail < SCULL_P_RECHDR + rlen)
+			break;
+		off = (tail + SCULL_P_RECHDR) & (r->size - 1);
+		if(off + rlen <= r->size){
+			c->cb(c->arg, r->data + off, rlen); /* in place */
+		} else {
+			n = rlen < c->size ? rlen : c->size;
+			scull_ring_copy_out(r, tail + SCULL_P_RECHDR, c->buf, n);
+			c->cb(c->arg, c->buf, n);
+		}
+		scull_ring_consume(r, SCULL_P_RECHDR + rlen);
+		total += rlen;
+	}
+	return total;
+}
+
+ssize_t scull_consumer_ready(struct scull_consumer *c)
+{
+	size_t total = 0, len;
+	const void *data;
+	eventfd_t cnt;
+	ssize_t n;
+
+	if(c->ring){
+		eventfd_read(c->evfd, &cnt); /* EAGAIN is fine */
+		total = drain_ring(c);
+		/* read() and write() don't see the mapping move: wake writers */
+		if(total)
+			scull_ring_kick(c->ring);
+		return total;
+	}
+	if(c->batch){
+		while(scull_batch_next(c->batch, &data, &len) == 0){
+			c->cb(c->arg, data, len);
+			total += len;
+		}
+	} else {
+		while((n = read(c->fd, c->buf, c->size)) > 0){
+			c->cb(c->arg, c->buf, n);
+			total += n;
+		}
+		if(n == 0)
+			return total;
+	}
+	if(errno == EAGAIN || (errno == EINTR && total))
+		return total;
+	return total ? (ssize_t)total : -1;
+}
+
+void scull_consumer_free(struct scull_consumer *c)
+{
+	if(c->ring){
+		epoll_ctl(c->epfd, EPOLL_CTL_DEL, c->evfd, NULL);
+		ioctl(c->fd, SCULL_P_IOCTEVENTFD, -1);
+		close(c->evfd);
+		scull_ring_unmap(c->ring);
+	} else {
+		epoll_ctl(c->epfd, EPOLL_CTL_DEL, c->fd, NULL);
+	}
+	if(c->batch)
+		scull_batch_free(c->batch);
+	free(c->buf);
+	free(c);
+}
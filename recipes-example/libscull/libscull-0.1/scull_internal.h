@@ -0,0 +1,24 @@
+#ifndef SCULL_INTERNAL_H
+#define SCULL_INTERNAL_H
+
+/* shared between the parts of libscull, not installed */
+#include "libscull.h"
+
+struct scull_ring {
+	int fd;
+	struct scull_p_ring_ctrl *ctrl;
+	char *data;
+	size_t maplen;
+	__u32 size;
+};
+
+/* bytes queued and the offset of tail, for a consumer */
+static inline __u32 scull_ring_avail(const struct scull_ring *r, __u32 *tail)
+{
+	*tail = r->ctrl->tail; /* ours, no ordering needed */
+	return __atomic_load_n(&r->ctrl->head, __ATOMIC_ACQUIRE) - *tail;
+}
+
+void scull_ring_copy_out(const struct scull_ring *r, __u32 pos, void *to, size_t n);
+
+#endif
@@ -0,0 +1,149 @@
+/*
+ * The shared ring of a pipe. The ring has one producer and one
+ * consumer; each side stores only its own index, with release ordering
+ * after touching the data, and loads the other's with acquire ordering.
+ */
+#include<string.h>
+#include<stdlib.h>
+#include<errno.h>
+#include<unistd.h>
+#include<sys/ioctl.h>
+#include<sys/mman.h>
+#include "scull_internal.h"
+
+struct scull_ring *scull_ring_map(int fd)
+{
+	size_t page = sysconf(_SC_PAGESIZE), maplen;
+	struct scull_p_ring_ctrl *ctrl;
+	struct scull_ring *r;
+	void *map;
+
+	/* the control page says how much there is to map */
+	map = mmap(NULL, page, PROT_READ, MAP_SHARED, fd, 0);
+	if(map == MAP_FAILED)
+		return NULL;
+	ctrl = map;
+	maplen = (size_t)ctrl->data_offset + ctrl->size;
+	munmap(map, page);
+
+	r = calloc(1, sizeof(*r));
+	if(!r)
+		return NULL;
+	map = mmap(NULL, maplen, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if(map == MAP_FAILED){
+		free(r);
+		return NULL;
+	}
+	r->fd = fd;
+	r->ctrl = map;
+	r->data = (char *)map + r->ctrl->data_offset;
+	r->size = r->ctrl->size;
+	r->maplen = maplen;
+	return r;
+}
+
+void scull_ring_unmap(struct scull_ring *r)
+{
+	munmap(r->ctrl, r->maplen);
+	free(r);
+}
+
+int scull_ring_recmode(const struct scull_ring *r)
+{
+	return __atomic_load_n(&r->ctrl->recmode, __ATOMIC_RELAXED);
+}
+
+int scull_ring_kick(struct scull_ring *r)
+{
+	return ioctl(r->fd, SCULL_P_IOCKICK);
+}
+
+void scull_ring_copy_out(const struct scull_ring *r, __u32 pos, void *to, size_t n)
+{
+	__u32 off = pos & (r->size - 1);
+	size_t first = r->size - off;
+
+	if(first > n)
+		first = n;
+	memcpy(to, r->data + off, first);
+	memcpy((char *)to + first, r->data, n - first);
+}
+
+static void copy_in(struct scull_ring *r, __u32 pos, const void *from, size_t n)
+{
+	__u32 off = pos & (r->size - 1);
+	size_t first = r->size - off;
+
+	if(first > n)
+		first = n;
+	memcpy(r->data + off, from, first);
+	memcpy(r->data, (const char *)from + first, n - first);
+}
+
+size_t scull_ring_peek(struct scull_ring *r, const void **data)
+{
+	__u32 tail, avail = scull_ring_avail(r, &tail);
+	__u32 off = tail & (r->size - 1);
+
+	*data = r->data + off;
+	return avail < r->size - off ? avail : r->size - off;
+}
+
+void scull_ring_consume(struct scull_ring *r, size_t n)
+{
+	__atomic_store_n(&r->ctrl->tail, r->ctrl->tail + (__u32)n, __ATOMIC_RELEASE);
+}
+
+size_t scull_ring_reserve(struct scull_ring *r, void **data)
+{
+	__u32 head = r->ctrl->head;
+	__u32 room = r->size - (head - __atomic_load_n(&r->ctrl->tail, __ATOMIC_ACQUIRE));
+	__u32 off = head & (r->size - 1);
+
+	*data = r->data + off;
+	return room < r->size - off ? room : r->size - off;
+}
+
+void scull_ring_commit(struct scull_ring *r, size_t n)
+{
+	__atomic_store_n(&r->ctrl->head, r->ctrl->head + (__u32)n, __ATOMIC_RELEASE);
+}
+
+ssize_t scull_ring_get_record(struct scull_ring *r, void *buf, size_t len)
+{
+	__u32 tail, avail = scull_ring_avail(r, &tail), rlen;
+
+	if(avail < SCULL_P_RECHDR){
+		errno = EAGAIN;
+		return -1;
+	}
+	scull_ring_copy_out(r, tail, &rlen, SCULL_P_RECHDR);
+	if(avail < SCULL_P_RECHDR + rlen){
+		errno = EAGAIN; /* can't happen with a sane producer */
+		return -1;
+	}
+	if(len > rlen)
+		len = rlen;
+	scull_ring_copy_out(r, tail + SCULL_P_RECHDR, buf, len);
+	scull_ring_consume(r, SCULL_P_RECHDR + rlen); /* the rest is dropped, like read() */
+	return len;
+}
+
+ssize_t scull_ring_put_record(struct scull_ring *r, const void *buf, size_t len)
+{
+	__u32 head = r->ctrl->head, rlen = len;
+	__u32 room = r->size - (head - __atomic_load_n(&r->ctrl->tail, __ATOMIC_ACQUIRE));
+
+	if(len > r->size - SCULL_P_RECHDR){
+		errno = EMSGSIZE;
+		return -1;
+	}
+	if(room < SCULL_P_RECHDR + len){
+		errno = EAGAIN;
+		return -1;
+	}
+	copy_in(r, head, &rlen, SCULL_P_RECHDR);
+	copy_in(r, head + SCULL_P_RECHDR, buf, len);
+	scull_ring_commit(r, SCULL_P_RECHDR + len);
+	return len;
+}
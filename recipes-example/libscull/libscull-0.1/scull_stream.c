@@ -0,0 +1,225 @@
+/*
+ * Buffered and vectored transfers.
+ */
+#include<stdlib.h>
+#include<string.h>
+#include<errno.h>
+#include<fcntl.h>
+#include<limits.h>
+#include<unistd.h>
+#include "scull_internal.h"
+
+struct scull_stream {
+	int fd;
+	int owned;		/* opened by us, closed by us */
+	int writing;		/* buf holds data to write, else data read */
+	char *buf;
+	size_t size;
+	size_t pos, len;	/* unread (or unwritten) data is buf[pos, len) */
+};
+
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
+/* drop what iov has done so far */
+static void iov_advance(struct iovec **iov, int *iovcnt, size_t n)
+{
+	while(*iovcnt && n >= (*iov)->iov_len){
+		n -= (*iov)->iov_len;
+		(*iov)++;
+		(*iovcnt)--;
+	}
+	if(*iovcnt){
+		(*iov)->iov_base = (char *)(*iov)->iov_base + n;
+		(*iov)->iov_len -= n;
+	}
+}
+
+ssize_t scull_readv_full(int fd, struct iovec *iov, int iovcnt)
+{
+	size_t done = 0;
+	ssize_t n;
+
+	iov_advance(&iov, &iovcnt, 0);
+	while(iovcnt){
+		n = readv(fd, iov, iovcnt > IOV_MAX ? IOV_MAX : iovcnt);
+		if(n < 0){
+			if(errno == EINTR)
+				continue;
+			return done ? (ssize_t)done : -1;
+		}
+		if(n == 0)
+			break;
+		done += n;
+		iov_advance(&iov, &iovcnt, n);
+	}
+	return done;
+}
+
+ssize_t scull_writev_full(int fd, struct iovec *iov, int iovcnt)
+{
+	size_t done = 0;
+	ssize_t n;
+
+	iov_advance(&iov, &iovcnt, 0);
+	while(iovcnt){
+		n = writev(fd, iov, iovcnt > IOV_MAX ? IOV_MAX : iovcnt);
+		if(n < 0){
+			if(errno == EINTR)
+				continue;
+			return done ? (ssize_t)done : -1;
+		}
+		done += n;
+		iov_advance(&iov, &iovcnt, n);
+	}
+	return done;
+}
+
+struct scull_stream *scull_stream_fdopen(int fd, size_t bufsize)
+{
+	struct scull_stream *s;
+
+	if(bufsize == 0){
+		errno = EINVAL;
+		return NULL;
+	}
+	s = calloc(1, sizeof(*s));
+	if(!s)
+		return NULL;
+	s->buf = malloc(bufsize);
+	if(!s->buf){
+		free(s);
+		return NULL;
+	}
+	s->fd = fd;
+	s->size = bufsize;
+	return s;
+}
+
+struct scull_stream *scull_stream_open(const char *path, int flags, size_t bufsize)
+{
+	struct scull_stream *s;
+	int fd = open(path, flags | O_CLOEXEC);
+
+	if(fd < 0)
+		return NULL;
+	s = scull_stream_fdopen(fd, bufsize);
+	if(!s){
+		int err = errno;
+
+		close(fd);
+		errno = err;
+		return NULL;
+	}
+	s->owned = 1;
+	return s;
+}
+
+int scull_stream_fd(const struct scull_stream *s)
+{
+	return s->fd;
+}
+
+int scull_stream_flush(struct scull_stream *s)
+{
+	struct iovec iov;
+	ssize_t n;
+
+	if(!s->writing || s->pos == s->len)
+		return 0;
+	iov.iov_base = s->buf + s->pos;
+	iov.iov_len = s->len - s->pos;
+	n = scull_writev_full(s->fd, &iov, 1);
+	if(n > 0)
+		s->pos += n;
+	if(s->pos < s->len)
+		return -1; /* what is left stays buffered */
+	s->pos = s->len = 0;
+	return 0;
+}
+
+ssize_t scull_stream_read(struct scull_stream *s, void *buf, size_t len)
+{
+	ssize_t n;
+
+	if(s->writing){
+		if(scull_stream_flush(s))
+			return -1;
+		s->writing = 0;
+	}
+	if(s->pos == s->len){
+		/* nothing buffered: big reads skip the copy */
+		do
+			n = read(s->fd, len >= s->size ? buf : s->buf, len >= s->size ? len : s->size);
+		while(n < 0 && errno == EINTR);
+		if(n <= 0 || len >= s->size)
+			return n;
+		s->pos = 0;
+		s->len = n;
+	}
+	if(len > s->len - s->pos)
+		len = s->len - s->pos;
+	memcpy(buf, s->buf + s->pos, len);
+	s->pos += len;
+	return len;
+}
+
+ssize_t scull_stream_read_full(struct scull_stream *s, void *buf, size_t len)
+{
+	size_t done = 0;
+	ssize_t n;
+
+	while(done < len){
+		n = scull_stream_read(s, (char *)buf + done, len - done);
+		if(n < 0)
+			return done ? (ssize_t)done : -1;
+		if(n == 0)
+			break;
+		done += n;
+	}
+	return done;
+}
+
+ssize_t scull_stream_write(struct scull_stream *s, const void *buf, size_t len)
+{
+	struct iovec iov[2];
+	size_t queued;
+	ssize_t n;
+
+	if(!s->writing){
+		s->pos = s->len = 0; /* read ahead is lost, as with stdio */
+		s->writing = 1;
+	}
+	if(s->len + len <= s->size){
+		memcpy(s->buf + s->len, buf, len);
+		s->len += len;
+		return len;
+	}
+	/* full: out with the buffer and the new data in one call */
+	queued = s->len - s->pos;
+	iov[0].iov_base = s->buf + s->pos;
+	iov[0].iov_len = queued;
+	iov[1].iov_base = (void *)buf;
+	iov[1].iov_len = len;
+	n = scull_writev_full(s->fd, iov, 2);
+	if(n < 0)
+		return -1;
+	if((size_t)n < queued){
+		s->pos += n; /* errno is writev()'s */
+		return -1;
+	}
+	s->pos = s->len = 0;
+	return n - queued;
+}
+
+int scull_stream_close(struct scull_stream *s)
+{
+	int ret = scull_stream_flush(s);
+
+	if(s->owned && close(s->fd) && !ret)
+		ret = -1;
+	free(s->buf);
+	free(s);
+	return ret;
+}
@@ -0,0 +1,511 @@
+/*
+ * scullbridge: copies the records of a scullpipe into a Redis stream.
+ *
+ * The pipe is read non blocking from a poll() loop, through
+ * SCULL_P_IOCRDBATCH in record mode and split at newlines in stream
+ * mode. Every record becomes one XADD, and the XADDs go out pipelined:
+ * a batch is written once it holds -b records or its oldest record has
+ * waited -l microseconds, whichever comes first.
+ *
+ * At most -w records are ever unacknowledged by Redis. When that many
+ * are in flight the pipe is left alone until replies come back, so a
+ * slow server fills the pipe and blocks its writers instead of growing
+ * a queue in here.
+ *
+ * Every -i seconds a line goes to stdout with the records per second
+ * and the latency percentiles from the moment a record was read (or,
+ * with -t, from the producer's own timestamp) to its XADD reply.
+ */
+#define _GNU_SOURCE
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<errno.h>
+#include<fcntl.h>
+#include<unistd.h>
+#include<poll.h>
+#include<signal.h>
+#include<stdint.h>
+#include<time.h>
+#include<sys/ioctl.h>
+#include<sys/socket.h>
+
+#include<hiredis/hiredis.h>
+#include<libscull.h>
+
+/* log-linear latency buckets: 32 per power of two, each within about 3% */
+#define SUB_BITS	5
+#define SUB		(1 << SUB_BITS)
+#define NBUCKETS	(2 * SUB + (64 - SUB_BITS - 1) * SUB)
+
+struct hist {
+	uint64_t b[NBUCKETS];
+	uint64_t total, max;
+};
+
+struct bridge {
+	int fd;
+	int recmode;
+	struct scull_batch *batch;	/* record mode */
+	char *buf;			/* stream mode: the partial line */
+	size_t bufsize, used;
+	uint64_t buf_stamp;		/* when the partial line was read */
+	int readable;			/* no EAGAIN since the last POLLIN */
+
+	redisContext *c;
+	int writing;			/* hiredis has unsent output */
+	uint64_t *stamps;		/* per record in flight, by sequence */
+	unsigned long head, tail;	/* acknowledged, appended */
+	unsigned long flushed;		/* appended and handed to the socket */
+	uint64_t oldest;		/* when the oldest unflushed record came in */
+
+	unsigned long events, batches, errors;
+	double stalled;			/* seconds spent with the window full */
+	struct hist interval, all;
+};
+
+static const char *device = "/dev/scullpipe0", *stream = "scull";
+static const char *host = "127.0.0.1", *unix_path;
+static int port = 6379, producer_stamps;
+static unsigned long batch_max = 128, window = 4096, bound_us = 1000;
+static const char *maxlen;
+static double report_every = 5;
+static volatile sig_atomic_t stop;
+
+static void on_signal(int sig)
+{
+	(void)sig;
+	stop = 1;
+}
+
+static uint64_t clock_ns(clockid_t id)
+{
+	struct timespec ts;
+
+	clock_gettime(id, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* record stamps; producers stamp with CLOCK_REALTIME, so -t compares against that */
+static uint64_t stamp_now(void)
+{
+	return clock_ns(producer_stamps ? CLOCK_REALTIME : CLOCK_MONOTONIC);
+}
+
+static int bucket(uint64_t v)
+{
+	int e;
+
+	if(v < 2 * SUB)
+		return v;
+	e = 63 - __builtin_clzll(v);
+	return 2 * SUB + (e - SUB_BITS - 1) * SUB + ((v >> (e - SUB_BITS)) - SUB);
+}
+
+static uint64_t bucket_lo(int b)
+{
+	int e;
+
+	if(b < 2 * SUB)
+		return b;
+	e = (b - 2 * SUB) / SUB + SUB_BITS + 1;
+	return (uint64_t)(SUB + (b - 2 * SUB) % SUB) << (e - SUB_BITS);
+}
+
+static void hist_add(struct hist *h, uint64_t v)
+{
+	h->b[bucket(v)]++;
+	h->total++;
+	if(v > h->max)
+		h->max = v;
+}
+
+static double hist_percentile(const struct hist *h, double p)
+{
+	uint64_t seen = 0, want = (uint64_t)(p * h->total);
+	int b;
+
+	for(b = 0; b < NBUCKETS; b++){
+		seen += h->b[b];
+		if(seen > want)
+			return bucket_lo(b) / 1e3;
+	}
+	return 0;
+}
+
+/* nonblocking connect, finished by hand */
+static redisContext *redis_connect(void)
+{
+	struct pollfd pfd;
+	redisContext *c;
+	socklen_t len;
+	int err = 0;
+
+	c = unix_path ? redisConnectUnixNonBlock(unix_path) : redisConnectNonBlock(host, port);
+	if(!c || c->err){
+		fprintf(stderr, "redis: %s\n", c ? c->errstr : "can't allocate redis context");
+		goto fail;
+	}
+	pfd.fd = c->fd;
+	pfd.events = POLLOUT;
+	if(poll(&pfd, 1, 2000) != 1){
+		fprintf(stderr, "redis: connect timed out\n");
+		goto fail;
+	}
+	len = sizeof(err);
+	if(getsockopt(c->fd, SOL_SOCKET, SO_ERROR, &err, &len) || err){
+		fprintf(stderr, "redis: %s\n", strerror(err ? err : errno));
+		goto fail;
+	}
+	return c;
+fail:
+	if(c)
+		redisFree(c);
+	return NULL;
+}
+
+/* one XADD for one record */
+static int publish(struct bridge *br, const char *data, size_t len, uint64_t t)
+{
+	const char *argv[10];
+	size_t argvlen[10];
+	char ts[24];
+	int argc = 0;
+
+	if(producer_stamps){
+		if(len < sizeof(t)){
+			br->errors++;
+			return 0;
+		}
+		memcpy(&t, data, sizeof(t));
+		data += sizeof(t);
+		len -= sizeof(t);
+	}
+#define ARG(s, n)	(argv[argc] = (s), argvlen[argc++] = (n))
+	ARG("XADD", 4);
+	ARG(stream, strlen(stream));
+	if(maxlen){
+		ARG("MAXLEN", 6);
+		ARG("~", 1);
+		ARG(maxlen, strlen(maxlen));
+	}
+	ARG("*", 1);
+	ARG("d", 1);
+	ARG(data, len);
+	if(producer_stamps){
+		ARG("ts", 2);
+		ARG(ts, snprintf(ts, sizeof(ts), "%llu", (unsigned long long)t));
+	}
+#undef ARG
+	if(redisAppendCommandArgv(br->c, argc, argv, argvlen) != REDIS_OK)
+		return -1;
+	if(br->tail == br->flushed)
+		br->oldest = clock_ns(CLOCK_MONOTONIC);
+	br->stamps[br->tail++ % window] = t;
+	return 0;
+}
+
+/* whole lines out of buf; what is left over waits for the rest of its line */
+static int split_lines(struct bridge *br, uint64_t t)
+{
+	char *p = br->buf, *end = br->buf + br->used, *nl;
+
+	while(p < end && br->tail - br->head < window && (nl = memchr(p, '\n', end - p))){
+		if(nl > p && publish(br, p, nl - p, t))
+			return -1;
+		p = nl + 1;
+	}
+	/* a line longer than the buffer goes out in pieces */
+	if(p == br->buf && br->used == br->bufsize && br->tail - br->head < window){
+		if(publish(br, p, br->used, t))
+			return -1;
+		p = end;
+	}
+	br->used = end - p;
+	memmove(br->buf, p, br->used);
+	return 0;
+}
+
+/* takes records while the window and the current batch have room */
+static int pull(struct bridge *br)
+{
+	const void *data;
+	ssize_t n;
+	size_t len;
+
+	/* lines held back by a full window go first */
+	if(!br->recmode && br->used && split_lines(br, br->buf_stamp))
+		return -1;
+	while(br->readable && br->tail - br->head < window && br->tail - br->flushed < batch_max){
+		if(br->recmode){
+			if(scull_batch_next(br->batch, &data, &len) == 0){
+				if(publish(br, data, len, stamp_now()))
+					return -1;
+				continue;
+			}
+		}else{
+			if(br->used == br->bufsize)
+				break;
+			n = read(br->fd, br->buf + br->used, br->bufsize - br->used);
+			if(n > 0){
+				br->used += n;
+				br->buf_stamp = stamp_now();
+				if(split_lines(br, br->buf_stamp))
+					return -1;
+				continue;
+			}
+			if(!n){
+				br->readable = 0;	/* no writer right now */
+				break;
+			}
+		}
+		if(errno == EAGAIN)
+			br->readable = 0;
+		else if(errno != EINTR){
+			perror(device);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/* starts a batch on its way, or keeps the last one going */
+static int flush(struct bridge *br, int force)
+{
+	int done;
+
+	if(br->tail != br->flushed && (force || br->tail - br->flushed >= batch_max ||
+				       clock_ns(CLOCK_MONOTONIC) - br->oldest >= bound_us * 1000)){
+		br->flushed = br->tail;
+		br->batches++;
+		br->writing = 1;
+	}
+	if(!br->writing)
+		return 0;
+	if(redisBufferWrite(br->c, &done) != REDIS_OK)
+		return -1;
+	br->writing = !done;
+	return 0;
+}
+
+static int collect(struct bridge *br)
+{
+	redisReply *reply;
+	void *r;
+	uint64_t t;
+
+	if(redisBufferRead(br->c) != REDIS_OK)
+		return -1;
+	t = stamp_now();
+	while(br->head != br->flushed){
+		if(redisGetReplyFromReader(br->c, &r) != REDIS_OK)
+			return -1;
+		if(!r)
+			break;
+		reply = r;
+		if(reply->type == REDIS_REPLY_ERROR && !br->errors++)
+			fprintf(stderr, "XADD: %s\n", reply->str);
+		freeReplyObject(reply);
+		t = t > br->stamps[br->head % window] ? t - br->stamps[br->head % window] : 0;
+		hist_add(&br->interval, t);
+		hist_add(&br->all, t);
+		t = stamp_now();
+		br->head++;
+		br->events++;
+	}
+	return 0;
+}
+
+static void report(struct bridge *br, double t, double secs, unsigned long events,
+		   unsigned long batches, double stalled)
+{
+	printf("%.1f,%lu,%.0f,%.1f,%.1f,%.1f,%.1f,%lu,%.1f\n", t, events, events / secs,
+	       batches ? (double)events / batches : 0, hist_percentile(&br->interval, 0.50),
+	       hist_percentile(&br->interval, 0.99), br->interval.max / 1e3,
+	       br->tail - br->head, 100 * stalled / secs);
+	fflush(stdout);
+}
+
+static int open_pipe(struct bridge *br)
+{
+	br->fd = open(device, O_RDONLY | O_NONBLOCK);
+	if(br->fd < 0){
+		perror(device);
+		return -1;
+	}
+	br->recmode = ioctl(br->fd, SCULL_P_IOCQRECMODE) == SCULL_P_RECORD;
+	if(producer_stamps && !br->recmode){
+		fprintf(stderr, "%s: -t needs a pipe in record mode\n", device);
+		return -1;
+	}
+	if(br->recmode)
+		br->batch = scull_batch_new(br->fd, br->bufsize);
+	else
+		br->buf = malloc(br->bufsize);
+	if(!br->batch && !br->buf){
+		perror("scullbridge");
+		return -1;
+	}
+	br->readable = 1;
+	return 0;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [options] [host [port]]\n"
+		"  -d dev    pipe to read (/dev/scullpipe0)\n"
+		"  -k key    stream to XADD to (scull)\n"
+		"  -m n      trim the stream to about n entries (MAXLEN ~)\n"
+		"  -b n      records per batch (128)\n"
+		"  -l usecs  longest a record waits for its batch to fill (1000)\n"
+		"  -w n      most records unacknowledged by Redis (4096)\n"
+		"  -B bytes  read buffer (64k)\n"
+		"  -t        records start with the producer's CLOCK_REALTIME stamp, 8 bytes of ns\n"
+		"  -i secs   seconds between reports (5)\n"
+		"  -s path   connect to this unix socket instead of host:port\n", prog);
+}
+
+int main(int argc, char **argv)
+{
+	struct bridge br;
+	struct pollfd pfd[2];
+	struct timespec ts;
+	uint64_t t, t0, last, next_report, wait_ns;
+	unsigned long last_events = 0, last_batches = 0;
+	double last_stalled = 0, secs;
+	int opt, full, ret = 0;
+
+	memset(&br, 0, sizeof(br));
+	br.bufsize = 65536;
+	while((opt = getopt(argc, argv, "d:k:m:b:l:w:B:ti:s:h")) != -1){
+		switch(opt){
+		case 'd': device = optarg; break;
+		case 'k': stream = optarg; break;
+		case 'm': maxlen = optarg; break;
+		case 'b': batch_max = strtoul(optarg, NULL, 0); break;
+		case 'l': bound_us = strtoul(optarg, NULL, 0); break;
+		case 'w': window = strtoul(optarg, NULL, 0); break;
+		case 'B': br.bufsize = strtoul(optarg, NULL, 0); break;
+		case 't': producer_stamps = 1; break;
+		case 'i': report_every = atof(optarg); break;
+		case 's': unix_path = optarg; break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	if(argc > optind)
+		host = argv[optind];
+	if(argc > optind + 1)
+		port = atoi(argv[optind + 1]);
+	if(!batch_max || !window || !br.bufsize || report_every <= 0){
+		usage(argv[0]);
+		return 1;
+	}
+	if(batch_max > window)
+		batch_max = window;
+
+	br.stamps = calloc(window, sizeof(*br.stamps));
+	if(!br.stamps || open_pipe(&br))
+		return 1;
+	br.c = redis_connect();
+	if(!br.c)
+		return 1;
+	signal(SIGINT, on_signal);
+	signal(SIGTERM, on_signal);
+
+	printf("seconds,events,events/s,events/batch,p50_us,p99_us,max_us,inflight,stalled%%\n");
+	t0 = last = clock_ns(CLOCK_MONOTONIC);
+	next_report = t0 + (uint64_t)(report_every * 1e9);
+	while(!stop){
+		if(pull(&br) || flush(&br, 0))
+			break;
+
+		/* wake for the pipe only while there is room to take from it */
+		full = br.tail - br.head >= window;
+		pfd[0].fd = br.fd;
+		pfd[0].events = !br.readable && !full && br.tail - br.flushed < batch_max ? POLLIN : 0;
+		pfd[1].fd = br.c->fd;
+		pfd[1].events = (br.head != br.flushed ? POLLIN : 0) | (br.writing ? POLLOUT : 0);
+		t = clock_ns(CLOCK_MONOTONIC);
+		wait_ns = next_report > t ? next_report - t : 0;
+		if(br.tail != br.flushed){
+			uint64_t due = br.oldest + bound_us * 1000;
+
+			if(due <= t)
+				wait_ns = 0;
+			else if(due - t < wait_ns)
+				wait_ns = due - t;
+		}
+		if(br.readable && !full && br.tail - br.flushed < batch_max)
+			wait_ns = 0;
+		ts.tv_sec = wait_ns / 1000000000ULL;
+		ts.tv_nsec = wait_ns % 1000000000ULL;
+		if(ppoll(pfd, 2, &ts, NULL) < 0 && errno != EINTR){
+			perror("ppoll");
+			ret = 1;
+			break;
+		}
+		t = clock_ns(CLOCK_MONOTONIC);
+		if(full)
+			br.stalled += (t - last) / 1e9;
+		last = t;
+
+		if(pfd[0].revents & (POLLIN | POLLHUP | POLLERR))
+			br.readable = 1;
+		if(pfd[1].revents & (POLLIN | POLLHUP | POLLERR))
+			if(collect(&br))
+				break;
+		if(pfd[1].revents & POLLOUT)
+			if(flush(&br, 0))
+				break;
+
+		if(t >= next_report){
+			secs = (t - next_report) / 1e9 + report_every;
+			report(&br, (t - t0) / 1e9, secs, br.events - last_events,
+			       br.batches - last_batches, br.stalled - last_stalled);
+			memset(&br.interval, 0, sizeof(br.interval));
+			last_events = br.events;
+			last_batches = br.batches;
+			last_stalled = br.stalled;
+			next_report = t + (uint64_t)(report_every * 1e9);
+		}
+	}
+
+	/* what was read goes out before we leave, if Redis is still there */
+	if(!br.c->err){
+		flush(&br, 1);
+		t = clock_ns(CLOCK_MONOTONIC) + 5000000000ULL;
+		while(!br.c->err && br.head != br.tail && clock_ns(CLOCK_MONOTONIC) < t){
+			pfd[1].fd = br.c->fd;
+			pfd[1].events = POLLIN | (br.writing ? POLLOUT : 0);
+			if(poll(&pfd[1], 1, 100) <= 0)
+				continue;
+			if((pfd[1].revents & POLLOUT) && flush(&br, 0))
+				break;
+			if((pfd[1].revents & (POLLIN | POLLHUP | POLLERR)) && collect(&br))
+				break;
+		}
+	}
+	if(br.c->err){
+		fprintf(stderr, "redis: %s\n", br.c->errstr);
+		ret = 1;
+	}
+	if(br.head != br.tail)
+		fprintf(stderr, "%lu records read but not acknowledged\n", br.tail - br.head);
+
+	secs = (clock_ns(CLOCK_MONOTONIC) - t0) / 1e9;
+	fprintf(stderr, "%lu events in %.1f s, %.0f/s, %lu batches, %lu errors, "
+		"latency p50 %.1f us p99 %.1f us p99.9 %.1f us max %.1f us\n",
+		br.events, secs, br.events / secs, br.batches, br.errors,
+		hist_percentile(&br.all, 0.50), hist_percentile(&br.all, 0.99),
+		hist_percentile(&br.all, 0.999), br.all.max / 1e3);
+
+	redisFree(br.c);
+	if(br.batch)
+		scull_batch_free(br.batch);
+	free(br.buf);
+	free(br.stamps);
+	close(br.fd);
+	return ret || br.errors ? 1 : 0;
+}
@@ -0,0 +1,839 @@
+/*
+ * scullresp: a RESP server that serves the scull_char devices as Redis
+ * strings, so redis-cli, hiredis and the rest can use them as they are.
+ *
+ * A key names a device under -D (keys must start with -k, scull_char by
+ * default, so nothing else under /dev is reachable), and the value is
+ * the device's contents:
+ *
+ *   GET key                   the whole device
+ *   SET key value             replaces it
+ *   GETRANGE key start end    bytes start..end, negative from the end
+ *   SETRANGE key offset value writes at offset; a gap reads back as zeros
+ *   APPEND key value          writes at the end
+ *   STRLEN key                its size
+ *
+ * plus PING, ECHO, SELECT 0, QUIT, and empty replies to COMMAND and
+ * CONFIG so that redis-cli and redis-benchmark get going.
+ *
+ * Each of -t threads runs its own epoll loop and accepts from the
+ * shared listening socket. Requests are parsed in place and pipelined:
+ * everything complete in the input buffer is answered before anything
+ * is written back. Values are never staged: a SET's payload goes to the
+ * device straight from the input buffer, and a GET reads the device
+ * straight into the output buffer behind the reply header. A scull_char
+ * read or write stops at the end of a quantum, so transfers are
+ * preadv()/pwritev() with one iovec per quantum, which the kernel walks
+ * in a single call.
+ */
+#define _GNU_SOURCE
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<stdarg.h>
+#include<limits.h>
+#include<strings.h>
+#include<errno.h>
+#include<fcntl.h>
+#include<unistd.h>
+#include<signal.h>
+#include<pthread.h>
+#include<stdint.h>
+#include<netdb.h>
+#include<netinet/in.h>
+#include<netinet/tcp.h>
+#include<sys/epoll.h>
+#include<sys/ioctl.h>
+#include<sys/socket.h>
+#include<sys/uio.h>
+#include<sys/un.h>
+
+#include<scull/scull_ioctl.h>
+
+#define MAX_ARGS	16
+#define MAX_BULK	(512L << 20)
+#define MAX_INLINE	(64 << 10)
+#define OUT_HIGH	(4 << 20)	/* stop answering until this much has gone out */
+#define MAX_DEVICES	64
+#define MAX_IOV		64
+
+struct device {
+	char name[64];
+	int fd;
+	long quantum;
+	pthread_rwlock_t lock;		/* one command at a time may change it */
+};
+
+struct conn {
+	int fd;
+	char *in;
+	size_t in_size, in_len, in_off;
+	size_t in_need;			/* the command being read needs this much */
+	char *out;
+	size_t out_size, out_len, out_off;
+	unsigned int events;
+	int closing;
+};
+
+struct worker {
+	pthread_t thread;
+	int epfd;
+	unsigned long commands, conns;
+};
+
+static const char *dev_dir = "/dev", *key_prefix = "scull_char";
+static int listen_fd;
+static volatile sig_atomic_t stop;
+
+static struct device devices[MAX_DEVICES];
+static int ndevices;
+static pthread_mutex_t devices_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static const char zeros[65536];
+
+static void on_signal(int sig)
+{
+	(void)sig;
+	stop = 1;
+}
+
+/* devices */
+
+static int open_device(const char *name, int flags)
+{
+	char path[PATH_MAX];
+
+	snprintf(path, sizeof(path), "%s/%s", dev_dir, name);
+	return open(path, flags | O_CLOEXEC);
+}
+
+/* the device behind key, opened on first use; NULL with errno set */
+static struct device *lookup(const char *key, size_t len)
+{
+	struct device *d = NULL;
+	size_t plen = strlen(key_prefix);
+	int i;
+
+	if(len < plen || len >= sizeof(d->name) || memcmp(key, key_prefix, plen) ||
+	   memchr(key, '/', len) || memchr(key, '\0', len)){
+		errno = ENOENT;
+		return NULL;
+	}
+	pthread_mutex_lock(&devices_lock);
+	for(i = 0; i < ndevices; i++)
+		if(strlen(devices[i].name) == len && !memcmp(devices[i].name, key, len)){
+			d = &devices[i];
+			goto out;
+		}
+	if(ndevices == MAX_DEVICES){
+		errno = EMFILE;
+		goto out;
+	}
+	d = &devices[ndevices];
+	memcpy(d->name, key, len);
+	d->name[len] = '\0';
+	d->fd = open_device(d->name, O_RDWR);
+	if(d->fd < 0 || lseek(d->fd, 0, SEEK_END) < 0){
+		/* only something with offsets can hold a string */
+		if(d->fd >= 0){
+			close(d->fd);
+			errno = ESPIPE;
+		}
+		d = NULL;
+		goto out;
+	}
+	d->quantum = ioctl(d->fd, SCULL_IOCQQUANTUM);
+	pthread_rwlock_init(&d->lock, NULL);
+	ndevices++;
+out:
+	pthread_mutex_unlock(&devices_lock);
+	return d;
+}
+
+static off_t dev_size(struct device *d)
+{
+	return lseek(d->fd, 0, SEEK_END);
+}
+
+/* iovecs for len bytes at off, cut at the quantum boundaries */
+static int quantum_iov(struct device *d, struct iovec *iov, char *buf, size_t len, off_t off)
+{
+	size_t q = d->quantum > 0 ? (size_t)d->quantum : len, n;
+	int cnt = 0;
+
+	while(len && cnt < MAX_IOV){
+		n = q - off % q;
+		if(n > len)
+			n = len;
+		iov[cnt].iov_base = buf;
+		iov[cnt++].iov_len = n;
+		buf += n;
+		off += n;
+		len -= n;
+	}
+	return cnt;
+}
+
+static ssize_t read_at(struct device *d, char *buf, size_t len, off_t off)
+{
+	struct iovec iov[MAX_IOV];
+	size_t done = 0;
+	ssize_t n;
+
+	while(done < len){
+		n = preadv(d->fd, iov, quantum_iov(d, iov, buf + done, len - done, off + done),
+			   off + done);
+		if(n < 0 && errno == EINTR)
+			continue;
+		if(n < 0)
+			return done ? (ssize_t)done : -1;
+		if(!n)
+			break;
+		done += n;
+	}
+	return done;
+}
+
+static ssize_t write_at(struct device *d, const char *buf, size_t len, off_t off)
+{
+	struct iovec iov[MAX_IOV];
+	size_t done = 0;
+	ssize_t n;
+
+	while(done < len){
+		n = pwritev(d->fd, iov, quantum_iov(d, iov, (char *)buf + done, len - done, off + done),
+			    off + done);
+		if(n < 0 && errno == EINTR)
+			continue;
+		if(n <= 0)
+			return -1;
+		done += n;
+	}
+	return done;
+}
+
+/* scull hands out quanta uninitialised; Redis promises zeros in a gap */
+static int zero_fill(struct device *d, off_t from, off_t to)
+{
+	size_t n;
+
+	while(from < to){
+		n = to - from < (off_t)sizeof(zeros) ? (size_t)(to - from) : sizeof(zeros);
+		if(write_at(d, zeros, n, from) < 0)
+			return -1;
+		from += n;
+	}
+	return 0;
+}
+
+/* replies */
+
+static int out_reserve(struct conn *c, size_t n)
+{
+	size_t size;
+	char *p;
+
+	if(c->out_off && c->out_off == c->out_len)
+		c->out_off = c->out_len = 0;
+	if(c->out_len + n <= c->out_size)
+		return 0;
+	size = c->out_size ? c->out_size : 16384;
+	while(size < c->out_len + n)
+		size *= 2;
+	p = realloc(c->out, size);
+	if(!p)
+		return -1;
+	c->out = p;
+	c->out_size = size;
+	return 0;
+}
+
+static void out_add(struct conn *c, const char *s, size_t n)
+{
+	if(out_reserve(c, n)){
+		c->closing = 1;
+		return;
+	}
+	memcpy(c->out + c->out_len, s, n);
+	c->out_len += n;
+}
+
+static void out_fmt(struct conn *c, const char *fmt, ...)
+	__attribute__((format(printf, 2, 3)));
+
+static void out_fmt(struct conn *c, const char *fmt, ...)
+{
+	char buf[256];
+	va_list ap;
+	int n;
+
+	va_start(ap, fmt);
+	n = vsnprintf(buf, sizeof(buf), fmt, ap);
+	va_end(ap);
+	out_add(c, buf, n < (int)sizeof(buf) ? n : (int)sizeof(buf) - 1);
+}
+
+static void out_bulk(struct conn *c, const char *s, size_t n)
+{
+	out_fmt(c, "$%zu\r\n", n);
+	out_add(c, s, n);
+	out_add(c, "\r\n", 2);
+}
+
+static void out_errno(struct conn *c, const char *what)
+{
+	out_fmt(c, "-ERR %s: %s\r\n", what, strerror(errno));
+}
+
+/*
+ * A bulk string read from the device right into the output buffer. If
+ * someone outside shrank the device under us the tail reads as zeros,
+ * the length already being on the wire.
+ */
+static void out_device(struct conn *c, struct device *d, off_t off, size_t len)
+{
+	ssize_t n;
+
+	if(out_reserve(c, len + 32)){
+		out_add(c, "-ERR out of memory\r\n", 20);
+		return;
+	}
+	c->out_len += sprintf(c->out + c->out_len, "$%zu\r\n", len);
+	n = read_at(d, c->out + c->out_len, len, off);
+	if(n < 0)
+		n = 0;
+	memset(c->out + c->out_len + n, 0, len - n);
+	c->out_len += len;
+	out_add(c, "\r\n", 2);
+}
+
+/* commands */
+
+static int is(const char *arg, size_t len, const char *name)
+{
+	return strlen(name) == len && !strncasecmp(arg, name, len);
+}
+
+static int to_ll(const char *arg, size_t len, long long *v)
+{
+	char buf[32], *end;
+
+	if(!len || len >= sizeof(buf))
+		return -1;
+	memcpy(buf, arg, len);
+	buf[len] = '\0';
+	errno = 0;
+	*v = strtoll(buf, &end, 10);
+	return *end || errno ? -1 : 0;
+}
+
+static void dispatch(struct conn *c, int argc, char **argv, size_t *argl)
+{
+	struct device *d;
+	long long a, b;
+	off_t size;
+
+	if(!argc)
+		return;
+#define ARGS(n)	do { if(argc != (n)) goto arity; } while(0)
+	if(is(argv[0], argl[0], "PING")){
+		if(argc > 1)
+			out_bulk(c, argv[1], argl[1]);
+		else
+			out_add(c, "+PONG\r\n", 7);
+		return;
+	}
+	if(is(argv[0], argl[0], "ECHO")){
+		ARGS(2);
+		out_bulk(c, argv[1], argl[1]);
+		return;
+	}
+	if(is(argv[0], argl[0], "QUIT")){
+		out_add(c, "+OK\r\n", 5);
+		c->closing = 1;
+		return;
+	}
+	if(is(argv[0], argl[0], "COMMAND") || is(argv[0], argl[0], "CONFIG")){
+		out_add(c, "*0\r\n", 4);
+		return;
+	}
+	if(is(argv[0], argl[0], "SELECT")){
+		ARGS(2);
+		if(is(argv[1], argl[1], "0"))
+			out_add(c, "+OK\r\n", 5);
+		else
+			out_add(c, "-ERR DB index is out of range\r\n", 31);
+		return;
+	}
+
+	if(!is(argv[0], argl[0], "GET") && !is(argv[0], argl[0], "SET") &&
+	   !is(argv[0], argl[0], "GETRANGE") && !is(argv[0], argl[0], "SETRANGE") &&
+	   !is(argv[0], argl[0], "APPEND") && !is(argv[0], argl[0], "STRLEN"))
+		goto unknown;
+	if(argc < 2)
+		goto arity;
+	d = lookup(argv[1], argl[1]);
+	if(!d){
+		out_fmt(c, "-ERR %.*s: %s\r\n", (int)(argl[1] < 64 ? argl[1] : 64), argv[1], strerror(errno));
+		return;
+	}
+
+	if(is(argv[0], argl[0], "GET")){
+		ARGS(2);
+		pthread_rwlock_rdlock(&d->lock);
+		size = dev_size(d);
+		if(size < 0)
+			out_errno(c, "GET");
+		else
+			out_device(c, d, 0, size);
+		pthread_rwlock_unlock(&d->lock);
+	}else if(is(argv[0], argl[0], "STRLEN")){
+		ARGS(2);
+		size = dev_size(d);
+		if(size < 0)
+			out_errno(c, "STRLEN");
+		else
+			out_fmt(c, ":%lld\r\n", (long long)size);
+	}else if(is(argv[0], argl[0], "GETRANGE")){
+		ARGS(4);
+		if(to_ll(argv[2], argl[2], &a) || to_ll(argv[3], argl[3], &b))
+			goto not_int;
+		pthread_rwlock_rdlock(&d->lock);
+		size = dev_size(d);
+		if(a < 0)
+			a += size;
+		if(b < 0)
+			b += size;
+		if(a < 0)
+			a = 0;
+		if(b >= size)
+			b = size - 1;
+		if(size <= 0 || a > b)
+			out_add(c, "$0\r\n\r\n", 6);
+		else
+			out_device(c, d, a, b - a + 1);
+		pthread_rwlock_unlock(&d->lock);
+	}else if(is(argv[0], argl[0], "SET")){
+		ARGS(3);
+		pthread_rwlock_wrlock(&d->lock);
+		size = dev_size(d);
+		/* only a shorter value needs the device emptied first */
+		if(size > (off_t)argl[2]){
+			int fd = open_device(d->name, O_WRONLY | O_TRUNC);
+
+			if(fd >= 0){
+				close(fd);
+				d->quantum = ioctl(d->fd, SCULL_IOCQQUANTUM);
+			}
+		}
+		if(write_at(d, argv[2], argl[2], 0) < 0)
+			out_errno(c, "SET");
+		else
+			out_add(c, "+OK\r\n", 5);
+		pthread_rwlock_unlock(&d->lock);
+	}else if(is(argv[0], argl[0], "APPEND")){
+		ARGS(3);
+		pthread_rwlock_wrlock(&d->lock);
+		size = dev_size(d);
+		if(size < 0 || write_at(d, argv[2], argl[2], size) < 0)
+			out_errno(c, "APPEND");
+		else
+			out_fmt(c, ":%lld\r\n", (long long)size + (long long)argl[2]);
+		pthread_rwlock_unlock(&d->lock);
+	}else{
+		ARGS(4);
+		if(to_ll(argv[2], argl[2], &a))
+			goto not_int;
+		if(a < 0 || a + (long long)argl[3] > MAX_BULK){
+			out_add(c, "-ERR offset is out of range\r\n", 29);
+			return;
+		}
+		pthread_rwlock_wrlock(&d->lock);
+		size = dev_size(d);
+		if(!argl[3])
+			out_fmt(c, ":%lld\r\n", (long long)size);
+		else if(size < 0 || (a > size && zero_fill(d, size, a)) ||
+			write_at(d, argv[3], argl[3], a) < 0)
+			out_errno(c, "SETRANGE");
+		else
+			out_fmt(c, ":%lld\r\n", (long long)(size > a + (off_t)argl[3] ? size : a + (off_t)argl[3]));
+		pthread_rwlock_unlock(&d->lock);
+	}
+	return;
+#undef ARGS
+arity:
+	out_fmt(c, "-ERR wrong number of arguments for '%.*s' command\r\n",
+		(int)(argl[0] < 32 ? argl[0] : 32), argv[0]);
+	return;
+not_int:
+	out_add(c, "-ERR value is not an integer or out of range\r\n", 46);
+	return;
+unknown:
+	out_fmt(c, "-ERR unknown command '%.*s'\r\n", (int)(argl[0] < 32 ? argl[0] : 32), argv[0]);
+}
+
+/* parsing */
+
+/* an inline command: one line, split at spaces */
+static int parse_inline(struct conn *c, int *argc, char **argv, size_t *argl)
+{
+	char *p = c->in + c->in_off, *end = c->in + c->in_len, *nl, *eol;
+
+	nl = memchr(p, '\n', end - p);
+	if(!nl)
+		return end - p > MAX_INLINE ? -1 : 0;
+	eol = nl > p && nl[-1] == '\r' ? nl - 1 : nl;
+	*argc = 0;
+	while(p < eol){
+		while(p < eol && (*p == ' ' || *p == '\t'))
+			p++;
+		if(p == eol)
+			break;
+		if(*argc == MAX_ARGS)
+			return -1;
+		argv[*argc] = p;
+		while(p < eol && *p != ' ' && *p != '\t')
+			p++;
+		argl[*argc] = p - argv[*argc];
+		(*argc)++;
+	}
+	c->in_off = nl + 1 - c->in;
+	return 1;
+}
+
+/*
+ * The next command in the input buffer, pointing into it: 1 when there
+ * is a whole one, 0 when more has to be read, -1 on a protocol error.
+ */
+static int parse(struct conn *c, int *argc, char **argv, size_t *argl)
+{
+	char *p = c->in + c->in_off, *end = c->in + c->in_len, *nl;
+	long long n, len;
+	int i;
+
+	if(*p != '*')
+		return parse_inline(c, argc, argv, argl);
+	nl = memchr(p, '\n', end - p);
+	if(!nl)
+		return end - p > 32 ? -1 : 0;
+	if(to_ll(p + 1, nl - p - 2, &n) || n > MAX_ARGS)
+		return -1;
+	p = nl + 1;
+	for(i = 0; i < n; i++){
+		if(p >= end)
+			return 0;
+		if(*p != '$')
+			return -1;
+		nl = memchr(p, '\n', end - p);
+		if(!nl)
+			return end - p > 32 ? -1 : 0;
+		if(to_ll(p + 1, nl - p - 2, &len) || len < 0 || len > MAX_BULK)
+			return -1;
+		p = nl + 1;
+		if(end - p < len + 2){
+			/* read the rest of a large value in one go */
+			c->in_need = p - (c->in + c->in_off) + len + 2;
+			return 0;
+		}
+		argv[i] = p;
+		argl[i] = len;
+		p += len + 2;
+	}
+	*argc = n > 0 ? n : 0;
+	c->in_off = p - c->in;
+	c->in_need = 0;
+	return 1;
+}
+
+/* answers what has come in; 1 if it stopped because the replies piled up */
+static int process(struct worker *w, struct conn *c)
+{
+	char *argv[MAX_ARGS];
+	size_t argl[MAX_ARGS];
+	int argc, r, full = 0;
+
+	while(!c->closing && c->in_off < c->in_len){
+		if(c->out_len - c->out_off >= OUT_HIGH){
+			full = 1;
+			break;
+		}
+		r = parse(c, &argc, argv, argl);
+		if(!r)
+			break;
+		if(r < 0){
+			out_add(c, "-ERR Protocol error\r\n", 21);
+			c->closing = 1;
+			break;
+		}
+		dispatch(c, argc, argv, argl);
+		w->commands++;
+	}
+	if(c->in_off == c->in_len)
+		c->in_off = c->in_len = 0;
+	else if(c->in_off > c->in_size / 2){
+		memmove(c->in, c->in + c->in_off, c->in_len - c->in_off);
+		c->in_len -= c->in_off;
+		c->in_off = 0;
+	}
+	return full;
+}
+
+/* connections */
+
+static void conn_free(struct worker *w, struct conn *c)
+{
+	epoll_ctl(w->epfd, EPOLL_CTL_DEL, c->fd, NULL);
+	close(c->fd);
+	free(c->in);
+	free(c->out);
+	free(c);
+	w->conns--;
+}
+
+static void conn_watch(struct worker *w, struct conn *c)
+{
+	struct epoll_event ev;
+	unsigned int events = 0;
+
+	if(c->out_off < c->out_len)
+		events |= EPOLLOUT;
+	if(!c->closing && c->out_len - c->out_off < OUT_HIGH)
+		events |= EPOLLIN;
+	if(events == c->events)
+		return;
+	memset(&ev, 0, sizeof(ev));
+	ev.events = events;
+	ev.data.ptr = c;
+	epoll_ctl(w->epfd, EPOLL_CTL_MOD, c->fd, &ev);
+	c->events = events;
+}
+
+/* -1 when the connection is done with */
+static int conn_write(struct conn *c)
+{
+	ssize_t n;
+
+	while(c->out_off < c->out_len){
+		n = write(c->fd, c->out + c->out_off, c->out_len - c->out_off);
+		if(n < 0){
+			if(errno == EAGAIN)
+				return 0;
+			if(errno == EINTR)
+				continue;
+			return -1;
+		}
+		c->out_off += n;
+	}
+	c->out_off = c->out_len = 0;
+	return c->closing ? -1 : 0;
+}
+
+static int conn_read(struct conn *c)
+{
+	size_t want, size;
+	ssize_t n;
+	char *p;
+
+	want = c->in_need > c->in_len - c->in_off ? c->in_need - (c->in_len - c->in_off) : 0;
+	if(want < 16384)
+		want = 16384;
+	if(c->in_len + want > c->in_size){
+		if(c->in_off){
+			memmove(c->in, c->in + c->in_off, c->in_len - c->in_off);
+			c->in_len -= c->in_off;
+			c->in_off = 0;
+		}
+		size = c->in_len + want;
+		if(size > c->in_size){
+			p = realloc(c->in, size);
+			if(!p)
+				return -1;
+			c->in = p;
+			c->in_size = size;
+		}
+	}
+	n = read(c->fd, c->in + c->in_len, c->in_size - c->in_len);
+	if(n < 0)
+		return errno == EAGAIN || errno == EINTR ? 0 : -1;
+	if(!n)
+		return -1;
+	c->in_len += n;
+	return 0;
+}
+
+static void conn_event(struct worker *w, struct conn *c, unsigned int events)
+{
+	int full;
+
+	if((events & (EPOLLERR | EPOLLHUP)) && !(events & EPOLLIN))
+		goto close;
+	if((events & EPOLLIN) && conn_read(c))
+		goto close;
+	/* answer, write, and answer more for as long as the socket takes it */
+	do{
+		full = process(w, c);
+		if(conn_write(c))
+			goto close;
+	}while(full && c->out_off == c->out_len);
+	conn_watch(w, c);
+	return;
+close:
+	conn_free(w, c);
+}
+
+static void accept_all(struct worker *w)
+{
+	struct epoll_event ev;
+	struct conn *c;
+	int fd, one = 1;
+
+	while((fd = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0){
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+		c = calloc(1, sizeof(*c));
+		if(!c){
+			close(fd);
+			continue;
+		}
+		c->fd = fd;
+		c->events = EPOLLIN;
+		memset(&ev, 0, sizeof(ev));
+		ev.events = EPOLLIN;
+		ev.data.ptr = c;
+		if(epoll_ctl(w->epfd, EPOLL_CTL_ADD, fd, &ev)){
+			close(fd);
+			free(c);
+			continue;
+		}
+		w->conns++;
+	}
+}
+
+static void *run(void *arg)
+{
+	struct worker *w = arg;
+	struct epoll_event evs[128];
+	int i, n;
+
+	while(!stop){
+		n = epoll_wait(w->epfd, evs, 128, 500);
+		for(i = 0; i < n; i++){
+			if(!evs[i].data.ptr)
+				accept_all(w);
+			else
+				conn_event(w, evs[i].data.ptr, evs[i].events);
+		}
+	}
+	return NULL;
+}
+
+static int listen_on(const char *host, const char *port, const char *unix_path)
+{
+	struct addrinfo hints, *ai;
+	struct sockaddr_un sun;
+	int fd, one = 1;
+
+	if(unix_path){
+		memset(&sun, 0, sizeof(sun));
+		sun.sun_family = AF_UNIX;
+		strncpy(sun.sun_path, unix_path, sizeof(sun.sun_path) - 1);
+		unlink(unix_path);
+		fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+		if(fd < 0 || bind(fd, (struct sockaddr *)&sun, sizeof(sun)) || listen(fd, 511)){
+			perror(unix_path);
+			return -1;
+		}
+		return fd;
+	}
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = AI_PASSIVE;
+	if(getaddrinfo(host, port, &hints, &ai)){
+		fprintf(stderr, "%s: can't resolve\n", host);
+		return -1;
+	}
+	fd = socket(ai->ai_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if(fd >= 0)
+		setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	if(fd < 0 || bind(fd, ai->ai_addr, ai->ai_addrlen) || listen(fd, 511)){
+		perror("listen");
+		freeaddrinfo(ai);
+		return -1;
+	}
+	freeaddrinfo(ai);
+	return fd;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [options]\n"
+		"  -b addr   address to listen on (127.0.0.1)\n"
+		"  -p port   port (6380)\n"
+		"  -s path   listen on this unix socket instead\n"
+		"  -t n      threads (4)\n"
+		"  -D dir    where the devices are (/dev)\n"
+		"  -k pfx    prefix every key must have (scull_char)\n", prog);
+}
+
+int main(int argc, char **argv)
+{
+	const char *bind_addr = "127.0.0.1", *port = "6380", *unix_path = NULL;
+	struct epoll_event ev;
+	struct worker *workers;
+	unsigned long commands = 0;
+	int nthreads = 4, i, opt;
+
+	while((opt = getopt(argc, argv, "b:p:s:t:D:k:h")) != -1){
+		switch(opt){
+		case 'b': bind_addr = optarg; break;
+		case 'p': port = optarg; break;
+		case 's': unix_path = optarg; break;
+		case 't': nthreads = atoi(optarg); break;
+		case 'D': dev_dir = optarg; break;
+		case 'k': key_prefix = optarg; break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	if(nthreads < 1 || !*key_prefix){
+		usage(argv[0]);
+		return 1;
+	}
+
+	listen_fd = listen_on(bind_addr, port, unix_path);
+	if(listen_fd < 0)
+		return 1;
+	signal(SIGPIPE, SIG_IGN);
+	signal(SIGINT, on_signal);
+	signal(SIGTERM, on_signal);
+
+	workers = calloc(nthreads, sizeof(*workers));
+	if(!workers)
+		return 1;
+	for(i = 0; i < nthreads; i++){
+		workers[i].epfd = epoll_create1(EPOLL_CLOEXEC);
+		memset(&ev, 0, sizeof(ev));
+		/* every thread accepts; EPOLLEXCLUSIVE wakes one of them per connection */
+		ev.events = EPOLLIN | EPOLLEXCLUSIVE;
+		ev.data.ptr = NULL;
+		if(workers[i].epfd < 0 || epoll_ctl(workers[i].epfd, EPOLL_CTL_ADD, listen_fd, &ev) ||
+		   pthread_create(&workers[i].thread, NULL, run, &workers[i])){
+			perror("scullresp");
+			return 1;
+		}
+	}
+	for(i = 0; i < nthreads; i++){
+		pthread_join(workers[i].thread, NULL);
+		commands += workers[i].commands;
+		close(workers[i].epfd);
+	}
+	fprintf(stderr, "%lu commands\n", commands);
+
+	close(listen_fd);
+	if(unix_path)
+		unlink(unix_path);
+	for(i = 0; i < ndevices; i++)
+		close(devices[i].fd);
+	free(workers);
+	return 0;
+}
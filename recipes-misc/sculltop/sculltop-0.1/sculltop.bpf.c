@@ -0,0 +1,347 @@
+/*
+ * sculltop.bpf.c: the in-kernel half of sculltop. Every traced scull
+ * function is timed from entry to return and folded into per-CPU
+ * totals keyed by device, function and comm; user space reads and
+ * diffs them. Nothing is sent per event, so the cost is a couple of
+ * hash lookups per call.
+ *
+ * Each program comes as fentry/fexit and as kprobe/kretprobe; sculltop
+ * loads one set. down_interruptible() is traced too, and the time a
+ * thread spends in it while inside a traced function is its semaphore
+ * wait. That probe fires for every semaphore in the kernel, so it
+ * returns before touching a map unless some thread is inside a traced
+ * function.
+ */
+#include <linux/types.h>
+#include <linux/bpf.h>
+#include <linux/ptrace.h>
+#include <bpf/bpf_helpers.h>
+#include <bpf/bpf_tracing.h>
+#include <bpf/bpf_core_read.h>
+#include "sculltop.h"
+
+/*
+ * The only kernel types looked into. There is no vmlinux.h in this
+ * layer; CO-RE relocates these fields against the running kernel's BTF.
+ */
+struct inode {
+	__u32 i_rdev;
+} __attribute__((preserve_access_index));
+
+struct file {
+	struct inode *f_inode;
+} __attribute__((preserve_access_index));
+
+const volatile __u32 targ_tgid = 0;
+
+/*
+ * Threads inside a traced function. A thread that dies halfway through
+ * one leaves it high, which only costs the lookups it saves.
+ */
+__s64 inside = 0;
+
+/* what a thread is in the middle of; calls nest (read -> follow) */
+struct task_state {
+	__u64 start[FN_MAX];
+	__u64 sem_ns[FN_MAX];
+	__u64 sem_start;
+	__s32 outer[FN_MAX];
+	__s32 cur;		/* innermost traced function, or -1 */
+	__u32 dev;
+};
+
+/* LRU, so threads that die halfway through a call don't pile up */
+struct {
+	__uint(type, BPF_MAP_TYPE_LRU_HASH);
+	__uint(max_entries, 10240);
+	__type(key, __u32);
+	__type(value, struct task_state);
+} tasks SEC(".maps");
+
+struct {
+	__uint(type, BPF_MAP_TYPE_PERCPU_HASH);
+	__uint(max_entries, 4096);
+	__type(key, struct scull_key);
+	__type(value, struct scull_stat);
+} stats SEC(".maps");
+
+static struct task_state zero_task = { .cur = -1 };
+static struct scull_stat zero_stat;
+
+static __always_inline __u32 log2l(__u64 v)
+{
+	__u32 r = 0, shift;
+
+	shift = (v > 0xffffffff) << 5; v >>= shift; r |= shift;
+	shift = (v > 0xffff) << 4; v >>= shift; r |= shift;
+	shift = (v > 0xff) << 3; v >>= shift; r |= shift;
+	shift = (v > 0xf) << 2; v >>= shift; r |= shift;
+	shift = (v > 0x3) << 1; v >>= shift; r |= shift;
+	r |= (v >> 1);
+	return r;
+}
+
+static __always_inline int enter(int fn, struct file *filp)
+{
+	__u64 id = bpf_get_current_pid_tgid();
+	__u32 tid = (__u32)id;
+	struct task_state *ts;
+
+	if (targ_tgid && (id >> 32) != targ_tgid)
+		return 0;
+	ts = bpf_map_lookup_elem(&tasks, &tid);
+	if (!ts) {
+		bpf_map_update_elem(&tasks, &tid, &zero_task, BPF_NOEXIST);
+		ts = bpf_map_lookup_elem(&tasks, &tid);
+		if (!ts)
+			return 0;
+	}
+	if (filp)
+		ts->dev = BPF_CORE_READ(filp, f_inode, i_rdev);
+	else if (ts->cur < 0)
+		ts->dev = 0; /* not called from a traced file operation */
+	ts->start[fn] = bpf_ktime_get_ns();
+	ts->sem_ns[fn] = 0;
+	ts->outer[fn] = ts->cur;
+	if (ts->cur < 0)
+		__sync_fetch_and_add(&inside, 1);
+	ts->cur = fn;
+	return 0;
+}
+
+static __always_inline int leave(int fn, long ret, int has_bytes)
+{
+	__u32 tid = (__u32)bpf_get_current_pid_tgid();
+	struct scull_key key = { .fn = fn };
+	struct scull_stat *st;
+	struct task_state *ts;
+	__u64 delta, sem;
+	__s32 outer;
+	__u32 slot;
+
+	ts = bpf_map_lookup_elem(&tasks, &tid);
+	if (!ts || !ts->start[fn])
+		return 0;
+	delta = bpf_ktime_get_ns() - ts->start[fn];
+	ts->start[fn] = 0;
+	sem = ts->sem_ns[fn];
+	outer = ts->outer[fn];
+	ts->cur = outer;
+	if (outer < 0)
+		__sync_fetch_and_add(&inside, -1);
+	/* the caller waited for the semaphore as well */
+	if (outer >= 0 && outer < FN_MAX)
+		ts->sem_ns[outer] += sem;
+
+	key.dev = ts->dev;
+	bpf_get_current_comm(&key.comm, sizeof(key.comm));
+	st = bpf_map_lookup_elem(&stats, &key);
+	if (!st) {
+		bpf_map_update_elem(&stats, &key, &zero_stat, BPF_NOEXIST);
+		st = bpf_map_lookup_elem(&stats, &key);
+		if (!st)
+			return 0;
+	}
+	st->ops++;
+	if (ret < 0)
+		st->errors++;
+	else if (has_bytes)
+		st->bytes += ret;
+	st->lat_ns += delta;
+	st->sem_ns += sem;
+	slot = log2l(delta);
+	if (slot >= HIST_SLOTS)
+		slot = HIST_SLOTS - 1;
+	st->hist[slot]++;
+	return 0;
+}
+
+static __always_inline int sem_enter(void)
+{
+	__u64 id = bpf_get_current_pid_tgid();
+	__u32 tid = (__u32)id;
+	struct task_state *ts;
+
+	/* most callers are nothing to do with scull: no map work for them */
+	if (!*(volatile __s64 *)&inside)
+		return 0;
+	if (targ_tgid && (id >> 32) != targ_tgid)
+		return 0;
+	ts = bpf_map_lookup_elem(&tasks, &tid);
+	if (ts && ts->cur >= 0)
+		ts->sem_start = bpf_ktime_get_ns();
+	return 0;
+}
+
+static __always_inline int sem_leave(void)
+{
+	__u64 id = bpf_get_current_pid_tgid();
+	__u32 tid = (__u32)id;
+	struct task_state *ts;
+	__s32 cur;
+
+	if (!*(volatile __s64 *)&inside)
+		return 0;
+	if (targ_tgid && (id >> 32) != targ_tgid)
+		return 0;
+	ts = bpf_map_lookup_elem(&tasks, &tid);
+	if (!ts || !ts->sem_start)
+		return 0;
+	cur = ts->cur;
+	if (cur >= 0 && cur < FN_MAX)
+		ts->sem_ns[cur] += bpf_ktime_get_ns() - ts->sem_start;
+	ts->sem_start = 0;
+	return 0;
+}
+
+/* fentry/fexit: cheapest, needs BTF for the scullp module */
+
+SEC("fentry/scull_read")
+int BPF_PROG(fentry_read, struct file *filp)
+{
+	return enter(FN_READ, filp);
+}
+
+SEC("fexit/scull_read")
+int BPF_PROG(fexit_read, struct file *filp, char *buf, size_t count, void *f_pos, long ret)
+{
+	return leave(FN_READ, ret, 1);
+}
+
+SEC("fentry/scull_write")
+int BPF_PROG(fentry_write, struct file *filp)
+{
+	return enter(FN_WRITE, filp);
+}
+
+SEC("fexit/scull_write")
+int BPF_PROG(fexit_write, struct file *filp, const char *buf, size_t count, void *f_pos, long ret)
+{
+	return leave(FN_WRITE, ret, 1);
+}
+
+SEC("fentry/scull_p_read")
+int BPF_PROG(fentry_p_read, struct file *filp)
+{
+	return enter(FN_P_READ, filp);
+}
+
+SEC("fexit/scull_p_read")
+int BPF_PROG(fexit_p_read, struct file *filp, char *buf, size_t count, void *f_pos, long ret)
+{
+	return leave(FN_P_READ, ret, 1);
+}
+
+SEC("fentry/scull_getwritespace")
+int BPF_PROG(fentry_getwritespace, void *dev, void *ring, struct file *filp)
+{
+	return enter(FN_GETWRITESPACE, filp);
+}
+
+SEC("fexit/scull_getwritespace")
+int BPF_PROG(fexit_getwritespace, void *dev, void *ring, struct file *filp, size_t need, int ret)
+{
+	return leave(FN_GETWRITESPACE, ret, 0);
+}
+
+/* no file here: it counts against the device of the read or write around it */
+SEC("fentry/scull_follow")
+int BPF_PROG(fentry_follow)
+{
+	return enter(FN_FOLLOW, NULL);
+}
+
+SEC("fexit/scull_follow")
+int BPF_PROG(fexit_follow)
+{
+	return leave(FN_FOLLOW, 0, 0);
+}
+
+SEC("fentry/down_interruptible")
+int BPF_PROG(fentry_down)
+{
+	return sem_enter();
+}
+
+SEC("fexit/down_interruptible")
+int BPF_PROG(fexit_down)
+{
+	return sem_leave();
+}
+
+/* kprobes: the same, for kernels without module BTF or trampolines */
+
+SEC("kprobe/scull_read")
+int BPF_KPROBE(kprobe_read, struct file *filp)
+{
+	return enter(FN_READ, filp);
+}
+
+SEC("kretprobe/scull_read")
+int BPF_KRETPROBE(kretprobe_read, long ret)
+{
+	return leave(FN_READ, ret, 1);
+}
+
+SEC("kprobe/scull_write")
+int BPF_KPROBE(kprobe_write, struct file *filp)
+{
+	return enter(FN_WRITE, filp);
+}
+
+SEC("kretprobe/scull_write")
+int BPF_KRETPROBE(kretprobe_write, long ret)
+{
+	return leave(FN_WRITE, ret, 1);
+}
+
+SEC("kprobe/scull_p_read")
+int BPF_KPROBE(kprobe_p_read, struct file *filp)
+{
+	return enter(FN_P_READ, filp);
+}
+
+SEC("kretprobe/scull_p_read")
+int BPF_KRETPROBE(kretprobe_p_read, long ret)
+{
+	return leave(FN_P_READ, ret, 1);
+}
+
+SEC("kprobe/scull_getwritespace")
+int BPF_KPROBE(kprobe_getwritespace, void *dev, void *ring, struct file *filp)
+{
+	return enter(FN_GETWRITESPACE, filp);
+}
+
+SEC("kretprobe/scull_getwritespace")
+int BPF_KRETPROBE(kretprobe_getwritespace, int ret)
+{
+	return leave(FN_GETWRITESPACE, ret, 0);
+}
+
+SEC("kprobe/scull_follow")
+int BPF_KPROBE(kprobe_follow)
+{
+	return enter(FN_FOLLOW, NULL);
+}
+
+SEC("kretprobe/scull_follow")
+int BPF_KRETPROBE(kretprobe_follow)
+{
+	return leave(FN_FOLLOW, 0, 0);
+}
+
+SEC("kprobe/down_interruptible")
+int BPF_KPROBE(kprobe_down)
+{
+	return sem_enter();
+}
+
+SEC("kretprobe/down_interruptible")
+int BPF_KRETPROBE(kretprobe_down)
+{
+	return sem_leave();
+}
+
+/* fentry and fexit programs must be GPL compatible */
+char LICENSE[] SEC("license") = "Dual MIT/GPL";
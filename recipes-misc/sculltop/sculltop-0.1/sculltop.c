@@ -0,0 +1,446 @@
+/*
+ * sculltop: a live view of where time goes in the scull devices. It
+ * traces scull_read, scull_write, scull_p_read, scull_getwritespace and
+ * scull_follow with eBPF (fentry/fexit, or kprobes where the kernel
+ * can't) and shows, per device and per process, ops/s, KB/s, latency
+ * and the time spent waiting for the device semaphore.
+ *
+ * The BPF side keeps per-CPU running totals; every interval this side
+ * reads them, subtracts what it saw last time and prints the rows with
+ * the most calls. Nothing is passed per event, so it can stay on.
+ */
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<errno.h>
+#include<signal.h>
+#include<stdarg.h>
+#include<time.h>
+#include<unistd.h>
+#include<sys/resource.h>
+#include<bpf/libbpf.h>
+#include<bpf/bpf.h>
+#include "sculltop.h"
+#include "sculltop.skel.h"
+
+static const char *fn_syms[FN_MAX] = {
+	[FN_READ] = "scull_read",
+	[FN_WRITE] = "scull_write",
+	[FN_P_READ] = "scull_p_read",
+	[FN_GETWRITESPACE] = "scull_getwritespace",
+	[FN_FOLLOW] = "scull_follow",
+};
+
+struct opts {
+	double interval;
+	int count;		/* updates before exiting, 0 for no limit */
+	int batch;		/* append instead of redrawing */
+	int hist;
+	int rows;
+	int kprobes;		/* don't even try fentry */
+	int verbose;
+	int fold;		/* 'd': one row per device, 'c': one per comm */
+	pid_t pid;
+};
+
+static volatile sig_atomic_t stop;
+static int verbose, probing;
+
+/* the totals seen last time, to diff against */
+#define NSLOTS 8192
+static struct prev {
+	struct scull_key key;
+	struct scull_stat total;
+	int used;
+} prev[NSLOTS];
+
+struct row {
+	struct scull_key key;
+	struct scull_stat d;
+};
+static struct row rows[NSLOTS];
+static int nrows;
+
+/* character device majors, from /proc/devices */
+static char *majors[4096];
+
+static void sig_stop(int sig)
+{
+	(void)sig;
+	stop = 1;
+}
+
+static int print_libbpf(enum libbpf_print_level level, const char *fmt, va_list ap)
+{
+	if(level == LIBBPF_DEBUG && !verbose)
+		return 0;
+	if(probing && !verbose)
+		return 0; /* a failed fentry load is expected on some kernels */
+	return vfprintf(stderr, fmt, ap);
+}
+
+static void read_majors(void)
+{
+	FILE *f = fopen("/proc/devices", "r");
+	char line[128], name[64];
+	int major;
+
+	if(!f)
+		return;
+	while(fgets(line, sizeof(line), f)){
+		if(!strncmp(line, "Block", 5))
+			break;
+		if(sscanf(line, "%d %63s", &major, name) == 2 && major >= 0 && major < 4096)
+			majors[major] = strdup(name);
+	}
+	fclose(f);
+}
+
+/*
+ * Is sym a function of the scullp module? A static function the
+ * compiler inlined, or cloned into sym.isra.0 with other arguments,
+ * can't be traced and is left out.
+ */
+static int present(const char *sym)
+{
+	FILE *f = fopen("/proc/kallsyms", "r");
+	char line[256], name[128], mod[64];
+	int found = 0;
+
+	if(!f)
+		return 0;
+	while(!found && fgets(line, sizeof(line), f))
+		if(sscanf(line, "%*s %*s %127s %63s", name, mod) == 2)
+			found = !strcmp(name, sym) && !strcmp(mod, "[scullp]");
+	fclose(f);
+	return found;
+}
+
+static struct sculltop_bpf *open_load(const struct opts *o, const int *avail, int fentry)
+{
+	struct sculltop_bpf *skel = sculltop_bpf__open();
+	struct bpf_program *progs[FN_MAX + 1][4];
+	int fn, i;
+
+	if(!skel)
+		return NULL;
+#define PROGS(fn, name) do { \
+		progs[fn][0] = skel->progs.fentry_##name; \
+		progs[fn][1] = skel->progs.fexit_##name; \
+		progs[fn][2] = skel->progs.kprobe_##name; \
+		progs[fn][3] = skel->progs.kretprobe_##name; \
+	} while(0)
+	PROGS(FN_READ, read);
+	PROGS(FN_WRITE, write);
+	PROGS(FN_P_READ, p_read);
+	PROGS(FN_GETWRITESPACE, getwritespace);
+	PROGS(FN_FOLLOW, follow);
+	PROGS(FN_MAX, down);
+#undef PROGS
+	for(fn = 0; fn <= FN_MAX; fn++){
+		int on = fn == FN_MAX || avail[fn];
+
+		for(i = 0; i < 4; i++)
+			bpf_program__set_autoload(progs[fn][i], on && (i < 2) == fentry);
+	}
+	skel->rodata->targ_tgid = o->pid;
+
+	probing = fentry;
+	if(sculltop_bpf__load(skel)){
+		probing = 0;
+		sculltop_bpf__destroy(skel);
+		return NULL;
+	}
+	probing = 0;
+	return skel;
+}
+
+static unsigned int key_hash(const struct scull_key *k)
+{
+	const unsigned char *p = (const unsigned char *)k;
+	unsigned int h = 2166136261u;
+	size_t i;
+
+	for(i = 0; i < sizeof(*k); i++)
+		h = (h ^ p[i]) * 16777619u;
+	return h;
+}
+
+static struct prev *prev_slot(const struct scull_key *k)
+{
+	unsigned int h = key_hash(k), i;
+	struct prev *p;
+
+	for(i = 0; i < NSLOTS; i++){
+		p = &prev[(h + i) % NSLOTS];
+		if(!p->used){
+			p->used = 1;
+			p->key = *k;
+			return p;
+		}
+		if(!memcmp(&p->key, k, sizeof(*k)))
+			return p;
+	}
+	return NULL;
+}
+
+static void add_row(const struct scull_key *k, const struct scull_stat *d)
+{
+	struct row *r;
+	int i;
+
+	for(i = 0; i < nrows; i++)
+		if(!memcmp(&rows[i].key, k, sizeof(*k)))
+			break;
+	if(i == nrows){
+		if(nrows == NSLOTS)
+			return;
+		memset(&rows[nrows], 0, sizeof(rows[nrows]));
+		rows[nrows++].key = *k;
+	}
+	r = &rows[i];
+	r->d.ops += d->ops;
+	r->d.bytes += d->bytes;
+	r->d.errors += d->errors;
+	r->d.lat_ns += d->lat_ns;
+	r->d.sem_ns += d->sem_ns;
+	for(i = 0; i < HIST_SLOTS; i++)
+		r->d.hist[i] += d->hist[i];
+}
+
+/* turn the per-CPU totals into this interval's rows */
+static int collect(int fd, int ncpus, const struct opts *o)
+{
+	struct scull_stat *percpu, sum, d;
+	struct scull_key key, next, *cur = NULL;
+	struct prev *p;
+	int cpu, i;
+
+	percpu = calloc(ncpus, sizeof(*percpu));
+	if(!percpu)
+		return -1;
+	nrows = 0;
+	while(bpf_map_get_next_key(fd, cur, &next) == 0){
+		key = next;
+		cur = &key;
+		if(bpf_map_lookup_elem(fd, &key, percpu))
+			continue;
+		memset(&sum, 0, sizeof(sum));
+		for(cpu = 0; cpu < ncpus; cpu++){
+			sum.ops += percpu[cpu].ops;
+			sum.bytes += percpu[cpu].bytes;
+			sum.errors += percpu[cpu].errors;
+			sum.lat_ns += percpu[cpu].lat_ns;
+			sum.sem_ns += percpu[cpu].sem_ns;
+			for(i = 0; i < HIST_SLOTS; i++)
+				sum.hist[i] += percpu[cpu].hist[i];
+		}
+		p = prev_slot(&key);
+		if(!p)
+			continue;
+		d.ops = sum.ops - p->total.ops;
+		d.bytes = sum.bytes - p->total.bytes;
+		d.errors = sum.errors - p->total.errors;
+		d.lat_ns = sum.lat_ns - p->total.lat_ns;
+		d.sem_ns = sum.sem_ns - p->total.sem_ns;
+		for(i = 0; i < HIST_SLOTS; i++)
+			d.hist[i] = sum.hist[i] - p->total.hist[i];
+		p->total = sum;
+		if(!d.ops)
+			continue;
+		if(o->fold == 'd')
+			memset(key.comm, 0, sizeof(key.comm));
+		else if(o->fold == 'c')
+			key.dev = 0;
+		add_row(&key, &d);
+	}
+	free(percpu);
+	return 0;
+}
+
+static int by_ops(const void *a, const void *b)
+{
+	const struct row *ra = a, *rb = b;
+
+	if(ra->d.ops != rb->d.ops)
+		return ra->d.ops < rb->d.ops ? 1 : -1;
+	return 0;
+}
+
+/* upper end of the log2 bucket holding the p-th fraction, in microseconds */
+static double pct(const struct scull_stat *s, double p)
+{
+	unsigned long long seen = 0, want = s->ops * p;
+	int i;
+
+	for(i = 0; i < HIST_SLOTS; i++){
+		seen += s->hist[i];
+		if(seen > want)
+			break;
+	}
+	return (double)(2ULL << i) / 1e3;
+}
+
+static const char *dev_name(__u32 dev, char *buf, size_t len)
+{
+	unsigned int major = dev >> 20, minor = dev & 0xfffff;
+
+	if(!dev)
+		return "-";
+	if(major < 4096 && majors[major])
+		snprintf(buf, len, "%s%u", majors[major], minor);
+	else
+		snprintf(buf, len, "%u:%u", major, minor);
+	return buf;
+}
+
+static void print_hist(const struct scull_stat *s)
+{
+	unsigned long long top = 0;
+	int i, lo = -1, hi = 0;
+
+	for(i = 0; i < HIST_SLOTS; i++){
+		if(!s->hist[i])
+			continue;
+		if(lo < 0)
+			lo = i;
+		hi = i;
+		if(s->hist[i] > top)
+			top = s->hist[i];
+	}
+	for(i = lo; lo >= 0 && i <= hi; i++)
+		printf("    %10llu -> %-10llu ns : %-10llu |%-40.*s|\n",
+		       i ? 1ULL << i : 0ULL, (2ULL << i) - 1, (unsigned long long)s->hist[i],
+		       (int)(s->hist[i] * 40 / top), "****************************************");
+}
+
+static void show(const struct opts *o, double secs, int fentry)
+{
+	char when[16], name[32];
+	time_t t = time(NULL);
+	int i;
+
+	strftime(when, sizeof(when), "%H:%M:%S", localtime(&t));
+	if(o->batch)
+		printf("\n");
+	else
+		printf("\033[H\033[J");
+	printf("sculltop - %s  %s  %d rows  %.1fs\n\n", when, fentry ? "fentry" : "kprobe", nrows, secs);
+	printf("%-12s %-20s %-16s %9s %10s %9s %9s %9s %9s %7s\n", "DEVICE", "FUNC", "COMM",
+	       "OPS/s", "KB/s", "AVG_us", "P50_us", "P99_us", "SEM_us", "ERR/s");
+	qsort(rows, nrows, sizeof(rows[0]), by_ops);
+	for(i = 0; i < nrows && i < o->rows; i++){
+		struct row *r = &rows[i];
+
+		printf("%-12s %-20s %-16s %9.0f %10.1f %9.1f %9.1f %9.1f %9.1f %7.0f\n",
+		       dev_name(r->key.dev, name, sizeof(name)), fn_syms[r->key.fn % FN_MAX],
+		       r->key.comm[0] ? r->key.comm : "-",
+		       r->d.ops / secs, r->d.bytes / secs / 1024,
+		       r->d.lat_ns / 1e3 / r->d.ops, pct(&r->d, 0.5), pct(&r->d, 0.99),
+		       r->d.sem_ns / 1e3 / r->d.ops, r->d.errors / secs);
+		if(o->hist)
+			print_hist(&r->d);
+	}
+	fflush(stdout);
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [-i secs] [-n count] [-r rows] [-p pid] [-b] [-H] [-d | -c] [-k] [-v]\n"
+		"  -b  batch mode: append each update instead of redrawing\n"
+		"  -H  print the latency histogram under each row\n"
+		"  -d  one row per device and function, all processes together\n"
+		"  -c  one row per process and function, all devices together\n"
+		"  -k  use kprobes even where fentry works\n", prog);
+}
+
+int main(int argc, char **argv)
+{
+	struct opts o = { .interval = 1, .rows = 20 };
+	struct rlimit rl = { RLIM_INFINITY, RLIM_INFINITY };
+	struct sculltop_bpf *skel = NULL;
+	int avail[FN_MAX], fn, any = 0, opt, fentry, ncpus, n;
+	double t0, t;
+
+	while((opt = getopt(argc, argv, "i:n:r:p:bHdckv")) != -1){
+		switch(opt){
+		case 'i': o.interval = atof(optarg); break;
+		case 'n': o.count = atoi(optarg); break;
+		case 'r': o.rows = atoi(optarg); break;
+		case 'p': o.pid = atoi(optarg); break;
+		case 'b': o.batch = 1; break;
+		case 'H': o.hist = 1; break;
+		case 'd': case 'c': o.fold = opt; break;
+		case 'k': o.kprobes = 1; break;
+		case 'v': o.verbose = 1; break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	if(o.interval <= 0 || o.rows <= 0){
+		usage(argv[0]);
+		return 1;
+	}
+	verbose = o.verbose;
+	libbpf_set_print(print_libbpf);
+	setrlimit(RLIMIT_MEMLOCK, &rl); /* older kernels charge maps to it */
+
+	for(fn = 0; fn < FN_MAX; fn++){
+		avail[fn] = present(fn_syms[fn]);
+		any |= avail[fn];
+		if(!avail[fn])
+			fprintf(stderr, "sculltop: %s is not a traceable scullp symbol, skipping it\n", fn_syms[fn]);
+	}
+	if(!any){
+		fprintf(stderr, "sculltop: is the scullp module loaded?\n");
+		return 1;
+	}
+	read_majors();
+
+	fentry = !o.kprobes;
+	if(fentry)
+		skel = open_load(&o, avail, 1);
+	if(!skel){
+		fentry = 0;
+		skel = open_load(&o, avail, 0);
+	}
+	if(!skel){
+		fprintf(stderr, "sculltop: failed to load the BPF programs (root? BTF?)\n");
+		return 1;
+	}
+	if(sculltop_bpf__attach(skel)){
+		fprintf(stderr, "sculltop: failed to attach: %s\n", strerror(errno));
+		sculltop_bpf__destroy(skel);
+		return 1;
+	}
+	ncpus = libbpf_num_possible_cpus();
+	if(ncpus <= 0){
+		sculltop_bpf__destroy(skel);
+		return 1;
+	}
+
+	signal(SIGINT, sig_stop);
+	signal(SIGTERM, sig_stop);
+	t0 = now();
+	for(n = 0; !stop && (!o.count || n < o.count); n++){
+		struct timespec ts = { (time_t)o.interval, (long)((o.interval - (time_t)o.interval) * 1e9) };
+
+		nanosleep(&ts, NULL);
+		t = now();
+		if(collect(bpf_map__fd(skel->maps.stats), ncpus, &o))
+			break;
+		show(&o, t - t0, fentry);
+		t0 = t;
+	}
+	sculltop_bpf__destroy(skel);
+	return 0;
+}
@@ -0,0 +1,37 @@
+#ifndef _SCULLTOP_H_
+#define _SCULLTOP_H_
+
+/* shared by sculltop.bpf.c and sculltop.c */
+#include <linux/types.h>
+
+enum {
+	FN_READ,		/* scull_read */
+	FN_WRITE,		/* scull_write */
+	FN_P_READ,		/* scull_p_read */
+	FN_GETWRITESPACE,	/* scull_getwritespace */
+	FN_FOLLOW,		/* scull_follow */
+	FN_MAX
+};
+
+/* log2 buckets of nanoseconds, the last one takes everything above 2^31 */
+#define HIST_SLOTS 32
+
+#define COMM_LEN 16
+
+struct scull_key {
+	__u32 dev;		/* the kernel's dev_t: major << 20 | minor */
+	__u32 fn;
+	char comm[COMM_LEN];
+};
+
+/* running totals, one copy per CPU */
+struct scull_stat {
+	__u64 ops;
+	__u64 bytes;
+	__u64 errors;
+	__u64 lat_ns;
+	__u64 sem_ns;		/* spent in down_interruptible() */
+	__u64 hist[HIST_SLOTS];
+};
+
+#endif /* _SCULLTOP_H_ */
@@ -0,0 +1,419 @@
+/*
+ * scullbench: throughput and latency of the scull_char memory devices.
+ * For every access pattern, block size and thread count asked for, the
+ * threads move a fixed amount of data through the device with pread()
+ * and pwrite(), each on its own file descriptor, and one CSV line (or
+ * JSON object) is printed with MB/s, ops/s and latency percentiles.
+ *
+ * Sequential threads each walk their own slice of the region; random
+ * threads pick block aligned offsets anywhere in it. The region is
+ * written once before the first read pattern so reads never hit holes.
+ *
+ * With -B the results are compared with an earlier CSV run: a row whose
+ * MB/s dropped, or whose p99 grew, by more than -r percent is reported
+ * on stderr and the exit status is 2.
+ */
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<errno.h>
+#include<fcntl.h>
+#include<unistd.h>
+#include<pthread.h>
+#include<time.h>
+#include<stdint.h>
+#include<sys/ioctl.h>
+#include<scull/scull_ioctl.h>
+
+enum { SEQREAD, SEQWRITE, RANDREAD, RANDWRITE, NPATTERNS };
+
+static const char *pattern_names[NPATTERNS] = {
+	"seqread", "seqwrite", "randread", "randwrite",
+};
+
+struct run {
+	const char *dev;
+	int pattern;
+	size_t block;
+	int nthreads;
+	off_t offset;			/* start of the region */
+	unsigned long long span;	/* bytes in the region */
+	unsigned long long ops;		/* operations per thread */
+	int err;
+};
+
+struct worker {
+	struct run *r;
+	int id;
+	uint64_t *lat;			/* ns per operation */
+	unsigned long long nops;
+};
+
+struct result {
+	char key[96];			/* pattern,block,threads,quantum,qset */
+	double mbs, p99;
+};
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static unsigned long long parse_size(const char *s)
+{
+	char *end;
+	unsigned long long v = strtoull(s, &end, 0);
+
+	switch(*end){
+	case 'k': case 'K': v <<= 10; break;
+	case 'm': case 'M': v <<= 20; break;
+	case 'g': case 'G': v <<= 30; break;
+	}
+	return v;
+}
+
+/* xorshift64*, one state per thread */
+static uint64_t next_rand(uint64_t *state)
+{
+	uint64_t x = *state;
+
+	x ^= x >> 12;
+	x ^= x << 25;
+	x ^= x >> 27;
+	*state = x;
+	return x * 0x2545f4914f6cdd1dULL;
+}
+
+/* scull stops every transfer at the end of a quantum: loop until done */
+static int transfer(int fd, char *buf, size_t len, off_t pos, int writing)
+{
+	ssize_t ret;
+	size_t done = 0;
+
+	while(done < len){
+		if(writing)
+			ret = pwrite(fd, buf + done, len - done, pos + done);
+		else
+			ret = pread(fd, buf + done, len - done, pos + done);
+		if(ret < 0){
+			if(errno == EINTR)
+				continue;
+			return -errno;
+		}
+		if(ret == 0)
+			return -EIO; /* a hole or the end of the device */
+		done += ret;
+	}
+	return 0;
+}
+
+static void *worker(void *arg)
+{
+	struct worker *w = arg;
+	struct run *r = w->r;
+	int writing = r->pattern == SEQWRITE || r->pattern == RANDWRITE;
+	int random = r->pattern == RANDREAD || r->pattern == RANDWRITE;
+	unsigned long long nblocks = r->span / r->block;
+	unsigned long long slice = nblocks / r->nthreads, blk, i;
+	uint64_t seed = 0x9e3779b97f4a7c15ULL * (w->id + 1), t0;
+	char *buf = malloc(r->block);
+	int fd, ret;
+
+	fd = open(r->dev, writing ? O_WRONLY : O_RDONLY);
+	if(fd < 0 || !buf){
+		__atomic_store_n(&r->err, fd < 0 ? errno : ENOMEM, __ATOMIC_RELAXED);
+		goto out;
+	}
+	memset(buf, 0x5a, r->block);
+	for(i = 0; i < r->ops && !r->err; i++){
+		if(random)
+			blk = next_rand(&seed) % nblocks;
+		else
+			blk = w->id * slice + i % slice;
+		t0 = now_ns();
+		ret = transfer(fd, buf, r->block, r->offset + blk * r->block, writing);
+		w->lat[i] = now_ns() - t0;
+		if(ret){
+			__atomic_store_n(&r->err, -ret, __ATOMIC_RELAXED);
+			break;
+		}
+	}
+	w->nops = i;
+	close(fd);
+  out:
+	free(buf);
+	return NULL;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static double percentile(uint64_t *sorted, unsigned long long n, double p)
+{
+	unsigned long long i = (unsigned long long)(p * n);
+
+	if(n == 0)
+		return 0;
+	if(i >= n)
+		i = n - 1;
+	return sorted[i] / 1e3;
+}
+
+/* fill the region so that reads find data everywhere */
+static int prefill(const char *dev, off_t offset, unsigned long long span)
+{
+	size_t chunk = 64 * 1024;
+	char *buf = malloc(chunk);
+	unsigned long long done;
+	int fd, ret = 0;
+
+	fd = open(dev, O_WRONLY);
+	if(fd < 0 || !buf){
+		free(buf);
+		return -1;
+	}
+	memset(buf, 0xa5, chunk);
+	for(done = 0; done < span && !ret; done += chunk){
+		if(chunk > span - done)
+			chunk = span - done;
+		ret = transfer(fd, buf, chunk, offset + done, 1);
+	}
+	close(fd);
+	free(buf);
+	return ret;
+}
+
+static int load_baseline(const char *path, struct result **out)
+{
+	char line[512], key[96];
+	struct result *res = NULL;
+	int n = 0, field;
+	char *tok, *save;
+	FILE *f = fopen(path, "r");
+
+	if(!f)
+		return -1;
+	while(fgets(line, sizeof(line), f)){
+		struct result cur = { .mbs = -1, .p99 = -1 };
+
+		if(strncmp(line, "pattern,", 8) == 0)
+			continue;
+		key[0] = '\0';
+		for(field = 0, tok = strtok_r(line, ",\n", &save); tok;
+		    field++, tok = strtok_r(NULL, ",\n", &save)){
+			if(field < 5){
+				strncat(key, tok, sizeof(key) - strlen(key) - 2);
+				if(field < 4)
+					strcat(key, ",");
+			} else if(field == 7){
+				cur.mbs = atof(tok);
+			} else if(field == 10){
+				cur.p99 = atof(tok);
+			}
+		}
+		if(field < 11)
+			continue;
+		snprintf(cur.key, sizeof(cur.key), "%s", key);
+		res = realloc(res, (n + 1) * sizeof(*res));
+		if(!res)
+			break;
+		res[n++] = cur;
+	}
+	fclose(f);
+	*out = res;
+	return res ? n : 0;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [-d device] [-p pattern,...] [-b block,...] [-T threads,...] [-o offset]\n"
+		"          [-S span] [-n total] [-q quantum] [-Q qset] [-j] [-B baseline.csv] [-r percent]\n"
+		"  -d  device (default /dev/scull_char0)\n"
+		"  -p  patterns: seqread, seqwrite, randread, randwrite (default all)\n"
+		"  -b  bytes per operation (default 4k)\n"
+		"  -T  thread counts (default 1)\n"
+		"  -o  start of the region in the device (default 0)\n"
+		"  -S  bytes in the region (default 16m)\n"
+		"  -n  bytes to move per run (default 64m)\n"
+		"  -q  quantum size, -Q quanta per set: empty the device and set its geometry\n"
+		"  -j  print JSON instead of CSV\n"
+		"  -B  compare with an earlier CSV run and flag regressions\n"
+		"  -r  regression threshold in percent (default 10)\n", prog);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	struct run r = { .dev = "/dev/scull_char0" };
+	char patterns[256] = "seqread,seqwrite,randread,randwrite";
+	char blocks[256] = "4k", threads[256] = "1";
+	unsigned long long total = 64ULL << 20;
+	long quantum = 0, qset = 0;
+	int opt, fd, json = 0, first = 1, prefilled = 0, nbase = 0, regressions = 0;
+	double threshold = 10;
+	const char *basepath = NULL;
+	struct result *base = NULL;
+	char plist[256], blist[256], tlist[256];
+	char *ptok, *btok, *ttok, *psave, *bsave, *tsave;
+
+	r.span = 16ULL << 20;
+	while((opt = getopt(argc, argv, "d:p:b:T:o:S:n:q:Q:jB:r:h")) != -1){
+		switch(opt){
+		case 'd': r.dev = optarg; break;
+		case 'p': snprintf(patterns, sizeof(patterns), "%s", optarg); break;
+		case 'b': snprintf(blocks, sizeof(blocks), "%s", optarg); break;
+		case 'T': snprintf(threads, sizeof(threads), "%s", optarg); break;
+		case 'o': r.offset = parse_size(optarg); break;
+		case 'S': r.span = parse_size(optarg); break;
+		case 'n': total = parse_size(optarg); break;
+		case 'q': quantum = parse_size(optarg); break;
+		case 'Q': qset = atol(optarg); break;
+		case 'j': json = 1; break;
+		case 'B': basepath = optarg; break;
+		case 'r': threshold = atof(optarg); break;
+		default: usage(argv[0]);
+		}
+	}
+	if(r.span == 0 || total == 0)
+		usage(argv[0]);
+	if(basepath && (nbase = load_baseline(basepath, &base)) < 0){
+		perror(basepath);
+		return 1;
+	}
+
+	/* with a new geometry the device starts out empty */
+	fd = open(r.dev, (quantum || qset) ? O_WRONLY | O_TRUNC : O_RDONLY);
+	if(fd < 0){
+		perror(r.dev);
+		return 1;
+	}
+	if((quantum && ioctl(fd, SCULL_IOCTQUANTUM, quantum) < 0) ||
+	   (qset && ioctl(fd, SCULL_IOCTQSET, qset) < 0)){
+		perror("geometry");
+		return 1;
+	}
+	quantum = ioctl(fd, SCULL_IOCQQUANTUM);
+	qset = ioctl(fd, SCULL_IOCQQSET);
+	close(fd);
+
+	if(json)
+		printf("[");
+	else
+		printf("pattern,block,threads,quantum,qset,bytes,seconds,MB/s,ops/s,p50_us,p99_us,p999_us\n");
+	snprintf(plist, sizeof(plist), "%s", patterns);
+	for(ptok = strtok_r(plist, ",", &psave); ptok; ptok = strtok_r(NULL, ",", &psave)){
+		for(r.pattern = 0; r.pattern < NPATTERNS; r.pattern++)
+			if(strcmp(ptok, pattern_names[r.pattern]) == 0)
+				break;
+		if(r.pattern == NPATTERNS)
+			usage(argv[0]);
+		if(!prefilled && (r.pattern == SEQREAD || r.pattern == RANDREAD)){
+			if(prefill(r.dev, r.offset, r.span)){
+				fprintf(stderr, "%s: can't fill the region\n", r.dev);
+				return 1;
+			}
+			prefilled = 1;
+		}
+
+		snprintf(blist, sizeof(blist), "%s", blocks);
+		for(btok = strtok_r(blist, ",", &bsave); btok; btok = strtok_r(NULL, ",", &bsave)){
+			snprintf(tlist, sizeof(tlist), "%s", threads);
+			for(ttok = strtok_r(tlist, ",", &tsave); ttok; ttok = strtok_r(NULL, ",", &tsave)){
+				unsigned long long nops = 0, bytes;
+				struct worker *w;
+				pthread_t *tids;
+				uint64_t *lat;
+				char key[96];
+				double t0, t, mbs, p50, p99, p999;
+				int i, j;
+
+				r.block = parse_size(btok);
+				r.nthreads = atoi(ttok);
+				r.err = 0;
+				if(r.block == 0 || r.nthreads <= 0 || r.span / r.block < (unsigned)r.nthreads)
+					usage(argv[0]);
+				r.ops = total / r.block / r.nthreads;
+				if(r.ops == 0)
+					r.ops = 1;
+
+				w = calloc(r.nthreads, sizeof(*w));
+				tids = calloc(r.nthreads, sizeof(*tids));
+				lat = malloc(r.nthreads * r.ops * sizeof(*lat));
+				if(!w || !tids || !lat){
+					fprintf(stderr, "out of memory\n");
+					return 1;
+				}
+				t0 = now();
+				for(i = 0; i < r.nthreads; i++){
+					w[i] = (struct worker){ .r = &r, .id = i, .lat = lat + i * r.ops };
+					pthread_create(&tids[i], NULL, worker, &w[i]);
+				}
+				for(i = 0; i < r.nthreads; i++)
+					pthread_join(tids[i], NULL);
+				t = now() - t0;
+				if(r.err){
+					fprintf(stderr, "%s: %s failed: %s\n", r.dev, ptok, strerror(r.err));
+					return 1;
+				}
+
+				/* pack the samples of all threads and sort them */
+				for(i = 0; i < r.nthreads; i++)
+					for(j = 0; j < (int)w[i].nops; j++)
+						lat[nops++] = w[i].lat[j];
+				qsort(lat, nops, sizeof(*lat), cmp_u64);
+				bytes = nops * r.block;
+				mbs = bytes / t / 1e6;
+				p50 = percentile(lat, nops, 0.50);
+				p99 = percentile(lat, nops, 0.99);
+				p999 = percentile(lat, nops, 0.999);
+
+				snprintf(key, sizeof(key), "%s,%zu,%d,%ld,%ld", ptok, r.block, r.nthreads, quantum, qset);
+				if(json)
+					printf("%s\n  {\"pattern\": \"%s\", \"block\": %zu, \"threads\": %d, "
+					       "\"quantum\": %ld, \"qset\": %ld, \"bytes\": %llu, \"seconds\": %.3f, "
+					       "\"mbs\": %.1f, \"ops\": %.0f, \"p50_us\": %.2f, \"p99_us\": %.2f, "
+					       "\"p999_us\": %.2f}", first ? "" : ",", ptok, r.block, r.nthreads,
+					       quantum, qset, bytes, t, mbs, nops / t, p50, p99, p999);
+				else
+					printf("%s,%llu,%.3f,%.1f,%.0f,%.2f,%.2f,%.2f\n", key, bytes, t, mbs,
+					       nops / t, p50, p99, p999);
+				fflush(stdout);
+				first = 0;
+
+				for(i = 0; i < nbase; i++){
+					if(strcmp(base[i].key, key))
+						continue;
+					if(mbs < base[i].mbs * (1 - threshold / 100) ||
+					   p99 > base[i].p99 * (1 + threshold / 100)){
+						fprintf(stderr, "regression: %s: %.1f MB/s (was %.1f), p99 %.2f us (was %.2f)\n",
+							key, mbs, base[i].mbs, p99, base[i].p99);
+						regressions++;
+					}
+				}
+				free(lat);
+				free(tids);
+				free(w);
+			}
+		}
+	}
+	if(json)
+		printf("\n]\n");
+	free(base);
+	return regressions ? 2 : 0;
+}
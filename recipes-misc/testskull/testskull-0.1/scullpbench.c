@@ -0,0 +1,320 @@
+/*
+ * scullpbench: streaming throughput of a scullpipe (or scullmq) device.
+ * For every buffer size and thread count asked for, as many writer as
+ * reader threads move a fixed amount of data through the device, each
+ * thread on its own file descriptor, and one CSV line is printed.
+ * With -m one writer and one reader share the mmap()ed ring instead
+ * and never enter the kernel.
+ */
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<errno.h>
+#include<fcntl.h>
+#include<unistd.h>
+#include<poll.h>
+#include<pthread.h>
+#include<time.h>
+#include<sched.h>
+#include<sys/ioctl.h>
+#include<sys/mman.h>
+#include<scull/scull_ioctl.h>
+
+struct run {
+	const char *dev;
+	size_t block;
+	unsigned long long per_writer;	/* bytes each writer sends */
+	unsigned long long total;	/* bytes the readers wait for */
+	unsigned long long nread;	/* bytes read so far, all readers */
+	int err;
+	struct scull_p_ring_ctrl *ctrl;	/* the mapping, with -m */
+	char *data;
+};
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void fail(struct run *r, int err)
+{
+	__atomic_store_n(&r->err, err, __ATOMIC_RELAXED);
+}
+
+static void *writer(void *arg)
+{
+	struct run *r = arg;
+	unsigned long long done = 0;
+	char *buf = malloc(r->block);
+	ssize_t ret;
+	int fd;
+
+	fd = open(r->dev, O_WRONLY);
+	if(fd < 0 || !buf){
+		fail(r, fd < 0 ? errno : ENOMEM);
+		goto out;
+	}
+	memset(buf, 0x5a, r->block);
+	while(done < r->per_writer && !r->err){
+		size_t n = r->block;
+
+		if(n > r->per_writer - done)
+			n = r->per_writer - done;
+		ret = write(fd, buf, n);
+		if(ret < 0){
+			if(errno == EINTR)
+				continue;
+			fail(r, errno);
+			break;
+		}
+		done += ret;
+	}
+	close(fd);
+  out:
+	free(buf);
+	return NULL;
+}
+
+/*
+ * Readers don't know which of them gets the last byte, so they read
+ * without blocking and poll with a timeout until all data has arrived.
+ */
+static void *reader(void *arg)
+{
+	struct run *r = arg;
+	char *buf = malloc(r->block);
+	struct pollfd pfd;
+	ssize_t ret;
+
+	pfd.fd = open(r->dev, O_RDONLY | O_NONBLOCK);
+	pfd.events = POLLIN;
+	if(pfd.fd < 0 || !buf){
+		fail(r, pfd.fd < 0 ? errno : ENOMEM);
+		goto out;
+	}
+	while(__atomic_load_n(&r->nread, __ATOMIC_RELAXED) < r->total && !r->err){
+		ret = read(pfd.fd, buf, r->block);
+		if(ret < 0){
+			if(errno == EAGAIN || errno == EINTR){
+				poll(&pfd, 1, 100);
+				continue;
+			}
+			fail(r, errno);
+			break;
+		}
+		__atomic_add_fetch(&r->nread, ret, __ATOMIC_RELAXED);
+	}
+	close(pfd.fd);
+  out:
+	free(buf);
+	return NULL;
+}
+
+/* the mmap flavour: one producer moves head, one consumer moves tail */
+static void *ring_writer(void *arg)
+{
+	struct run *r = arg;
+	struct scull_p_ring_ctrl *c = r->ctrl;
+	unsigned long long done = 0;
+	__u32 head = c->head, tail, off;
+	size_t n;
+
+	while(done < r->total){
+		tail = __atomic_load_n(&c->tail, __ATOMIC_ACQUIRE);
+		n = c->size - (head - tail);
+		if(n == 0){
+			sched_yield();
+			continue;
+		}
+		off = head & (c->size - 1);
+		if(n > c->size - off)
+			n = c->size - off; /* up to the end of the data area */
+		if(n > r->block)
+			n = r->block;
+		if(n > r->total - done)
+			n = r->total - done;
+		memset(r->data + off, 0x5a, n);
+		head += n;
+		__atomic_store_n(&c->head, head, __ATOMIC_RELEASE);
+		done += n;
+	}
+	return NULL;
+}
+
+static void *ring_reader(void *arg)
+{
+	struct run *r = arg;
+	struct scull_p_ring_ctrl *c = r->ctrl;
+	char *buf = malloc(r->block);
+	__u32 tail = c->tail, head, off;
+	size_t n;
+
+	if(!buf){
+		fail(r, ENOMEM);
+		return NULL;
+	}
+	while(r->nread < r->total){
+		head = __atomic_load_n(&c->head, __ATOMIC_ACQUIRE);
+		n = head - tail;
+		if(n == 0){
+			sched_yield();
+			continue;
+		}
+		off = tail & (c->size - 1);
+		if(n > c->size - off)
+			n = c->size - off;
+		if(n > r->block)
+			n = r->block;
+		memcpy(buf, r->data + off, n);
+		tail += n;
+		__atomic_store_n(&c->tail, tail, __ATOMIC_RELEASE);
+		r->nread += n;
+	}
+	free(buf);
+	return NULL;
+}
+
+static unsigned long parse_size(const char *s)
+{
+	char *end;
+	unsigned long v = strtoul(s, &end, 0);
+
+	switch(*end){
+	case 'k': case 'K': v <<= 10; break;
+	case 'm': case 'M': v <<= 20; break;
+	case 'g': case 'G': v <<= 30; break;
+	}
+	return v;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [-d device] [-s size,...] [-T threads,...] [-b block] [-n total] [-w lowat] [-m]\n"
+		"  -d  device (default /dev/scullpipe0; /dev/scullmqN works too)\n"
+		"  -s  buffer sizes to try (default: leave the size alone)\n"
+		"  -T  writer/reader thread counts to try (default 1)\n"
+		"  -b  bytes per read()/write() (default 4k)\n"
+		"  -n  bytes to move per run (default 256m)\n"
+		"  -w  reader and writer wakeup watermark in bytes (default 1)\n"
+		"  -m  move the data through the mmap()ed ring (one writer, one reader)\n", prog);
+	exit(1);
+}
+
+static int bench(const char *dev, int holder, long size, int nthreads, size_t block,
+		 unsigned long long total, int use_mmap)
+{
+	struct run r = { .dev = dev, .block = block };
+	pthread_t *tids = calloc(2 * nthreads, sizeof(pthread_t));
+	struct scull_p_ring_ctrl *ctrl = NULL;
+	size_t maplen = 0;
+	double t0, t;
+	int i;
+
+	if(!tids)
+		return -1;
+	r.per_writer = total / nthreads;
+	r.total = r.per_writer * nthreads;
+	if(use_mmap){
+		ctrl = mmap(NULL, getpagesize(), PROT_READ, MAP_SHARED, holder, 0);
+		if(ctrl == MAP_FAILED){
+			perror("mmap");
+			free(tids);
+			return -1;
+		}
+		maplen = ctrl->data_offset + ctrl->size;
+		munmap(ctrl, getpagesize());
+		r.ctrl = mmap(NULL, maplen, PROT_READ | PROT_WRITE, MAP_SHARED, holder, 0);
+		if(r.ctrl == MAP_FAILED){
+			perror("mmap");
+			free(tids);
+			return -1;
+		}
+		r.data = (char *)r.ctrl + r.ctrl->data_offset;
+	}
+
+	t0 = now();
+	for(i = 0; i < nthreads; i++)
+		pthread_create(&tids[i], NULL, use_mmap ? ring_reader : reader, &r);
+	for(i = 0; i < nthreads; i++)
+		pthread_create(&tids[nthreads + i], NULL, use_mmap ? ring_writer : writer, &r);
+	for(i = 0; i < 2 * nthreads; i++)
+		pthread_join(tids[i], NULL);
+	t = now() - t0;
+	free(tids);
+	if(use_mmap)
+		munmap(r.ctrl, maplen);
+
+	if(r.err){
+		fprintf(stderr, "%s: transfer failed: %s\n", dev, strerror(r.err));
+		return -1;
+	}
+	printf("%ld,%d,%zu,%llu,%.3f,%.1f,%.0f\n", size, nthreads, block, r.total, t,
+	       r.total / t / 1e6, r.total / block / t);
+	fflush(stdout);
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	const char *dev = "/dev/scullpipe0";
+	char sizes[256] = "", threads[256] = "1";
+	size_t block = 4096;
+	unsigned long long total = 256ULL << 20;
+	unsigned long lowat = 0;
+	char *stok, *ttok, *ssave, *tsave;
+	int opt, holder, use_mmap = 0;
+
+	while((opt = getopt(argc, argv, "d:s:T:b:n:w:mh")) != -1){
+		switch(opt){
+		case 'd': dev = optarg; break;
+		case 's': snprintf(sizes, sizeof(sizes), "%s", optarg); break;
+		case 'T': snprintf(threads, sizeof(threads), "%s", optarg); break;
+		case 'b': block = parse_size(optarg); break;
+		case 'n': total = parse_size(optarg); break;
+		case 'w': lowat = parse_size(optarg); break;
+		case 'm': use_mmap = 1; break;
+		default: usage(argv[0]);
+		}
+	}
+	if(block == 0 || total == 0)
+		usage(argv[0]);
+	if(use_mmap)
+		snprintf(threads, sizeof(threads), "1"); /* the ring is single producer, single consumer */
+
+	/* keep the device open so its buffers live across runs */
+	holder = open(dev, O_RDWR | O_NONBLOCK);
+	if(holder < 0){
+		perror(dev);
+		return 1;
+	}
+	if(lowat && (ioctl(holder, SCULL_P_IOCTRCVLOWAT, lowat) < 0 ||
+		     ioctl(holder, SCULL_P_IOCTSNDLOWAT, lowat) < 0)){
+		perror("watermarks");
+		return 1;
+	}
+
+	printf("bufsize,threads,block,bytes,seconds,MB/s,ops/s\n");
+	stok = strtok_r(sizes, ",", &ssave);
+	do {
+		char tlist[256];
+		long size;
+
+		if(stok && ioctl(holder, SCULL_P_IOCTSIZE, parse_size(stok)) < 0){
+			fprintf(stderr, "%s: can't set size %s: %s\n", dev, stok, strerror(errno));
+			continue;
+		}
+		size = ioctl(holder, SCULL_P_IOCQSIZE);
+
+		snprintf(tlist, sizeof(tlist), "%s", threads);
+		for(ttok = strtok_r(tlist, ",", &tsave); ttok; ttok = strtok_r(NULL, ",", &tsave))
+			if(atoi(ttok) > 0 && bench(dev, holder, size, atoi(ttok), block, total, use_mmap))
+				return 1;
+	} while(stok && (stok = strtok_r(NULL, ",", &ssave)));
+
+	close(holder);
+	return 0;
+}
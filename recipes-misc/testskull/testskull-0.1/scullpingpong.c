@@ -0,0 +1,527 @@
+/*
+ * scullpingpong: round trip latency and streaming throughput of a
+ * scullpipe against the kernel's own IPC, between two pinned threads.
+ *
+ * Transports: two scullpipe devices (one per direction), pipe(2),
+ * socketpair(AF_UNIX, SOCK_STREAM) and an eventfd doorbell over a shared
+ * memory ring. Each runs in blocking mode, and in poll mode where the
+ * descriptors are non blocking and every wait is a poll().
+ *
+ * For every transport, mode and message size one "rtt" line is printed
+ * with the percentiles and the streaming rate, followed by "hist" lines
+ * with every non empty bucket of the round trip histogram. The buckets
+ * are log-linear: 32 per power of two, so each is within about 3%.
+ */
+#define _GNU_SOURCE
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<errno.h>
+#include<fcntl.h>
+#include<unistd.h>
+#include<poll.h>
+#include<pthread.h>
+#include<sched.h>
+#include<time.h>
+#include<stdint.h>
+#include<sys/mman.h>
+#include<sys/socket.h>
+#include<sys/eventfd.h>
+
+#define SUB_BITS	5
+#define SUB		(1 << SUB_BITS)
+#define NBUCKETS	(2 * SUB + (64 - SUB_BITS - 1) * SUB)
+
+#define SHM_RING	(1 << 20)
+
+/* one direction of a link */
+struct chan {
+	int rfd, wfd;
+	/* eventfd + shm only */
+	char *data;
+	uint32_t *head, *tail;
+	int data_efd, space_efd;
+};
+
+struct transport {
+	const char *name;
+	int (*setup)(struct chan *c, int dir, int nonblock);
+	int (*send)(struct chan *c, const char *buf, size_t n, int use_poll);
+	int (*recv)(struct chan *c, char *buf, size_t n, int use_poll);
+	void (*teardown)(struct chan *c);
+};
+
+struct run {
+	const struct transport *t;
+	struct chan ping, pong;
+	size_t size;
+	int use_poll;
+	unsigned long iters, warmup, nmsgs;
+	int cpu[2];
+	uint64_t *hist;
+	int err;
+};
+
+static const char *scull_dev[2] = { "/dev/scullpipe0", "/dev/scullpipe1" };
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static unsigned long parse_size(const char *s)
+{
+	char *end;
+	unsigned long v = strtoul(s, &end, 0);
+
+	switch(*end){
+	case 'k': case 'K': v <<= 10; break;
+	case 'm': case 'M': v <<= 20; break;
+	}
+	return v;
+}
+
+static int bucket(uint64_t v)
+{
+	int e;
+
+	if(v < 2 * SUB)
+		return v;
+	e = 63 - __builtin_clzll(v);
+	return 2 * SUB + (e - SUB_BITS - 1) * SUB + ((v >> (e - SUB_BITS)) - SUB);
+}
+
+static uint64_t bucket_lo(int b)
+{
+	int e;
+
+	if(b < 2 * SUB)
+		return b;
+	e = (b - 2 * SUB) / SUB + SUB_BITS + 1;
+	return (uint64_t)(SUB + (b - 2 * SUB) % SUB) << (e - SUB_BITS);
+}
+
+static double hist_percentile(uint64_t *hist, uint64_t total, double p)
+{
+	uint64_t seen = 0, want = (uint64_t)(p * total);
+	int b;
+
+	for(b = 0; b < NBUCKETS; b++){
+		seen += hist[b];
+		if(seen > want)
+			return bucket_lo(b) / 1e3;
+	}
+	return 0;
+}
+
+/* wait until fd is ready; in blocking mode the next call just blocks */
+static int wait_fd(int fd, short events, int use_poll)
+{
+	struct pollfd pfd = { .fd = fd, .events = events };
+
+	if(!use_poll)
+		return 0;
+	while(poll(&pfd, 1, -1) < 0)
+		if(errno != EINTR)
+			return -errno;
+	return 0;
+}
+
+static int fd_send(struct chan *c, const char *buf, size_t n, int use_poll)
+{
+	ssize_t ret;
+
+	while(n){
+		ret = write(c->wfd, buf, n);
+		if(ret < 0){
+			if(errno == EAGAIN)
+				ret = wait_fd(c->wfd, POLLOUT, use_poll);
+			else if(errno != EINTR)
+				return -errno;
+			if(ret < 0)
+				return ret;
+			continue;
+		}
+		buf += ret;
+		n -= ret;
+	}
+	return 0;
+}
+
+static int fd_recv(struct chan *c, char *buf, size_t n, int use_poll)
+{
+	ssize_t ret;
+
+	while(n){
+		ret = read(c->rfd, buf, n);
+		if(ret < 0){
+			if(errno == EAGAIN)
+				ret = wait_fd(c->rfd, POLLIN, use_poll);
+			else if(errno != EINTR)
+				return -errno;
+			if(ret < 0)
+				return ret;
+			continue;
+		}
+		if(ret == 0)
+			return -EPIPE;
+		buf += ret;
+		n -= ret;
+	}
+	return 0;
+}
+
+static void fd_teardown(struct chan *c)
+{
+	close(c->rfd);
+	if(c->wfd != c->rfd)
+		close(c->wfd);
+}
+
+static int scull_setup(struct chan *c, int dir, int nonblock)
+{
+	int fl = nonblock ? O_NONBLOCK : 0;
+
+	/* open the read side first so the writer never sees a pipe without readers */
+	c->rfd = open(scull_dev[dir], O_RDONLY | fl);
+	c->wfd = open(scull_dev[dir], O_WRONLY | fl);
+	return c->rfd < 0 || c->wfd < 0 ? -errno : 0;
+}
+
+static int pipe_setup(struct chan *c, int dir, int nonblock)
+{
+	int p[2];
+
+	(void)dir;
+	if(pipe2(p, nonblock ? O_NONBLOCK : 0))
+		return -errno;
+	c->rfd = p[0];
+	c->wfd = p[1];
+	return 0;
+}
+
+/* a socketpair is bidirectional: each direction gets its own anyway */
+static int sock_setup(struct chan *c, int dir, int nonblock)
+{
+	int sv[2];
+
+	(void)dir;
+	if(socketpair(AF_UNIX, SOCK_STREAM | (nonblock ? SOCK_NONBLOCK : 0), 0, sv))
+		return -errno;
+	c->rfd = sv[0];
+	c->wfd = sv[1];
+	return 0;
+}
+
+/*
+ * eventfd + shm: a single producer, single consumer byte ring. The
+ * producer rings data_efd after publishing head, the consumer rings
+ * space_efd after publishing tail, and a side that finds nothing to do
+ * sleeps in read() on its eventfd and looks again.
+ */
+static int shm_setup(struct chan *c, int dir, int nonblock)
+{
+	int fl = EFD_CLOEXEC | (nonblock ? EFD_NONBLOCK : 0);
+	char *m;
+
+	(void)dir;
+	m = mmap(NULL, SHM_RING + 4096, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if(m == MAP_FAILED)
+		return -errno;
+	c->head = (uint32_t *)m;
+	c->tail = (uint32_t *)(m + 64);
+	c->data = m + 4096;
+	c->data_efd = eventfd(0, fl);
+	c->space_efd = eventfd(0, fl);
+	return c->data_efd < 0 || c->space_efd < 0 ? -errno : 0;
+}
+
+static int efd_wait(int efd, int use_poll)
+{
+	uint64_t v;
+
+	for(;;){
+		if(read(efd, &v, sizeof(v)) == sizeof(v))
+			return 0;
+		if(errno == EAGAIN){
+			if(wait_fd(efd, POLLIN, use_poll) < 0)
+				return -errno;
+		} else if(errno != EINTR){
+			return -errno;
+		}
+	}
+}
+
+static int shm_send(struct chan *c, const char *buf, size_t n, int use_poll)
+{
+	uint32_t head = *c->head, tail, off;
+	uint64_t one = 1;
+	size_t room;
+	int ret;
+
+	while(n){
+		tail = __atomic_load_n(c->tail, __ATOMIC_ACQUIRE);
+		room = SHM_RING - (head - tail);
+		if(room == 0){
+			if((ret = efd_wait(c->space_efd, use_poll)))
+				return ret;
+			continue;
+		}
+		off = head & (SHM_RING - 1);
+		if(room > SHM_RING - off)
+			room = SHM_RING - off;
+		if(room > n)
+			room = n;
+		memcpy(c->data + off, buf, room);
+		head += room;
+		__atomic_store_n(c->head, head, __ATOMIC_RELEASE);
+		if(write(c->data_efd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+			return -errno;
+		buf += room;
+		n -= room;
+	}
+	return 0;
+}
+
+static int shm_recv(struct chan *c, char *buf, size_t n, int use_poll)
+{
+	uint32_t tail = *c->tail, head, off;
+	uint64_t one = 1;
+	size_t avail;
+	int ret;
+
+	while(n){
+		head = __atomic_load_n(c->head, __ATOMIC_ACQUIRE);
+		avail = head - tail;
+		if(avail == 0){
+			if((ret = efd_wait(c->data_efd, use_poll)))
+				return ret;
+			continue;
+		}
+		off = tail & (SHM_RING - 1);
+		if(avail > SHM_RING - off)
+			avail = SHM_RING - off;
+		if(avail > n)
+			avail = n;
+		memcpy(buf, c->data + off, avail);
+		tail += avail;
+		__atomic_store_n(c->tail, tail, __ATOMIC_RELEASE);
+		if(write(c->space_efd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+			return -errno;
+		buf += avail;
+		n -= avail;
+	}
+	return 0;
+}
+
+static void shm_teardown(struct chan *c)
+{
+	close(c->data_efd);
+	close(c->space_efd);
+	munmap(c->head, SHM_RING + 4096);
+}
+
+static const struct transport transports[] = {
+	{ "scullpipe", scull_setup, fd_send, fd_recv, fd_teardown },
+	{ "pipe", pipe_setup, fd_send, fd_recv, fd_teardown },
+	{ "socketpair", sock_setup, fd_send, fd_recv, fd_teardown },
+	{ "eventfd+shm", shm_setup, shm_send, shm_recv, shm_teardown },
+};
+#define NTRANSPORTS (sizeof(transports) / sizeof(transports[0]))
+
+static void pin(int cpu)
+{
+	cpu_set_t set;
+
+	if(cpu < 0)
+		return;
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	if(pthread_setaffinity_np(pthread_self(), sizeof(set), &set))
+		fprintf(stderr, "can't pin to cpu %d\n", cpu);
+}
+
+static void fail(struct run *r, int err)
+{
+	__atomic_store_n(&r->err, err, __ATOMIC_RELAXED);
+}
+
+/* the far side: echo every message, then swallow the stream */
+static void *ponger(void *arg)
+{
+	struct run *r = arg;
+	char *buf = malloc(r->size);
+	unsigned long i;
+	int ret = 0;
+
+	pin(r->cpu[1]);
+	for(i = 0; buf && !ret && i < r->warmup + r->iters; i++){
+		ret = r->t->recv(&r->ping, buf, r->size, r->use_poll);
+		if(!ret)
+			ret = r->t->send(&r->pong, buf, r->size, r->use_poll);
+	}
+	for(i = 0; buf && !ret && i < r->nmsgs; i++)
+		ret = r->t->recv(&r->ping, buf, r->size, r->use_poll);
+	/* tell the streaming side we have it all */
+	if(buf && !ret)
+		ret = r->t->send(&r->pong, buf, 1, r->use_poll);
+	if(ret)
+		fail(r, ret);
+	free(buf);
+	return NULL;
+}
+
+static int bench(struct run *r)
+{
+	char *buf = calloc(1, r->size);
+	uint64_t t0, t, sum = 0, max = 0, total;
+	pthread_t tid;
+	unsigned long i;
+	double stream_s;
+	int b, ret = 0;
+
+	r->err = 0;
+	if(!buf)
+		return -ENOMEM;
+	memset(r->hist, 0, NBUCKETS * sizeof(*r->hist));
+	if((ret = r->t->setup(&r->ping, 0, r->use_poll)) || (ret = r->t->setup(&r->pong, 1, r->use_poll))){
+		free(buf);
+		return ret;
+	}
+	pthread_create(&tid, NULL, ponger, r);
+	pin(r->cpu[0]);
+
+	for(i = 0; !ret && i < r->warmup + r->iters; i++){
+		t0 = now_ns();
+		ret = r->t->send(&r->ping, buf, r->size, r->use_poll);
+		if(!ret)
+			ret = r->t->recv(&r->pong, buf, r->size, r->use_poll);
+		t = now_ns() - t0;
+		if(i < r->warmup)
+			continue;
+		r->hist[bucket(t)]++;
+		sum += t;
+		if(t > max)
+			max = t;
+	}
+
+	t0 = now_ns();
+	for(i = 0; !ret && i < r->nmsgs; i++)
+		ret = r->t->send(&r->ping, buf, r->size, r->use_poll);
+	if(!ret)
+		ret = r->t->recv(&r->pong, buf, 1, r->use_poll);
+	stream_s = (now_ns() - t0) / 1e9;
+
+	pthread_join(tid, NULL);
+	r->t->teardown(&r->ping);
+	r->t->teardown(&r->pong);
+	free(buf);
+	if(ret || r->err)
+		return ret ? ret : r->err;
+
+	total = r->iters;
+	printf("rtt,%s,%s,%zu,%lu,%.2f,%.2f,%.2f,%.2f,%.2f,%.1f,%.0f\n", r->t->name,
+	       r->use_poll ? "poll" : "block", r->size, r->iters, sum / 1e3 / total,
+	       hist_percentile(r->hist, total, 0.50), hist_percentile(r->hist, total, 0.99),
+	       hist_percentile(r->hist, total, 0.999), max / 1e3,
+	       r->nmsgs * r->size / stream_s / 1e6, r->nmsgs / stream_s);
+	for(b = 0; b < NBUCKETS; b++)
+		if(r->hist[b])
+			printf("hist,%s,%s,%zu,%llu,%llu,%llu\n", r->t->name, r->use_poll ? "poll" : "block",
+			       r->size, (unsigned long long)bucket_lo(b),
+			       (unsigned long long)bucket_lo(b + 1) - 1, (unsigned long long)r->hist[b]);
+	fflush(stdout);
+	return 0;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [-t transport,...] [-m block|poll|both] [-s size,...] [-i iterations]\n"
+		"          [-w warmup] [-n stream bytes] [-c cpu,cpu] [-d dev,dev]\n"
+		"  -t  scullpipe, pipe, socketpair, eventfd+shm (default all)\n"
+		"  -m  wait by blocking, by poll() on non blocking fds, or both (default)\n"
+		"  -s  message sizes (default 1,64,4k)\n"
+		"  -i  round trips per run (default 100000), after -w warmup ones (default 1000)\n"
+		"  -n  bytes to stream per run (default 64m)\n"
+		"  -c  cpus for the two threads (default unpinned)\n"
+		"  -d  scullpipe devices for the two directions (default /dev/scullpipe0,/dev/scullpipe1)\n",
+		prog);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	struct run r = { .iters = 100000, .warmup = 1000, .cpu = { -1, -1 } };
+	char tnames[256] = "scullpipe,pipe,socketpair,eventfd+shm", sizes[256] = "1,64,4k";
+	char tlist[256], slist[256], *ttok, *stok, *tsave, *ssave, *comma;
+	unsigned long long stream = 64ULL << 20;
+	int opt, modes = 3, mode, ret;
+	unsigned i;
+
+	while((opt = getopt(argc, argv, "t:m:s:i:w:n:c:d:h")) != -1){
+		switch(opt){
+		case 't': snprintf(tnames, sizeof(tnames), "%s", optarg); break;
+		case 'm':
+			modes = !strcmp(optarg, "block") ? 1 : !strcmp(optarg, "poll") ? 2 : 3;
+			break;
+		case 's': snprintf(sizes, sizeof(sizes), "%s", optarg); break;
+		case 'i': r.iters = strtoul(optarg, NULL, 0); break;
+		case 'w': r.warmup = strtoul(optarg, NULL, 0); break;
+		case 'n': stream = parse_size(optarg); break;
+		case 'c':
+			if(sscanf(optarg, "%d,%d", &r.cpu[0], &r.cpu[1]) != 2)
+				usage(argv[0]);
+			break;
+		case 'd':
+			comma = strchr(optarg, ',');
+			if(!comma)
+				usage(argv[0]);
+			*comma = '\0';
+			scull_dev[0] = optarg;
+			scull_dev[1] = comma + 1;
+			break;
+		default: usage(argv[0]);
+		}
+	}
+	if(r.iters == 0)
+		usage(argv[0]);
+	r.hist = calloc(NBUCKETS + 1, sizeof(*r.hist));
+	if(!r.hist)
+		return 1;
+
+	printf("kind,transport,mode,size,iterations,mean_us,p50_us,p99_us,p999_us,max_us,stream_MB/s,stream_msgs/s\n");
+	printf("kind,transport,mode,size,lo_ns,hi_ns,count\n");
+	snprintf(tlist, sizeof(tlist), "%s", tnames);
+	for(ttok = strtok_r(tlist, ",", &tsave); ttok; ttok = strtok_r(NULL, ",", &tsave)){
+		r.t = NULL;
+		for(i = 0; i < NTRANSPORTS; i++)
+			if(!strcmp(ttok, transports[i].name))
+				r.t = &transports[i];
+		if(!r.t)
+			usage(argv[0]);
+		for(mode = 0; mode < 2; mode++){
+			if(!(modes & (1 << mode)))
+				continue;
+			r.use_poll = mode;
+			snprintf(slist, sizeof(slist), "%s", sizes);
+			for(stok = strtok_r(slist, ",", &ssave); stok; stok = strtok_r(NULL, ",", &ssave)){
+				r.size = parse_size(stok);
+				if(r.size == 0)
+					usage(argv[0]);
+				r.nmsgs = stream / r.size;
+				ret = bench(&r);
+				if(ret){
+					fprintf(stderr, "%s/%s/%zu: %s\n", r.t->name, mode ? "poll" : "block",
+						r.size, strerror(-ret));
+					return 1;
+				}
+			}
+		}
+	}
+	free(r.hist);
+	return 0;
+}
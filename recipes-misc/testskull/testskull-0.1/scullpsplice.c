@@ -0,0 +1,275 @@
+/*
+ * scullpsplice: forward a stream from a scullpipe device to a socket,
+ * once with read()+write() through a user buffer and once with splice()
+ * through a pipe, and print the throughput of both as CSV.
+ *
+ * A feeder thread writes the device, the main thread forwards, and a
+ * drain thread reads the other end of a socketpair. With -v the feeder
+ * gifts its data to the kernel: it maps fresh pages, vmsplice()s them
+ * with SPLICE_F_GIFT and unmaps them before splicing them on, so the pipe
+ * holds their only reference. The device may then take the pages instead
+ * of copying them, which it does on the lanes that can't be mapped (-l).
+ */
+#define _GNU_SOURCE
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<errno.h>
+#include<fcntl.h>
+#include<unistd.h>
+#include<pthread.h>
+#include<time.h>
+#include<sys/mman.h>
+#include<sys/uio.h>
+#include<sys/socket.h>
+#include<sys/ioctl.h>
+#include<scull/scull_ioctl.h>
+
+struct run {
+	const char *dev;
+	size_t block;
+	unsigned long long total;
+	int use_vmsplice;
+	int lane;		/* the feeder writes to this lane */
+	int sock;		/* drain side of the socketpair */
+};
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static unsigned long parse_size(const char *s)
+{
+	char *end;
+	unsigned long v = strtoul(s, &end, 0);
+
+	switch(*end){
+	case 'k': case 'K': v <<= 10; break;
+	case 'm': case 'M': v <<= 20; break;
+	case 'g': case 'G': v <<= 30; break;
+	}
+	return v;
+}
+
+/*
+ * Gift up to n bytes of freshly mapped pages to the (empty) pipe, drop the
+ * mapping, then move them on to the device. At most a pipe full goes per
+ * call, since everything has to be in the pipe before the unmap.
+ */
+static ssize_t gift(int fd, int p[2], size_t n, size_t pipesz)
+{
+	size_t page = getpagesize();
+	size_t len, in = 0, out = 0;
+	ssize_t ret;
+	char *buf;
+
+	if(n > pipesz)
+		n = pipesz;
+	len = (n + page - 1) & ~(page - 1);
+	buf = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if(buf == MAP_FAILED)
+		return -1;
+	memset(buf, 0x5a, n);
+	while(in < n){
+		struct iovec iov = { buf + in, n - in };
+
+		ret = vmsplice(p[1], &iov, 1, SPLICE_F_GIFT);
+		if(ret < 0){
+			if(errno == EINTR)
+				continue;
+			munmap(buf, len);
+			return -1;
+		}
+		in += ret;
+	}
+	munmap(buf, len);
+	while(out < in){
+		ret = splice(p[0], NULL, fd, NULL, in - out, SPLICE_F_MOVE);
+		if(ret < 0){
+			if(errno == EINTR)
+				continue;
+			return -1;
+		}
+		out += ret;
+	}
+	return out;
+}
+
+static void *feeder(void *arg)
+{
+	struct run *r = arg;
+	unsigned long long done = 0;
+	int fd, p[2] = { -1, -1 }, pipesz = 0;
+	ssize_t ret;
+	void *buf = NULL;
+
+	if(!r->use_vmsplice){
+		if(posix_memalign(&buf, getpagesize(), r->block))
+			return NULL;
+		memset(buf, 0x5a, r->block);
+	}
+	fd = open(r->dev, O_WRONLY);
+	if(fd < 0 || (r->use_vmsplice && (pipe(p) || (pipesz = fcntl(p[1], F_GETPIPE_SZ)) < 0)) ||
+	   (r->lane && ioctl(fd, SCULL_P_IOCTLANE, r->lane) < 0)){
+		perror(r->dev);
+		exit(1);
+	}
+	while(done < r->total){
+		size_t n = r->block;
+
+		if(n > r->total - done)
+			n = r->total - done;
+		if(r->use_vmsplice)
+			ret = gift(fd, p, n, pipesz);
+		else
+			ret = write(fd, buf, n);
+		if(ret < 0){
+			if(errno == EINTR)
+				continue;
+			perror("feed");
+			exit(1);
+		}
+		done += ret;
+	}
+	close(fd);
+	if(p[0] >= 0){
+		close(p[0]);
+		close(p[1]);
+	}
+	free(buf);
+	return NULL;
+}
+
+static void *drain(void *arg)
+{
+	struct run *r = arg;
+	unsigned long long done = 0;
+	char *buf = malloc(r->block);
+	ssize_t ret;
+
+	while(buf && done < r->total){
+		ret = read(r->sock, buf, r->block);
+		if(ret <= 0){
+			if(ret < 0 && errno == EINTR)
+				continue;
+			break;
+		}
+		done += ret;
+	}
+	free(buf);
+	return NULL;
+}
+
+static int forward(struct run *r, int in, int out, int use_splice)
+{
+	unsigned long long done = 0;
+	char *buf = malloc(r->block);
+	ssize_t got, ret, off;
+	int p[2];
+
+	if(!buf || (use_splice && pipe(p)))
+		return -1;
+	while(done < r->total){
+		if(use_splice)
+			got = splice(in, NULL, p[1], NULL, r->block, SPLICE_F_MOVE);
+		else
+			got = read(in, buf, r->block);
+		if(got <= 0){
+			if(got < 0 && errno == EINTR)
+				continue;
+			perror(use_splice ? "splice in" : "read");
+			return -1;
+		}
+		/* push out everything that came in before fetching more */
+		for(off = 0; off < got; off += ret){
+			if(use_splice)
+				ret = splice(p[0], NULL, out, NULL, got - off, SPLICE_F_MOVE);
+			else
+				ret = write(out, buf + off, got - off);
+			if(ret < 0 && errno == EINTR)
+				ret = 0;
+			else if(ret <= 0){
+				perror(use_splice ? "splice out" : "write");
+				return -1;
+			}
+		}
+		done += got;
+	}
+	if(use_splice){
+		close(p[0]);
+		close(p[1]);
+	}
+	free(buf);
+	return 0;
+}
+
+static int bench(struct run *r, int use_splice)
+{
+	pthread_t feed, sink;
+	int sv[2], in;
+	double t0, t;
+
+	if(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0)
+		return -1;
+	r->sock = sv[1];
+	in = open(r->dev, O_RDONLY);
+	if(in < 0)
+		return -1;
+
+	t0 = now();
+	pthread_create(&sink, NULL, drain, r);
+	pthread_create(&feed, NULL, feeder, r);
+	if(forward(r, in, sv[0], use_splice))
+		return -1;
+	pthread_join(feed, NULL);
+	pthread_join(sink, NULL);
+	t = now() - t0;
+
+	printf("%s,%s,%zu,%llu,%.3f,%.1f\n", use_splice ? "splice" : "read+write",
+	       r->use_vmsplice ? "vmsplice" : "write", r->block, r->total, t, r->total / t / 1e6);
+	fflush(stdout);
+	close(in);
+	close(sv[0]);
+	close(sv[1]);
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	struct run r = { .dev = "/dev/scullpipe0", .block = 64 * 1024, .total = 1ULL << 30 };
+	int opt, holder;
+
+	while((opt = getopt(argc, argv, "d:b:n:l:vh")) != -1){
+		switch(opt){
+		case 'd': r.dev = optarg; break;
+		case 'b': r.block = parse_size(optarg); break;
+		case 'n': r.total = parse_size(optarg); break;
+		case 'l': r.lane = atoi(optarg); break;
+		case 'v': r.use_vmsplice = 1; break;
+		default:
+			fprintf(stderr, "usage: %s [-d device] [-b block] [-n total] [-l lane] [-v]\n"
+				"  -l  feed this priority lane instead of lane 0\n"
+				"  -v  feed the device by gifting pages with vmsplice()+splice() instead of write()\n", argv[0]);
+			return 1;
+		}
+	}
+	if(r.block == 0 || r.total == 0)
+		return 1;
+
+	/* the splice paths work on the byte stream */
+	holder = open(r.dev, O_RDWR | O_NONBLOCK);
+	if(holder < 0 || ioctl(holder, SCULL_P_IOCTRECMODE, SCULL_P_STREAM) < 0){
+		perror(r.dev);
+		return 1;
+	}
+
+	printf("forward,feed,block,bytes,seconds,MB/s\n");
+	if(bench(&r, 0) || bench(&r, 1))
+		return 1;
+	close(holder);
+	return 0;
+}
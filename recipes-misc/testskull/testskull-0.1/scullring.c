@@ -0,0 +1,373 @@
+/*
+ * scullring: io_uring load generator for the scull devices. One thread
+ * keeps a fixed number of reads and/or writes in flight on the device,
+ * with the file and the buffers registered with the ring unless told
+ * otherwise, and one CSV line per queue depth reports IOPS, bandwidth
+ * and latency percentiles.
+ *
+ * The drivers have no nonblocking read_iter/write_iter, so io_uring
+ * hands their requests to io-wq worker threads. How many of them got
+ * punted there is counted with a histogram trigger on the
+ * io_uring_queue_async_work tracepoint when tracefs is writable (root,
+ * CONFIG_HIST_TRIGGERS); otherwise the punted column is empty.
+ */
+#define _GNU_SOURCE
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<errno.h>
+#include<fcntl.h>
+#include<unistd.h>
+#include<time.h>
+#include<stdint.h>
+#include<sys/uio.h>
+#include<liburing.h>
+
+#define SUB_BITS	5
+#define SUB		(1 << SUB_BITS)
+#define NBUCKETS	(2 * SUB + (64 - SUB_BITS - 1) * SUB)
+
+#define PUNT_EVENT	"events/io_uring/io_uring_queue_async_work/trigger"
+
+struct run {
+	const char *dev;
+	int is_pipe;
+	unsigned depth;
+	size_t block;
+	int write_pct;		/* share of writes, in percent */
+	int random;
+	unsigned long long span;
+	double seconds;
+	int fixed_files, fixed_bufs;
+};
+
+static const char *trace_dirs[] = { "/sys/kernel/tracing", "/sys/kernel/debug/tracing" };
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static unsigned long long parse_size(const char *s)
+{
+	char *end;
+	unsigned long long v = strtoull(s, &end, 0);
+
+	switch(*end){
+	case 'k': case 'K': v <<= 10; break;
+	case 'm': case 'M': v <<= 20; break;
+	case 'g': case 'G': v <<= 30; break;
+	}
+	return v;
+}
+
+static uint64_t next_rand(uint64_t *state)
+{
+	uint64_t x = *state;
+
+	x ^= x >> 12;
+	x ^= x << 25;
+	x ^= x >> 27;
+	*state = x;
+	return x * 0x2545f4914f6cdd1dULL;
+}
+
+static int bucket(uint64_t v)
+{
+	int e;
+
+	if(v < 2 * SUB)
+		return v;
+	e = 63 - __builtin_clzll(v);
+	return 2 * SUB + (e - SUB_BITS - 1) * SUB + ((v >> (e - SUB_BITS)) - SUB);
+}
+
+static uint64_t bucket_lo(int b)
+{
+	int e;
+
+	if(b < 2 * SUB)
+		return b;
+	e = (b - 2 * SUB) / SUB + SUB_BITS + 1;
+	return (uint64_t)(SUB + (b - 2 * SUB) % SUB) << (e - SUB_BITS);
+}
+
+static double hist_percentile(uint64_t *hist, uint64_t total, double p)
+{
+	uint64_t seen = 0, want = (uint64_t)(p * total);
+	int b;
+
+	for(b = 0; b < NBUCKETS; b++){
+		seen += hist[b];
+		if(seen > want)
+			return bucket_lo(b) / 1e3;
+	}
+	return 0;
+}
+
+static int write_file(const char *dir, const char *name, const char *text)
+{
+	char path[256];
+	int fd, ret;
+
+	snprintf(path, sizeof(path), "%s/%s", dir, name);
+	fd = open(path, O_WRONLY | O_APPEND);
+	if(fd < 0)
+		return -1;
+	ret = write(fd, text, strlen(text)) < 0 ? -1 : 0;
+	close(fd);
+	return ret;
+}
+
+/* arm the punt counter; returns the tracefs directory, or NULL */
+static const char *punt_start(void)
+{
+	unsigned i;
+
+	for(i = 0; i < sizeof(trace_dirs) / sizeof(trace_dirs[0]); i++)
+		if(write_file(trace_dirs[i], PUNT_EVENT, "hist:keys=common_pid\n") == 0)
+			return trace_dirs[i];
+	return NULL;
+}
+
+/* read our count off the histogram and take the trigger away again */
+static long punt_stop(const char *dir)
+{
+	char path[256], line[256];
+	long pid, hits, total = -1;
+	FILE *f;
+
+	if(!dir)
+		return -1;
+	snprintf(path, sizeof(path), "%s/events/io_uring/io_uring_queue_async_work/hist", dir);
+	f = fopen(path, "r");
+	if(f){
+		total = 0;
+		while(fgets(line, sizeof(line), f))
+			if(sscanf(line, "{ common_pid: %ld } hitcount: %ld", &pid, &hits) == 2 && pid == getpid())
+				total += hits;
+		fclose(f);
+	}
+	write_file(dir, PUNT_EVENT, "!hist:keys=common_pid\n");
+	return total;
+}
+
+static int bench(struct run *r, int fd, char **bufs, struct iovec *iov)
+{
+	struct io_uring ring;
+	struct io_uring_sqe *sqe;
+	struct io_uring_cqe *cqe;
+	uint64_t *start = calloc(r->depth, sizeof(*start));
+	uint64_t *hist = calloc(NBUCKETS, sizeof(*hist));
+	uint64_t seed = 0x9e3779b97f4a7c15ULL, t0, end, lat, ios = 0, bytes = 0;
+	unsigned long long nblocks = r->span / r->block, seq = 0;
+	unsigned i, inflight = 0;
+	const char *trace;
+	long punted;
+	double t;
+	int ret, target, writing;
+
+	ret = start && hist ? io_uring_queue_init(r->depth, &ring, 0) : -ENOMEM;
+	if(ret < 0){
+		free(start);
+		free(hist);
+		return ret;
+	}
+	if(r->fixed_files && (ret = io_uring_register_files(&ring, &fd, 1)) < 0)
+		goto out;
+	if(r->fixed_bufs && (ret = io_uring_register_buffers(&ring, iov, r->depth)) < 0)
+		goto out;
+	target = r->fixed_files ? 0 : fd;
+
+	trace = punt_start();
+	t0 = now_ns();
+	end = t0 + r->seconds * 1e9;
+	for(;;){
+		/* top the queue up: slot i is free when start[i] is 0 */
+		for(i = 0; i < r->depth && now_ns() < end; i++){
+			off_t off;
+
+			if(start[i])
+				continue;
+			sqe = io_uring_get_sqe(&ring);
+			if(!sqe)
+				break;
+			writing = (int)(next_rand(&seed) % 100) < r->write_pct;
+			if(r->is_pipe)
+				off = -1; /* the pipes have no position */
+			else if(r->random)
+				off = (next_rand(&seed) % nblocks) * r->block;
+			else
+				off = (seq++ % nblocks) * r->block;
+			if(r->fixed_bufs && writing)
+				io_uring_prep_write_fixed(sqe, target, bufs[i], r->block, off, i);
+			else if(r->fixed_bufs)
+				io_uring_prep_read_fixed(sqe, target, bufs[i], r->block, off, i);
+			else if(writing)
+				io_uring_prep_write(sqe, target, bufs[i], r->block, off);
+			else
+				io_uring_prep_read(sqe, target, bufs[i], r->block, off);
+			if(r->fixed_files)
+				io_uring_sqe_set_flags(sqe, IOSQE_FIXED_FILE);
+			io_uring_sqe_set_data(sqe, (void *)(uintptr_t)i);
+			start[i] = now_ns();
+			inflight++;
+		}
+		if(!inflight)
+			break;
+		if(now_ns() < end){
+			ret = io_uring_submit_and_wait(&ring, 1);
+			if(ret < 0 && ret != -EINTR)
+				goto out_trace;
+		} else {
+			/*
+			 * Time is up. On a pipe the last reads may wait for data
+			 * nobody writes anymore: whatever is still blocked after a
+			 * while is cancelled by io_uring_queue_exit().
+			 */
+			struct __kernel_timespec ts = { .tv_nsec = 200000000 };
+
+			io_uring_submit(&ring);
+			if(io_uring_wait_cqe_timeout(&ring, &cqe, &ts) == -ETIME)
+				break;
+		}
+		while(io_uring_peek_cqe(&ring, &cqe) == 0){
+			i = (uintptr_t)io_uring_cqe_get_data(cqe);
+			lat = now_ns() - start[i];
+			start[i] = 0;
+			inflight--;
+			if(cqe->res < 0){
+				ret = cqe->res;
+				io_uring_cqe_seen(&ring, cqe);
+				goto out_trace;
+			}
+			hist[bucket(lat)]++;
+			ios++;
+			bytes += cqe->res;
+			io_uring_cqe_seen(&ring, cqe);
+		}
+	}
+	ret = 0;
+  out_trace:
+	t = (now_ns() - t0) / 1e9;
+	punted = punt_stop(trace);
+	if(!ret){
+		printf("%s,%u,%zu,%d,%s,%d,%d,%llu,%.3f,%.0f,%.1f,%.2f,%.2f,%.2f,", r->dev, r->depth, r->block,
+		       r->write_pct, r->random ? "rand" : "seq", r->fixed_files, r->fixed_bufs,
+		       (unsigned long long)ios, t, ios / t, bytes / t / 1e6, hist_percentile(hist, ios, 0.50),
+		       hist_percentile(hist, ios, 0.99), hist_percentile(hist, ios, 0.999));
+		if(punted >= 0)
+			printf("%ld,%.3f\n", punted, ios ? (double)punted / ios : 0);
+		else
+			printf(",\n");
+		fflush(stdout);
+	}
+  out:
+	io_uring_queue_exit(&ring);
+	free(start);
+	free(hist);
+	return ret;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [-d device] [-q depth,...] [-b block] [-w write%%] [-r] [-S span] [-t seconds] [-F] [-R]\n"
+		"  -d  scull_char or scullpipe device (default /dev/scull_char0)\n"
+		"  -q  queue depths to try (default 1,4,16,64)\n"
+		"  -b  bytes per request (default 4k)\n"
+		"  -w  percentage of writes (default 0 on memory devices, 50 on pipes)\n"
+		"  -r  random offsets instead of sequential ones (memory devices)\n"
+		"  -S  bytes of the device to cover (default 16m)\n"
+		"  -t  seconds per queue depth (default 5)\n"
+		"  -F  plain file descriptors instead of fixed files\n"
+		"  -R  plain buffers instead of registered ones\n", prog);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	struct run r = { .dev = "/dev/scull_char0", .block = 4096, .write_pct = -1,
+			 .span = 16ULL << 20, .seconds = 5, .fixed_files = 1, .fixed_bufs = 1 };
+	char depths[256] = "1,4,16,64", tmp[256], *tok, *save;
+	unsigned maxdepth = 0, i;
+	struct iovec *iov;
+	char **bufs;
+	int opt, fd, ret;
+
+	while((opt = getopt(argc, argv, "d:q:b:w:rS:t:FRh")) != -1){
+		switch(opt){
+		case 'd': r.dev = optarg; break;
+		case 'q': snprintf(depths, sizeof(depths), "%s", optarg); break;
+		case 'b': r.block = parse_size(optarg); break;
+		case 'w': r.write_pct = atoi(optarg); break;
+		case 'r': r.random = 1; break;
+		case 'S': r.span = parse_size(optarg); break;
+		case 't': r.seconds = atof(optarg); break;
+		case 'F': r.fixed_files = 0; break;
+		case 'R': r.fixed_bufs = 0; break;
+		default: usage(argv[0]);
+		}
+	}
+	r.is_pipe = strstr(r.dev, "scullpipe") != NULL || strstr(r.dev, "scullmq") != NULL;
+	if(r.write_pct < 0)
+		r.write_pct = r.is_pipe ? 50 : 0;
+	if(r.block == 0 || r.span < r.block || r.write_pct > 100)
+		usage(argv[0]);
+
+	/* one buffer per slot of the deepest queue */
+	snprintf(tmp, sizeof(tmp), "%s", depths);
+	for(tok = strtok_r(tmp, ",", &save); tok; tok = strtok_r(NULL, ",", &save))
+		if((unsigned)atoi(tok) > maxdepth)
+			maxdepth = atoi(tok);
+	if(maxdepth == 0)
+		usage(argv[0]);
+	bufs = calloc(maxdepth, sizeof(*bufs));
+	iov = calloc(maxdepth, sizeof(*iov));
+	for(i = 0; bufs && iov && i < maxdepth; i++){
+		if(posix_memalign((void **)&bufs[i], 4096, r.block))
+			break;
+		memset(bufs[i], 0x5a, r.block);
+		iov[i] = (struct iovec){ bufs[i], r.block };
+	}
+	if(!bufs || !iov || i < maxdepth){
+		fprintf(stderr, "out of memory\n");
+		return 1;
+	}
+
+	fd = open(r.dev, O_RDWR);
+	if(fd < 0){
+		perror(r.dev);
+		return 1;
+	}
+	/* reads of a memory device need data to find */
+	if(!r.is_pipe && r.write_pct < 100){
+		unsigned long long off;
+
+		for(off = 0; off < r.span; off += ret){
+			ret = pwrite(fd, bufs[0], r.block, off);
+			if(ret <= 0){
+				perror("prefill");
+				return 1;
+			}
+		}
+	}
+
+	printf("device,depth,block,write_pct,pattern,fixed_files,fixed_bufs,ios,seconds,IOPS,MB/s,"
+	       "p50_us,p99_us,p999_us,punted,punt_share\n");
+	for(tok = strtok_r(depths, ",", &save); tok; tok = strtok_r(NULL, ",", &save)){
+		r.depth = atoi(tok);
+		if(r.depth == 0)
+			continue;
+		ret = bench(&r, fd, bufs, iov);
+		if(ret < 0){
+			fprintf(stderr, "%s, depth %u: %s\n", r.dev, r.depth, strerror(-ret));
+			return 1;
+		}
+	}
+	close(fd);
+	return 0;
+}
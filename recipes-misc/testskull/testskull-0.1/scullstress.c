@@ -0,0 +1,540 @@
+/*
+ * scullstress: many writers and readers at once on a scull_char or a
+ * scullpipe device, with every payload sequence numbered and checksummed
+ * so that lost, torn, duplicated or reordered data shows up.
+ *
+ * Memory devices: every writer owns a set of slots, one per quantum at
+ * sparse offsets (-g quanta apart), and keeps rewriting random ones of
+ * them with a growing sequence number after an lseek(). Readers read
+ * random slots, never written ones included: a slot must be a hole or
+ * hold an intact record, and its sequence number must never go back.
+ * At the end every slot must hold its writer's last record.
+ *
+ * Pipes run in record mode so each write() stays one message. Every
+ * reader must see each writer's records in order, and together the
+ * readers must get each record exactly once.
+ *
+ * Half the threads use O_NONBLOCK and poll(), a signal thread keeps
+ * interrupting blocked calls with SIGUSR1, and a churn thread opens and
+ * closes the device all the time. One CSV line per thread count reports
+ * the throughput, the EINTR/EAGAIN returns and the anomalies found;
+ * the anomalies themselves go to stderr.
+ */
+#define _GNU_SOURCE
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<errno.h>
+#include<fcntl.h>
+#include<unistd.h>
+#include<poll.h>
+#include<pthread.h>
+#include<signal.h>
+#include<time.h>
+#include<stdint.h>
+#include<stdarg.h>
+#include<sys/ioctl.h>
+#include<scull/scull_ioctl.h>
+
+#define REC_MAGIC	0x5c011dae
+#define MAX_WRITERS	256
+#define MAX_REPORTS	20	/* anomalies printed per run */
+
+struct rec {
+	uint32_t magic;
+	uint16_t writer;
+	uint16_t len;		/* payload bytes after the header */
+	uint32_t seq;
+	uint32_t slot;
+	uint32_t crc;		/* over header (crc = 0) and payload */
+};
+
+struct run {
+	const char *dev;
+	int is_pipe;
+	int nthreads;		/* writers, and as many readers */
+	size_t maxlen;		/* largest payload */
+	long quantum;
+	unsigned gap;		/* quanta between two slots */
+	unsigned slots;		/* per writer */
+	volatile int stop;	/* writers stop */
+	volatile int drained;	/* readers stop */
+
+	/* memory device: last sequence number written to each slot */
+	uint32_t *slot_seq;
+	/* pipe: records each writer sent, and the readers got */
+	unsigned long sent[MAX_WRITERS], got[MAX_WRITERS];
+	unsigned long long seqsum[MAX_WRITERS];
+
+	unsigned long long ops, bytes;
+	unsigned long eintr, eagain, anomalies, opens;
+	pthread_mutex_t report_lock;
+};
+
+struct worker {
+	struct run *r;
+	int id;
+	int nonblock;
+	pthread_t tid;
+};
+
+static uint32_t crc_table[256];
+
+static void crc_init(void)
+{
+	uint32_t c;
+	int i, k;
+
+	for(i = 0; i < 256; i++){
+		for(c = i, k = 0; k < 8; k++)
+			c = c & 1 ? 0xedb88320 ^ (c >> 1) : c >> 1;
+		crc_table[i] = c;
+	}
+}
+
+static uint32_t crc32(const void *p, size_t n)
+{
+	const unsigned char *s = p;
+	uint32_t c = ~0U;
+
+	while(n--)
+		c = crc_table[(c ^ *s++) & 0xff] ^ (c >> 8);
+	return ~c;
+}
+
+static uint64_t next_rand(uint64_t *state)
+{
+	uint64_t x = *state;
+
+	x ^= x >> 12;
+	x ^= x << 25;
+	x ^= x >> 27;
+	*state = x;
+	return x * 0x2545f4914f6cdd1dULL;
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void count(unsigned long *c)
+{
+	__atomic_add_fetch(c, 1, __ATOMIC_RELAXED);
+}
+
+static void anomaly(struct run *r, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+static void anomaly(struct run *r, const char *fmt, ...)
+{
+	va_list ap;
+
+	pthread_mutex_lock(&r->report_lock);
+	if(r->anomalies++ < MAX_REPORTS){
+		fprintf(stderr, "%s, %d threads: ", r->dev, r->nthreads);
+		va_start(ap, fmt);
+		vfprintf(stderr, fmt, ap);
+		va_end(ap);
+		fputc('\n', stderr);
+	}
+	pthread_mutex_unlock(&r->report_lock);
+}
+
+static size_t rec_build(char *buf, int writer, uint32_t seq, uint32_t slot, size_t len)
+{
+	struct rec *h = (struct rec *)buf;
+	uint64_t fill = ((uint64_t)writer << 32 | seq) + 1;
+	size_t i;
+
+	*h = (struct rec){ REC_MAGIC, writer, len, seq, slot, 0 };
+	for(i = 0; i < len; i++)
+		buf[sizeof(*h) + i] = next_rand(&fill);
+	h->crc = crc32(buf, sizeof(*h) + len);
+	return sizeof(*h) + len;
+}
+
+/* 0 if buf holds an intact record of n bytes (or at least n, with exact 0) */
+static int rec_check(struct rec *h, size_t n, int exact)
+{
+	uint32_t crc = h->crc;
+	int bad;
+
+	if(n < sizeof(*h) || h->magic != REC_MAGIC || h->writer >= MAX_WRITERS)
+		return -1;
+	if(sizeof(*h) + h->len > n || (exact && sizeof(*h) + h->len != n))
+		return -1;
+	h->crc = 0;
+	bad = crc32(h, sizeof(*h) + h->len) != crc;
+	h->crc = crc;
+	return bad ? -1 : 0;
+}
+
+static off_t slot_offset(struct run *r, int writer, unsigned slot)
+{
+	return ((off_t)slot * r->nthreads + writer) * r->gap * r->quantum;
+}
+
+/* wait for fd in non blocking mode; a signal just ends the wait early */
+static void wait_fd(struct run *r, int fd, short events)
+{
+	struct pollfd pfd = { .fd = fd, .events = events };
+
+	count(&r->eagain);
+	poll(&pfd, 1, 50);
+}
+
+static void *writer(void *arg)
+{
+	struct worker *w = arg;
+	struct run *r = w->r;
+	uint64_t seed = 0x9e3779b97f4a7c15ULL * (w->id + 1);
+	char *buf = malloc(sizeof(struct rec) + r->maxlen);
+	uint32_t seq = 0;
+	unsigned slot = 0;
+	size_t len;
+	ssize_t ret;
+	int fd;
+
+	fd = open(r->dev, O_WRONLY | (w->nonblock ? O_NONBLOCK : 0));
+	if(fd < 0 || !buf){
+		anomaly(r, "writer %d: can't start: %s", w->id, strerror(fd < 0 ? errno : ENOMEM));
+		free(buf);
+		return NULL;
+	}
+	while(!r->stop){
+		len = next_rand(&seed) % (r->maxlen + 1);
+		if(!r->is_pipe){
+			slot = next_rand(&seed) % r->slots;
+			seq = r->slot_seq[w->id * r->slots + slot] + 1;
+			if(lseek(fd, slot_offset(r, w->id, slot), SEEK_SET) < 0){
+				anomaly(r, "writer %d: lseek: %s", w->id, strerror(errno));
+				break;
+			}
+		}
+		len = rec_build(buf, w->id, seq, slot, len);
+		ret = write(fd, buf, len);
+		if(ret < 0){
+			if(errno == EINTR)
+				count(&r->eintr);
+			else if(errno == EAGAIN)
+				wait_fd(r, fd, POLLOUT);
+			else {
+				anomaly(r, "writer %d: write: %s", w->id, strerror(errno));
+				break;
+			}
+			continue;
+		}
+		if((size_t)ret != len){
+			anomaly(r, "writer %d: short write, %zd of %zu bytes", w->id, ret, len);
+			break;
+		}
+		if(r->is_pipe){
+			r->sent[w->id]++;
+			seq++;
+		} else {
+			r->slot_seq[w->id * r->slots + slot] = seq;
+		}
+		__atomic_add_fetch(&r->ops, 1, __ATOMIC_RELAXED);
+		__atomic_add_fetch(&r->bytes, len, __ATOMIC_RELAXED);
+	}
+	close(fd);
+	free(buf);
+	return NULL;
+}
+
+static void check_slot(struct run *r, int id, char *buf, ssize_t n, unsigned slot_index, uint32_t *seen)
+{
+	struct rec *h = (struct rec *)buf;
+	int owner = slot_index % r->nthreads;
+	unsigned slot = slot_index / r->nthreads;
+
+	if(n == 0){
+		/* a hole, or past the end: fine unless the slot had data before */
+		if(seen[slot_index])
+			anomaly(r, "reader %d: slot %u lost its data (had seq %u)", id, slot_index, seen[slot_index]);
+		return;
+	}
+	if(rec_check(h, n, 0) || h->writer != owner || h->slot != slot){
+		anomaly(r, "reader %d: slot %u holds a torn or misplaced record", id, slot_index);
+		return;
+	}
+	if(h->seq < seen[slot_index])
+		anomaly(r, "reader %d: slot %u went back from seq %u to %u", id, slot_index,
+			seen[slot_index], h->seq);
+	seen[slot_index] = h->seq;
+}
+
+static void *reader(void *arg)
+{
+	struct worker *w = arg;
+	struct run *r = w->r;
+	uint64_t seed = 0x7f4a7c159e3779b9ULL * (w->id + 1);
+	size_t bufsize = sizeof(struct rec) + r->maxlen;
+	unsigned nslots = r->slots * r->nthreads, s;
+	uint32_t *seen = calloc(r->is_pipe ? MAX_WRITERS : nslots, sizeof(*seen));
+	char *buf = malloc(bufsize);
+	struct rec *h = (struct rec *)buf;
+	ssize_t n;
+	int fd;
+
+	fd = open(r->dev, O_RDONLY | (w->nonblock ? O_NONBLOCK : 0));
+	if(fd < 0 || !buf || !seen){
+		anomaly(r, "reader %d: can't start: %s", w->id, strerror(fd < 0 ? errno : ENOMEM));
+		goto out;
+	}
+	while(!r->drained){
+		s = 0;
+		if(!r->is_pipe){
+			if(r->stop)
+				break;
+			s = next_rand(&seed) % nslots;
+			/* a memory device read may stop at the end of a quantum: a slot fits one */
+			if(s & 1)
+				n = pread(fd, buf, bufsize, slot_offset(r, s % r->nthreads, s / r->nthreads));
+			else if(lseek(fd, slot_offset(r, s % r->nthreads, s / r->nthreads), SEEK_SET) < 0)
+				n = -1;
+			else
+				n = read(fd, buf, bufsize);
+		} else {
+			n = read(fd, buf, bufsize);
+		}
+		if(n < 0){
+			if(errno == EINTR)
+				count(&r->eintr);
+			else if(errno == EAGAIN)
+				wait_fd(r, fd, POLLIN);
+			else
+				anomaly(r, "reader %d: read: %s", w->id, strerror(errno));
+			continue;
+		}
+		if(!r->is_pipe){
+			check_slot(r, w->id, buf, n, s, seen);
+			continue;
+		}
+		if(rec_check(h, n, 1)){
+			anomaly(r, "reader %d: torn record of %zd bytes", w->id, n);
+			continue;
+		}
+		/* seen[] holds the next sequence number expected at least, plus one */
+		if(seen[h->writer] && h->seq < seen[h->writer])
+			anomaly(r, "reader %d: writer %u went back from seq %u to %u", w->id, h->writer,
+				seen[h->writer] - 1, h->seq);
+		seen[h->writer] = h->seq + 1;
+		__atomic_add_fetch(&r->got[h->writer], 1, __ATOMIC_RELAXED);
+		__atomic_add_fetch(&r->seqsum[h->writer], h->seq, __ATOMIC_RELAXED);
+	}
+	close(fd);
+  out:
+	free(seen);
+	free(buf);
+	return NULL;
+}
+
+/* open/close churn, both directions */
+static void *churn(void *arg)
+{
+	struct worker *w = arg;
+	struct run *r = w->r;
+	int fd, i = 0;
+
+	while(!r->drained){
+		fd = open(r->dev, (i++ & 1 ? O_RDONLY : O_WRONLY) | O_NONBLOCK);
+		if(fd >= 0){
+			close(fd);
+			count(&r->opens);
+		} else if(errno != EINTR){
+			anomaly(r, "churn: open: %s", strerror(errno));
+			usleep(1000);
+		}
+	}
+	return NULL;
+}
+
+static void on_signal(int sig)
+{
+	(void)sig;
+}
+
+static int pipe_finished(struct run *r)
+{
+	int i;
+
+	for(i = 0; i < r->nthreads; i++)
+		if(r->got[i] != r->sent[i])
+			return 0;
+	return 1;
+}
+
+static int stress(struct run *r, double seconds, int use_signals)
+{
+	struct worker *w = calloc(2 * r->nthreads + 1, sizeof(*w));
+	uint64_t seed = 42;
+	unsigned long long want;
+	double t0, t, deadline;
+	int i, holder;
+
+	if(!w)
+		return -1;
+	r->stop = r->drained = 0;
+	r->ops = r->bytes = 0;
+	r->eintr = r->eagain = r->anomalies = r->opens = 0;
+	memset(r->sent, 0, sizeof(r->sent));
+	memset(r->got, 0, sizeof(r->got));
+	memset(r->seqsum, 0, sizeof(r->seqsum));
+
+	/* start from an empty device */
+	holder = open(r->dev, O_RDWR | O_NONBLOCK | (r->is_pipe ? 0 : O_TRUNC));
+	if(holder < 0){
+		perror(r->dev);
+		free(w);
+		return -1;
+	}
+	if(r->is_pipe){
+		char *buf = malloc(65536);
+
+		if(ioctl(holder, SCULL_P_IOCTRECMODE, SCULL_P_STREAM) < 0)
+			perror("stream mode");
+		while(buf && read(holder, buf, 65536) > 0)
+			;
+		free(buf);
+		if(ioctl(holder, SCULL_P_IOCTRECMODE, SCULL_P_RECORD) < 0){
+			perror("record mode");
+			free(w);
+			return -1;
+		}
+	} else {
+		r->quantum = ioctl(holder, SCULL_IOCQQUANTUM);
+		if(r->quantum <= 0)
+			r->quantum = 4000; /* a scull without the ioctls: the LDD3 default */
+		if(sizeof(struct rec) + r->maxlen > (size_t)r->quantum)
+			r->maxlen = r->quantum - sizeof(struct rec);
+		free(r->slot_seq);
+		r->slot_seq = calloc(r->nthreads * r->slots, sizeof(*r->slot_seq));
+		if(!r->slot_seq)
+			return -1;
+	}
+
+	t0 = now();
+	for(i = 0; i < 2 * r->nthreads; i++){
+		w[i] = (struct worker){ .r = r, .id = i % r->nthreads, .nonblock = (i / 2) & 1 };
+		pthread_create(&w[i].tid, NULL, i < r->nthreads ? writer : reader, &w[i]);
+	}
+	w[i] = (struct worker){ .r = r };
+	pthread_create(&w[i].tid, NULL, churn, &w[i]);
+
+	deadline = t0 + seconds;
+	while((t = now()) < deadline){
+		usleep(use_signals ? 2000 : 100000);
+		if(use_signals)
+			pthread_kill(w[next_rand(&seed) % (2 * r->nthreads)].tid, SIGUSR1);
+	}
+	r->stop = 1;
+	for(i = 0; i < r->nthreads; i++)
+		pthread_join(w[i].tid, NULL);
+	t = now() - t0;
+
+	/* give the readers two seconds to get the rest */
+	deadline = now() + 2;
+	while(r->is_pipe && !pipe_finished(r) && now() < deadline)
+		usleep(1000);
+	r->drained = 1;
+	for(i = r->nthreads; i < 2 * r->nthreads + 1; i++){
+		/* blocked readers only come back for a signal */
+		while(pthread_tryjoin_np(w[i].tid, NULL) == EBUSY){
+			pthread_kill(w[i].tid, SIGUSR1);
+			usleep(1000);
+		}
+	}
+
+	if(r->is_pipe){
+		for(i = 0; i < r->nthreads; i++){
+			want = r->sent[i] ? (unsigned long long)r->sent[i] * (r->sent[i] - 1) / 2 : 0;
+			if(r->got[i] != r->sent[i])
+				anomaly(r, "writer %d sent %lu records, readers got %lu", i, r->sent[i], r->got[i]);
+			else if(r->seqsum[i] != want)
+				anomaly(r, "writer %d: records duplicated and lost", i);
+		}
+	} else {
+		unsigned s, nslots = r->slots * r->nthreads;
+		char *buf = malloc(sizeof(struct rec) + r->maxlen);
+		struct rec *h = (struct rec *)buf;
+		ssize_t n;
+
+		/* every slot must hold the last record its writer put there */
+		for(s = 0; buf && s < nslots; s++){
+			uint32_t want_seq = r->slot_seq[(s % r->nthreads) * r->slots + s / r->nthreads];
+
+			n = pread(holder, buf, sizeof(*h) + r->maxlen,
+				  slot_offset(r, s % r->nthreads, s / r->nthreads));
+			if(want_seq == 0 ? n > 0 : n <= 0 || rec_check(h, n, 0) || h->seq != want_seq)
+				anomaly(r, "slot %u: expected seq %u at the end", s, want_seq);
+		}
+		free(buf);
+	}
+	close(holder);
+
+	printf("%s,%s,%d,%llu,%llu,%.3f,%.1f,%.0f,%lu,%lu,%lu,%lu\n", r->dev, r->is_pipe ? "pipe" : "memory",
+	       r->nthreads, r->ops, r->bytes, t, r->bytes / t / 1e6, r->ops / t, r->eintr, r->eagain,
+	       r->opens, r->anomalies);
+	fflush(stdout);
+	free(w);
+	return 0;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [-d device] [-T threads,...] [-t seconds] [-s maxlen] [-S slots] [-g gap] [-N]\n"
+		"  -d  a scull_char or scullpipe device (default /dev/scull_char0)\n"
+		"  -T  writer (and reader) counts to try (default 1,2,4,8)\n"
+		"  -t  seconds per run (default 5)\n"
+		"  -s  largest payload in bytes (default 512)\n"
+		"  -S  slots per writer on a memory device (default 64)\n"
+		"  -g  quanta between slots, for sparse files (default 3)\n"
+		"  -N  no signals\n", prog);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	struct run r = { .dev = "/dev/scull_char0", .maxlen = 512, .slots = 64, .gap = 3 };
+	char threads[256] = "1,2,4,8", *tok, *save;
+	struct sigaction sa = { .sa_handler = on_signal };
+	double seconds = 5;
+	int opt, use_signals = 1, failed = 0;
+
+	while((opt = getopt(argc, argv, "d:T:t:s:S:g:Nh")) != -1){
+		switch(opt){
+		case 'd': r.dev = optarg; break;
+		case 'T': snprintf(threads, sizeof(threads), "%s", optarg); break;
+		case 't': seconds = atof(optarg); break;
+		case 's': r.maxlen = strtoul(optarg, NULL, 0); break;
+		case 'S': r.slots = strtoul(optarg, NULL, 0); break;
+		case 'g': r.gap = strtoul(optarg, NULL, 0); break;
+		case 'N': use_signals = 0; break;
+		default: usage(argv[0]);
+		}
+	}
+	if(r.slots == 0 || r.gap == 0 || r.maxlen > 65535)
+		usage(argv[0]);
+	r.is_pipe = strstr(r.dev, "scullpipe") != NULL;
+	crc_init();
+	pthread_mutex_init(&r.report_lock, NULL);
+	/* no SA_RESTART: blocked calls must come back with EINTR */
+	sigaction(SIGUSR1, &sa, NULL);
+
+	printf("device,kind,threads,ops,bytes,seconds,MB/s,ops/s,eintr,eagain,opens,anomalies\n");
+	for(tok = strtok_r(threads, ",", &save); tok; tok = strtok_r(NULL, ",", &save)){
+		r.nthreads = atoi(tok);
+		if(r.nthreads <= 0 || r.nthreads > MAX_WRITERS)
+			usage(argv[0]);
+		if(stress(&r, seconds, use_signals))
+			return 1;
+		failed |= r.anomalies != 0;
+	}
+	free(r.slot_seq);
+	return failed ? 2 : 0;
+}